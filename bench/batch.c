@@ -0,0 +1,155 @@
+// Runs many short programs that share their code but start with different
+// registers and data, as scalar Cpus one after another and as lockstep batches.
+// Usage: batch [lanes...]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "batch.h"
+
+#define PROGRAMS 4096
+#define DATA_ADDR 0x0200
+#define DATA_SIZE 64
+
+// Mixes DATA_SIZE bytes at DATA_ADDR into C, D and E, with a data-dependent branch
+static const uint8_t program[] = {
+    0x21, 0x00, 0x02, //       LXI H,0200h
+    0x06, DATA_SIZE,  //       MVI B,DATA_SIZE
+    0x7E,             // loop: MOV A,M
+    0xA9,             //       XRA C
+    0x07,             //       RLC
+    0x83,             //       ADD E
+    0x5F,             //       MOV E,A
+    0xFE, 0x80,       //       CPI 80h
+    0xDA, 0x11, 0x01, //       JC skip
+    0x0C,             //       INR C
+    0x14,             //       INR D
+    0x7A,             // skip: MOV A,D
+    0x8B,             //       ADC E
+    0x57,             //       MOV D,A
+    0x23,             //       INX H
+    0x05,             //       DCR B
+    0xC2, 0x05, 0x01, //       JNZ loop
+    0x76,             //       HLT
+};
+
+static unsigned char* new_memory(void) {
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    memcpy(memory + 0x100, program, sizeof(program));
+    return memory;
+}
+
+static uint8_t next_random(uint32_t* state) {
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 24;
+}
+
+// Writes the data of program n and sets up its starting registers
+static void setup_program(Cpu* cpu, unsigned char* memory, unsigned n) {
+    uint32_t state = n * 2654435761u;
+    cpu_init(cpu, memory);
+    for (int i = 0; i < DATA_SIZE; i++) memory[DATA_ADDR + i] = next_random(&state);
+    cpu->c = next_random(&state);
+    cpu->e = next_random(&state);
+}
+
+static bool same_registers(Cpu* x, Cpu* y) {
+    cpu_sync_flags(x);
+    cpu_sync_flags(y);
+    return x->psw == y->psw && x->bc == y->bc && x->de == y->de && x->hl == y->hl &&
+        x->sp == y->sp && x->pc == y->pc && x->cycles == y->cycles;
+}
+
+static void run_scalar(Cpu* results, unsigned char* memory) {
+    for (unsigned n = 0; n < PROGRAMS; n++) {
+        Cpu* cpu = &results[n];
+        setup_program(cpu, memory, n);
+        while (memory[cpu->pc] != 0x76) cpu_execute(cpu);
+    }
+}
+
+// Adds the batch instruction counts to ops[0] (whole group) and ops[1] (lane by lane)
+static void run_batch(Cpu* results, unsigned char** memory, CpuBatch* batch, unsigned lanes, uint64_t* ops) {
+    for (unsigned base = 0; base < PROGRAMS; base += lanes) {
+        batch_init(batch, lanes);
+        batch->shared_code = true;
+        for (unsigned lane = 0; lane < lanes && base + lane < PROGRAMS; lane++) {
+            Cpu cpu;
+            setup_program(&cpu, memory[lane], base + lane);
+            batch_load(batch, lane, &cpu);
+        }
+        batch_run(batch, UINT64_MAX);
+        ops[0] += batch->vector_ops;
+        ops[1] += batch->lane_ops;
+        for (unsigned lane = 0; lane < lanes && base + lane < PROGRAMS; lane++) {
+            cpu_init(&results[base + lane], memory[lane]);
+            batch_store(batch, lane, &results[base + lane]);
+        }
+    }
+}
+
+static uint64_t total_cycles(const Cpu* results) {
+    uint64_t cycles = 0;
+    for (unsigned n = 0; n < PROGRAMS; n++) cycles += results[n].cycles;
+    return cycles;
+}
+
+int main(int argc, char** argv) {
+    static const unsigned default_lanes[] = { 8, 16, 32 };
+    unsigned num_configs = argc > 1 ? (unsigned)argc - 1 : 3;
+    unsigned* configs = malloc(num_configs * sizeof(unsigned));
+    for (unsigned i = 0; i < num_configs; i++) {
+        configs[i] = argc > 1 ? (unsigned)atoi(argv[i + 1]) : default_lanes[i];
+        if (configs[i] < 1 || configs[i] > BATCH_MAX_LANES) {
+            fprintf(stderr, "Usage: %s [lanes...], lanes between 1 and %d\n", argv[0], BATCH_MAX_LANES);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Cpu* expected = malloc(PROGRAMS * sizeof(Cpu));
+    Cpu* results = malloc(PROGRAMS * sizeof(Cpu));
+    unsigned char* memory[BATCH_MAX_LANES];
+    for (int lane = 0; lane < BATCH_MAX_LANES; lane++) memory[lane] = new_memory();
+
+    unsigned runs = 0;
+    double seconds;
+    double start = bench_now();
+    do {
+        run_scalar(expected, memory[0]);
+        runs++;
+        seconds = bench_now() - start;
+    } while (seconds < BENCH_MIN_SECONDS);
+    double scalar_rate = PROGRAMS * runs / seconds;
+    uint64_t cycles = total_cycles(expected);
+    printf("scalar    %5u runs %8.3fs %12.0f lanes/s %9.2f MHz\n", runs, seconds, scalar_rate,
+        cycles * runs / seconds / 1e6);
+
+    int status = EXIT_SUCCESS;
+    CpuBatch batch;
+    for (unsigned i = 0; i < num_configs; i++) {
+        uint64_t ops[2] = { 0, 0 };
+        runs = 0;
+        start = bench_now();
+        do {
+            run_batch(results, memory, &batch, configs[i], ops);
+            runs++;
+            seconds = bench_now() - start;
+        } while (seconds < BENCH_MIN_SECONDS);
+
+        double rate = PROGRAMS * runs / seconds;
+        printf("%2u lanes  %5u runs %8.3fs %12.0f lanes/s %9.2f MHz %6.2fx vs scalar, %.1f%% vectorized\n",
+            configs[i], runs, seconds, rate, total_cycles(results) * runs / seconds / 1e6, rate / scalar_rate,
+            100.0 * ops[0] / (ops[0] + ops[1]));
+        for (unsigned n = 0; n < PROGRAMS; n++) {
+            if (!same_registers(&expected[n], &results[n])) {
+                printf("%2u lanes  MISMATCH in program %u\n", configs[i], n);
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+    }
+
+    for (int lane = 0; lane < BATCH_MAX_LANES; lane++) free(memory[lane]);
+    free(expected);
+    free(results);
+    free(configs);
+    return status;
+}
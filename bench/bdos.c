@@ -0,0 +1,119 @@
+// BDOS file I/O: a guest writes a file of 128-byte records sequentially, reads
+// it back sequentially and then reads every record once in a scattered order,
+// checking each one. Runs with the default read ahead and write behind, and
+// with one host read or write per record.
+// Usage: bdos [records], a power of two from 256 to 32768
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <unistd.h>
+#include "bdos.h"
+#include "hooks.h"
+
+#define DEFAULT_RECORDS 32768
+#define ROUNDS 3
+
+// Make BENCH.DAT, write records stamped with their number from the DMA buffer, close
+static const uint8_t write_program[] = { 0x11, 0x5C, 0x00, 0x0E, 0x16, 0xCD, 0x05, 0x00, 0x21, 0x00, 0x00, 0x22,
+    0x40, 0x00, 0x2A, 0x40, 0x00, 0x22, 0x80, 0x00, 0x11, 0x5C, 0x00, 0x0E, 0x15, 0xCD, 0x05, 0x00, 0x2A, 0x40,
+    0x00, 0x23, 0x22, 0x40, 0x00, 0x7C, 0xFE, 0x00, 0xC2, 0x0E, 0x01, 0x11, 0x5C, 0x00, 0x0E, 0x10, 0xCD, 0x05,
+    0x00, 0xC3, 0x00, 0x00 };
+#define WRITE_COUNT_HI 0x25
+
+// Open, read sequentially to the end of the file, counting records
+static const uint8_t read_program[] = { 0x11, 0x5C, 0x00, 0x0E, 0x0F, 0xCD, 0x05, 0x00, 0x21, 0x00, 0x00, 0x22,
+    0x40, 0x00, 0x11, 0x5C, 0x00, 0x0E, 0x14, 0xCD, 0x05, 0x00, 0xB7, 0xC2, 0x24, 0x01, 0x2A, 0x40, 0x00, 0x23,
+    0x22, 0x40, 0x00, 0xC3, 0x0E, 0x01, 0xC3, 0x00, 0x00 };
+
+// Open, then read records r += 1EAFh modulo the record count, checking each stamp
+static const uint8_t random_program[] = { 0x11, 0x5C, 0x00, 0x0E, 0x0F, 0xCD, 0x05, 0x00, 0x21, 0x00, 0x00, 0x22,
+    0x40, 0x00, 0x22, 0x42, 0x00, 0x2A, 0x42, 0x00, 0x11, 0xAF, 0x1E, 0x19, 0x7C, 0xE6, 0x00, 0x67, 0x22, 0x42,
+    0x00, 0x22, 0x7D, 0x00, 0xAF, 0x32, 0x7F, 0x00, 0x11, 0x5C, 0x00, 0x0E, 0x21, 0xCD, 0x05, 0x00, 0xB7, 0xC2,
+    0x50, 0x01, 0x2A, 0x80, 0x00, 0xEB, 0x2A, 0x42, 0x00, 0x7D, 0xBB, 0xC2, 0x50, 0x01, 0x7C, 0xBA, 0xC2, 0x50,
+    0x01, 0x2A, 0x40, 0x00, 0x23, 0x22, 0x40, 0x00, 0x7C, 0xFE, 0x00, 0xC2, 0x11, 0x01, 0xC3, 0x00, 0x00 };
+#define RANDOM_MASK 0x1A
+#define RANDOM_COUNT_HI 0x4C
+
+enum { WRITE, READ, RANDOM };
+
+// Runs one program against bdos, returns the record count it left at 0x0040
+static uint16_t run(Bdos* bdos, unsigned char* memory, const uint8_t* program, size_t size, double* seconds) {
+    memset(memory, 0, BENCH_MEMORY_SIZE);
+    memcpy(memory + 0x100, program, size);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    Hooks hooks;
+    hooks_init(&hooks, &cpu);
+    bdos_attach(bdos, &hooks, &cpu);
+    bdos_set_command_line(&cpu, "BENCH.DAT");
+    bdos->dma = 0x0080;
+
+    double start = bench_now();
+    while (!cpu.halted) cpu_run(&cpu, UINT64_MAX);
+    *seconds = bench_now() - start;
+    uint16_t count = memory[0x40] | memory[0x41] << 8;
+    cpu_free(&cpu);
+    return count;
+}
+
+int main(int argc, char** argv) {
+    unsigned long records = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+    char dir[] = "/tmp/bdos-bench-XXXXXX";
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    if (memory == NULL || records < 256 || records > 32768 || (records & (records - 1))) {
+        fprintf(stderr, "Usage: %s [records], a power of two from 256 to 32768\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t write_code[sizeof(write_program)], random_code[sizeof(random_program)];
+    memcpy(write_code, write_program, sizeof(write_program));
+    memcpy(random_code, random_program, sizeof(random_program));
+    write_code[WRITE_COUNT_HI] = (uint8_t)(records >> 8);
+    random_code[RANDOM_COUNT_HI] = (uint8_t)(records >> 8);
+    random_code[RANDOM_MASK] = (uint8_t)((records >> 8) - 1);
+    const uint8_t* programs[] = { write_code, read_program, random_code };
+    size_t sizes[] = { sizeof(write_code), sizeof(read_program), sizeof(random_code) };
+    static const char* phases[] = { "write", "read", "random" };
+
+    printf("%lu records, %lu KiB\n", records, records * BDOS_RECORD_SIZE / 1024);
+    int status = EXIT_SUCCESS;
+    static const size_t block_sizes[] = { BDOS_BLOCK_SIZE, BDOS_RECORD_SIZE };
+    for (int mode = 0; mode < 2; mode++) {
+        double best[3] = { 0 };
+        double host_ops[3] = { 0 };
+        for (int round = 0; round < ROUNDS; round++) {
+            Console console;
+            console_init(&console, NULL);
+            Bdos bdos;
+            bdos_init(&bdos, &console, dir);
+            bdos.block_size = block_sizes[mode];
+            for (int phase = WRITE; phase <= RANDOM; phase++) {
+                uint64_t ops = bdos.host_reads + bdos.host_writes;
+                double seconds;
+                uint16_t count = run(&bdos, memory, programs[phase], sizes[phase], &seconds);
+                if (count != records) {
+                    printf("%s: %u of %lu records\n", phases[phase], count, records);
+                    status = EXIT_FAILURE;
+                }
+                if (round == 0 || seconds < best[phase]) best[phase] = seconds;
+                host_ops[phase] = (double)(bdos.host_reads + bdos.host_writes - ops) / records;
+            }
+            if (!bdos_free(&bdos)) status = EXIT_FAILURE;
+            console_free(&console);
+        }
+        printf("%s\n", mode == 0 ? "read ahead and write behind" : "one host call per record");
+        for (int phase = WRITE; phase <= RANDOM; phase++) {
+            printf("  %-6s %10.0f records/s %8.1f MB/s %6.3f host calls per record\n", phases[phase],
+                records / best[phase], records * BDOS_RECORD_SIZE / best[phase] / 1e6, host_ops[phase]);
+        }
+    }
+
+    char path[sizeof(dir) + 16];
+    snprintf(path, sizeof(path), "%s/BENCH.DAT", dir);
+    unlink(path);
+    rmdir(dir);
+    free(memory);
+    return status;
+}
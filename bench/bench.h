@@ -0,0 +1,69 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "cpu.h"
+
+#define BENCH_MEMORY_SIZE 0x10000
+#define BENCH_SLICE 10000
+#define BENCH_MIN_SECONDS 0.5
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Loads a CP/M .COM test rom at 0x100. BDOS calls at 0x0005 fall through to a
+// RET at 0x0007 without printing, and the warm boot vector at 0x0000 becomes a
+// HLT, so every run loop stops right where the program ends.
+static inline unsigned char* bench_load_rom(const char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    fread(memory + 0x100, 1, BENCH_MEMORY_SIZE - 0x100, fp);
+    fclose(fp);
+
+    memory[0x00] = 0x76;
+    memory[0x07] = 0xC9;
+    return memory;
+}
+
+// Runs a loaded rom to completion with the given run loop, returns T-states executed
+static inline uint64_t bench_run_rom(Cpu* cpu, uint64_t (*run)(Cpu*, uint64_t)) {
+    while (!cpu->halted) {
+        run(cpu, BENCH_SLICE);
+    }
+    return cpu->cycles;
+}
+
+static inline bool bench_same_state(Cpu* x, Cpu* y) {
+    cpu_sync_flags(x);
+    cpu_sync_flags(y);
+    return x->psw == y->psw && x->bc == y->bc && x->de == y->de && x->hl == y->hl &&
+        x->sp == y->sp && x->pc == y->pc && x->cycles == y->cycles &&
+        memcmp(x->memory, y->memory, BENCH_MEMORY_SIZE) == 0;
+}
+
+// FNV-1a over registers, flags, cycles and memory. Lets builds with different
+// core options (FLAGS=lazy) be checked against each other.
+static inline uint64_t bench_state_hash(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    uint8_t regs[] = { cpu->a, cpu->f, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l,
+        cpu->sp >> 8, cpu->sp & 0xFF, cpu->pc >> 8, cpu->pc & 0xFF };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(regs); i++) hash = (hash ^ regs[i]) * 0x100000001b3ULL;
+    for (int i = 0; i < 8; i++) hash = (hash ^ ((cpu->cycles >> (i * 8)) & 0xFF)) * 0x100000001b3ULL;
+    for (size_t i = 0; i < BENCH_MEMORY_SIZE; i++) hash = (hash ^ cpu->memory[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+#endif
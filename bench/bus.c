@@ -0,0 +1,126 @@
+// Measures what the paged memory bus costs against the flat memory pointer on
+// a load/store heavy copy loop, with every page RAM, with the code in ROM,
+// with a bank switched lower 48 KiB and with the source page behind MMIO.
+// Usage: bus [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "bus.h"
+
+#define DEFAULT_CYCLES 500000000ULL
+#define ROUNDS 9
+#define SRC_PAGE 0x20
+#define DST_PAGE 0x30
+
+// Copies the 256 bytes at 2000h to 3000h, incrementing each, forever
+static const uint8_t program[] = {
+    0x21, 0x00, SRC_PAGE, // outer: LXI H,2000h
+    0x11, 0x00, DST_PAGE, //        LXI D,3000h
+    0x06, 0x00,           //        MVI B,0
+    0x7E,                 // inner: MOV A,M
+    0x3C,                 //        INR A
+    0x12,                 //        STAX D
+    0x23,                 //        INX H
+    0x13,                 //        INX D
+    0x05,                 //        DCR B
+    0xC2, 0x08, 0x01,     //        JNZ inner
+    0xC3, 0x00, 0x01,     //        JMP outer
+};
+
+typedef enum { CONFIG_RAW, CONFIG_RAM, CONFIG_ROM, CONFIG_BANKED, CONFIG_MMIO } Config;
+
+static const char* const config_names[] = { "raw", "ram", "rom", "banked", "mmio" };
+
+#define NUM_CONFIGS (sizeof(config_names) / sizeof(config_names[0]))
+
+typedef struct {
+    const char* name;
+    uint64_t (*run)(Cpu*, uint64_t);
+} Strategy;
+
+// cpu_run_threaded hands a cpu with a bus to cpu_run_switch, so it is left out
+static const Strategy strategies[] = {
+    { "switch", cpu_run_switch },
+#ifdef CPU_HAVE_THREADED
+    { "cached", cpu_run_cached },
+#endif
+};
+
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+static uint8_t read_source(void* ctx, uint16_t addr) {
+    (void)ctx;
+    return addr * 7;
+}
+
+static Bus* setup(Cpu* cpu, unsigned char* memory, Config config) {
+    memset(memory, 0, BENCH_MEMORY_SIZE);
+    memcpy(memory + 0x100, program, sizeof(program));
+    for (int i = 0; i < 0x100; i++) memory[SRC_PAGE << 8 | i] = i * 7;
+    cpu_init(cpu, memory);
+    if (config == CONFIG_RAW) return NULL;
+
+    Bus* bus = bus_create(memory);
+    if (bus == NULL) {
+        fprintf(stderr, "Could not allocate the bus\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config == CONFIG_ROM) bus_map_rom(bus, 0x01, 1, memory + 0x100, NULL, NULL);
+    if (config == CONFIG_BANKED && !bus_set_banks(bus, 0x00, 0xC0, 4)) {
+        fprintf(stderr, "Could not allocate the banks\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config == CONFIG_MMIO) bus_map_io(bus, SRC_PAGE, 1, read_source, NULL, NULL);
+    cpu->bus = bus;
+    return bus;
+}
+
+// Registers, cycles and the destination page as the cpu sees it
+static uint64_t state_hash(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    uint64_t words[] = { cpu->psw, cpu->bc, cpu->de, cpu->hl, cpu->sp, cpu->pc, cpu->cycles };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    for (int i = 0; i < 0x100; i++) hash = (hash ^ cpu_get_content_addr(cpu, DST_PAGE << 8 | i)) * 0x100000001b3ULL;
+    return hash;
+}
+
+static uint64_t raw_hash[NUM_STRATEGIES];
+static bool mismatch[NUM_STRATEGIES][NUM_CONFIGS];
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = malloc(BENCH_MEMORY_SIZE);
+    if (memory == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Configs take turns and keep their best time, which evens out clock changes
+    int status = EXIT_SUCCESS;
+    for (size_t s = 0; s < NUM_STRATEGIES; s++) {
+        double best[NUM_CONFIGS] = { 0 };
+        for (int round = 0; round < ROUNDS; round++) {
+            for (size_t c = 0; c < NUM_CONFIGS; c++) {
+                Cpu cpu;
+                Bus* bus = setup(&cpu, memory, c);
+                double start = bench_now();
+                strategies[s].run(&cpu, cycles);
+                double seconds = bench_now() - start;
+                if (round == 0 || seconds < best[c]) best[c] = seconds;
+                // MMIO reads return the same bytes as the RAM source page
+                uint64_t hash = state_hash(&cpu);
+                if (c == CONFIG_RAW) raw_hash[s] = hash;
+                if (hash != raw_hash[s]) mismatch[s][c] = true;
+                cpu_free(&cpu);
+                bus_destroy(bus);
+            }
+        }
+        for (size_t c = 0; c < NUM_CONFIGS; c++) {
+            printf("%-9s %-7s %8.3fs %9.2f MHz %6.2fx vs raw%s\n", strategies[s].name, config_names[c], best[c],
+                cycles / best[c] / 1e6, best[CONFIG_RAW] / best[c], mismatch[s][c] ? "  MISMATCH" : "");
+            if (mismatch[s][c]) status = EXIT_FAILURE;
+        }
+    }
+    free(memory);
+    return status;
+}
@@ -0,0 +1,117 @@
+// Console output: a guest printing lines with BDOS function 9 and one
+// character at a time with function 2, into /dev/null through one stdio
+// call per character as before, a stream flushed by line and by buffer, a
+// file descriptor, and into an in-memory capture.
+// Usage: console [lines], a multiple of 256 below 65536
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include "bdos.h"
+#include "hooks.h"
+
+#define DEFAULT_LINES 32768
+#define ROUNDS 3
+
+static const char message[] = "The quick brown fox jumps over the lazy dog 0123456789 abcdefg\r\n$";
+#define MESSAGE_LEN (sizeof(message) - 2)
+
+// Print the line at 0200h with function 9, count lines at 0040h
+static const uint8_t string_program[] = { 0x21, 0x00, 0x00, 0x22, 0x40, 0x00, 0x11, 0x00, 0x02, 0x0E, 0x09, 0xCD,
+    0x05, 0x00, 0x2A, 0x40, 0x00, 0x23, 0x22, 0x40, 0x00, 0x7C, 0xFE, 0x00, 0xC2, 0x06, 0x01, 0xC3, 0x00, 0x00 };
+#define STRING_LINES_HI 0x17
+
+// Print it with function 2 up to the $
+static const uint8_t char_program[] = { 0x21, 0x00, 0x00, 0x22, 0x40, 0x00, 0x21, 0x00, 0x02, 0x7E, 0xFE, 0x24,
+    0xCA, 0x1B, 0x01, 0xE5, 0x5F, 0x0E, 0x02, 0xCD, 0x05, 0x00, 0xE1, 0x23, 0xC3, 0x09, 0x01, 0x2A, 0x40, 0x00,
+    0x23, 0x22, 0x40, 0x00, 0x7C, 0xFE, 0x00, 0xC2, 0x06, 0x01, 0xC3, 0x00, 0x00 };
+#define CHAR_LINES_HI 0x24
+
+// The output path before buffering, one stdio call per character
+static bool putc_sink(void* ctx, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) fputc(data[i], ctx);
+    return true;
+}
+
+enum { PER_CHAR, FILE_LINE, FILE_FULL, FD_FULL, CAPTURE, MODES };
+
+static void set_mode(Console* console, int mode, FILE* fp, int fd) {
+    switch (mode) {
+        case PER_CHAR: console_set_sink(console, putc_sink, fp, CONSOLE_FLUSH_WRITE); break;
+        case FILE_LINE: console_set_file(console, fp, CONSOLE_FLUSH_LINE); break;
+        case FILE_FULL: console_set_file(console, fp, CONSOLE_FLUSH_FULL); break;
+        case FD_FULL: console_set_fd(console, fd, CONSOLE_FLUSH_FULL); break;
+        case CAPTURE: console_set_sink(console, NULL, NULL, CONSOLE_FLUSH_EXIT); break;
+    }
+}
+
+// Runs program printing through console, returns the lines it counted
+static uint16_t run(Console* console, unsigned char* memory, const uint8_t* program, size_t size, double* seconds) {
+    memset(memory, 0, BENCH_MEMORY_SIZE);
+    memcpy(memory + 0x100, program, size);
+    memcpy(memory + 0x200, message, sizeof(message) - 1);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    Hooks hooks;
+    hooks_init(&hooks, &cpu);
+    Bdos bdos;
+    bdos_init(&bdos, console, ".");
+    bdos_attach(&bdos, &hooks, &cpu);
+
+    double start = bench_now();
+    while (!cpu.halted) cpu_run(&cpu, UINT64_MAX);
+    console_flush(console);
+    *seconds = bench_now() - start;
+    bdos_free(&bdos);
+    cpu_free(&cpu);
+    return memory[0x40] | memory[0x41] << 8;
+}
+
+int main(int argc, char** argv) {
+    unsigned long lines = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LINES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    FILE* fp = fopen("/dev/null", "w");
+    int fd = open("/dev/null", O_WRONLY);
+    if (memory == NULL || lines == 0 || lines >= 65536 || lines % 256) {
+        fprintf(stderr, "Usage: %s [lines], a multiple of 256 below 65536\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (fp == NULL || fd < 0) {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t string_code[sizeof(string_program)], char_code[sizeof(char_program)];
+    memcpy(string_code, string_program, sizeof(string_program));
+    memcpy(char_code, char_program, sizeof(char_program));
+    string_code[STRING_LINES_HI] = (uint8_t)(lines >> 8);
+    char_code[CHAR_LINES_HI] = (uint8_t)(lines >> 8);
+    const uint8_t* programs[] = { string_code, char_code };
+    size_t sizes[] = { sizeof(string_code), sizeof(char_code) };
+    static const char* modes[] = { "fputc per char", "stream by line", "stream by buffer", "fd by buffer", "capture" };
+
+    printf("%lu lines of %zu characters\n%-18s %14s %14s\n", lines, MESSAGE_LEN, "", "function 9", "function 2");
+    int status = EXIT_SUCCESS;
+    for (int mode = 0; mode < MODES; mode++) {
+        printf("%-18s", modes[mode]);
+        for (int program = 0; program < 2; program++) {
+            double best = 0;
+            for (int round = 0; round < ROUNDS; round++) {
+                Console console;
+                console_init(&console, NULL);
+                set_mode(&console, mode, fp, fd);
+                double seconds;
+                uint16_t count = run(&console, memory, programs[program], sizes[program], &seconds);
+                if (count != lines || (mode == CAPTURE && console.len != lines * MESSAGE_LEN)) status = EXIT_FAILURE;
+                if (round == 0 || seconds < best) best = seconds;
+                console_free(&console);
+            }
+            printf(" %9.1f MB/s", lines * MESSAGE_LEN / best / 1e6);
+        }
+        printf("\n");
+    }
+    if (status != EXIT_SUCCESS) printf("MISMATCH: a guest printed the wrong number of lines\n");
+    fclose(fp);
+    close(fd);
+    free(memory);
+    return status;
+}
@@ -0,0 +1,90 @@
+// Compares the switch and computed-goto dispatch loops, the block cache and the
+// JIT on CP/M test roms.
+// Usage: dispatch rom...
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "jit.h"
+
+#ifdef CPU_HAVE_JIT
+static uint64_t run_jit(Cpu* cpu, uint64_t cycle_budget) {
+    if (cpu->jit == NULL && !jit_attach(cpu)) {
+        fprintf(stderr, "Could not map memory for the JIT\n");
+        exit(EXIT_FAILURE);
+    }
+    return cpu_run_cached(cpu, cycle_budget);
+}
+#endif
+
+typedef struct {
+    const char* name;
+    uint64_t (*run)(Cpu*, uint64_t);
+} Strategy;
+
+static const Strategy strategies[] = {
+    { "switch", cpu_run_switch },
+#ifdef CPU_HAVE_THREADED
+    { "threaded", cpu_run_threaded },
+    { "cached", cpu_run_cached },
+#endif
+#ifdef CPU_HAVE_JIT
+    { "jit", run_jit },
+#endif
+};
+
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rom...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = 1; i < argc; i++) {
+        Cpu cpus[NUM_STRATEGIES];
+        double mhz[NUM_STRATEGIES];
+        for (size_t s = 0; s < NUM_STRATEGIES; s++) {
+            // Short roms are repeated so every measurement covers at least BENCH_MIN_SECONDS
+            uint64_t cycles = 0;
+            unsigned runs = 0;
+            double seconds;
+            double start = bench_now();
+            do {
+                if (runs++) {
+                    free(cpus[s].memory);
+                    cpu_free(&cpus[s]);
+                }
+                cpu_init(&cpus[s], bench_load_rom(argv[i]));
+                cycles += bench_run_rom(&cpus[s], strategies[s].run);
+                seconds = bench_now() - start;
+            } while (seconds < BENCH_MIN_SECONDS);
+            mhz[s] = cycles / seconds / 1e6;
+            printf("%-20s %-9s %6u runs %14llu cycles %8.3fs %9.2f MHz\n", argv[i], strategies[s].name,
+                runs, (unsigned long long)cycles, seconds, mhz[s]);
+#ifdef CPU_HAVE_JIT
+            if (cpus[s].jit) {
+                printf("%-20s %-9s %llu blocks translated, %llu rejected, %llu arena resets\n", argv[i],
+                    strategies[s].name, (unsigned long long)cpus[s].jit->blocks_translated,
+                    (unsigned long long)cpus[s].jit->blocks_rejected,
+                    (unsigned long long)cpus[s].jit->arena_resets);
+            }
+#endif
+        }
+        for (size_t s = 1; s < NUM_STRATEGIES; s++) {
+            if (!bench_same_state(&cpus[0], &cpus[s])) {
+                printf("%-20s %-9s MISMATCH against %s\n", argv[i], strategies[s].name, strategies[0].name);
+                status = EXIT_FAILURE;
+            }
+            else {
+                printf("%-20s %-9s %.2fx vs %s\n", argv[i], strategies[s].name, mhz[s] / mhz[0],
+                    strategies[0].name);
+            }
+        }
+        printf("%-20s state hash %016llx\n", argv[i], (unsigned long long)bench_state_hash(&cpus[0]));
+        for (size_t s = 0; s < NUM_STRATEGIES; s++) {
+            free(cpus[s].memory);
+            cpu_free(&cpus[s]);
+        }
+    }
+    return status;
+}
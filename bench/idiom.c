@@ -0,0 +1,92 @@
+// Block memory loops: copy, overlapping copy, fill and compare loops run
+// forever, through the threaded loop one instruction at a time and through
+// the block cache, which runs them with memmove, memset and memcmp. Both runs
+// must end in the same state.
+// Usage: idiom [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "block_cache.h"
+
+#define DEFAULT_CYCLES 50000000ULL
+#define ROUNDS 3
+
+typedef struct {
+    const char* name;
+    uint8_t code[32];
+} Program;
+
+static const Program programs[] = {
+    // LXI H,1000h; LXI D,3000h; LXI B,1000h
+    // loop: MOV A,M; STAX D; INX H; INX D; DCX B; MOV A,B; ORA C; JNZ loop; LXI H,1000h; INR M; JMP 0100h
+    { "copy", { 0x21, 0x00, 0x10, 0x11, 0x00, 0x30, 0x01, 0x00, 0x10, 0x7E, 0x12, 0x23, 0x13, 0x0B, 0x78, 0xB1,
+        0xC2, 0x09, 0x01, 0x21, 0x00, 0x10, 0x34, 0xC3, 0x00, 0x01 } },
+    // LXI H,1000h; LXI D,1001h; MVI B,0
+    // loop: MOV A,M; STAX D; INX H; INX D; DCR B; JNZ loop; LXI H,1000h; INR M; JMP 0100h
+    { "smear", { 0x21, 0x00, 0x10, 0x11, 0x01, 0x10, 0x06, 0x00, 0x7E, 0x12, 0x23, 0x13, 0x05, 0xC2, 0x08, 0x01,
+        0x21, 0x00, 0x10, 0x34, 0xC3, 0x00, 0x01 } },
+    // LXI H,2000h; LXI B,2000h; loop: MOV M,D; INX H; DCX B; MOV A,B; ORA C; JNZ loop; INR D; JMP 0100h
+    { "fill", { 0x21, 0x00, 0x20, 0x01, 0x00, 0x20, 0x72, 0x23, 0x0B, 0x78, 0xB1, 0xC2, 0x06, 0x01, 0x14, 0xC3, 0x00, 0x01 } },
+    // LXI H,2000h; MVI C,0; loop: MVI M,E5h; INX H; DCR C; JNZ loop; JMP 0100h
+    { "fill8", { 0x21, 0x00, 0x20, 0x0E, 0x00, 0x36, 0xE5, 0x23, 0x0D, 0xC2, 0x05, 0x01, 0xC3, 0x00, 0x01 } },
+    // LXI H,1000h; LXI D,3000h; LXI B,1000h
+    // loop: LDAX D; CMP M; JNZ out; INX H; INX D; DCX B; MOV A,B; ORA C; JNZ loop; out: JMP 0100h
+    { "compare", { 0x21, 0x00, 0x10, 0x11, 0x00, 0x30, 0x01, 0x00, 0x10, 0x1A, 0xBE, 0xC2, 0x16, 0x01, 0x13, 0x23,
+        0x0B, 0x78, 0xB1, 0xC2, 0x09, 0x01, 0xC3, 0x00, 0x01 } },
+};
+
+#define NUM_PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+
+// Two equal 4K buffers at 1000h and 3000h that differ at 3C00h
+static void load(unsigned char* memory, const Program* program) {
+    memset(memory, 0, BENCH_MEMORY_SIZE);
+    memcpy(memory + 0x100, program->code, sizeof(program->code));
+    for (int i = 0; i < 0x1000; i++) memory[0x1000 + i] = memory[0x3000 + i] = i * 7 + 3;
+    memory[0x3C00] ^= 0xFF;
+}
+
+int main(int argc, char** argv) {
+#ifdef CPU_HAVE_THREADED
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    if (memory == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    for (size_t p = 0; p < NUM_PROGRAMS; p++) {
+        double best[2] = { 0 };
+        uint64_t hash[2] = { 0 };
+        uint64_t idiom_cycles = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            for (int cached = 0; cached < 2; cached++) {
+                load(memory, &programs[p]);
+                Cpu cpu;
+                cpu_init(&cpu, memory);
+                double start = bench_now();
+                if (cached) cpu_run_cached(&cpu, cycles);
+                else cpu_run_threaded(&cpu, cycles);
+                double seconds = bench_now() - start;
+                if (round == 0 || seconds < best[cached]) best[cached] = seconds;
+                hash[cached] = bench_state_hash(&cpu);
+                if (cached) idiom_cycles = cpu.block_cache->idiom_cycles;
+                cpu_free(&cpu);
+            }
+        }
+        printf("%-8s threaded %8.3fs %9.2f MHz\n", programs[p].name, best[0], cycles / best[0] / 1e6);
+        printf("%-8s cached   %8.3fs %9.2f MHz %6.2fx, %.1f%% of T-states in idioms\n", programs[p].name, best[1],
+            cycles / best[1] / 1e6, best[0] / best[1], 100.0 * idiom_cycles / cycles);
+        if (hash[0] != hash[1]) {
+            printf("%-8s MISMATCH: state %016llx vs %016llx\n", programs[p].name, (unsigned long long)hash[0],
+                (unsigned long long)hash[1]);
+            status = EXIT_FAILURE;
+        }
+    }
+    free(memory);
+    return status;
+#else
+    (void)argc;
+    fprintf(stderr, "%s needs the block cache, which this compiler does not support\n", argv[0]);
+    return EXIT_FAILURE;
+#endif
+}
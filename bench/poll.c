@@ -0,0 +1,117 @@
+// Busy-wait fast-forward: a guest that polls a memory flag set by a frame
+// interrupt and one that polls a stable port set by a frame event, run through
+// sched_run with and without skipping polling loops. Both runs must end in the
+// same state.
+// Usage: poll [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "ports.h"
+#include "sched.h"
+
+#define DEFAULT_CYCLES 100000000ULL
+#define ROUNDS 3
+#define PERIOD 33333
+#define PORT 0x10
+
+typedef struct {
+    const char* name;
+    uint8_t code[20];
+    bool interrupts; // the frame raises RST 1 instead of setting the port
+} Program;
+
+static const Program programs[] = {
+    // LXI SP,F000h; EI; loop: LDA 0200h; ORA A; JZ loop; XRA A; STA 0200h; INR B; JMP loop
+    { "memory", { 0x31, 0x00, 0xF0, 0xFB, 0x3A, 0x00, 0x02, 0xB7, 0xCA, 0x04, 0x01, 0xAF, 0x32, 0x00, 0x02, 0x04,
+        0xC3, 0x04, 0x01 }, true },
+    // loop: IN 10h; ANI 01h; JZ loop; OUT 10h; INR B; JMP loop
+    { "port", { 0xDB, PORT, 0xE6, 0x01, 0xCA, 0x00, 0x01, 0xD3, PORT, 0x04, 0xC3, 0x00, 0x01 }, false },
+};
+
+// RST 1: PUSH PSW; MVI A,1; STA 0200h; POP PSW; EI; RET
+static const uint8_t handler[] = { 0xF5, 0x3E, 0x01, 0x32, 0x00, 0x02, 0xF1, 0xFB, 0xC9 };
+
+#define NUM_PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+
+// The port reads 1 from a frame until the guest acknowledges it with OUT
+typedef struct {
+    const Program* program;
+    uint8_t ready;
+} Device;
+
+static uint8_t device_read(void* ctx, uint8_t port) {
+    (void)port;
+    return ((Device*)ctx)->ready;
+}
+
+static void device_write(void* ctx, uint8_t port, uint8_t value) {
+    (void)port;
+    (void)value;
+    ((Device*)ctx)->ready = 0;
+}
+
+static void frame(Scheduler* sched, void* ctx, uint64_t time) {
+    Device* device = ctx;
+    if (device->program->interrupts) sched_request_interrupt(sched, 1);
+    else device->ready = 1;
+    sched_post(sched, time + PERIOD, frame, ctx);
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    Ports* ports = ports_create();
+    if (memory == NULL || ports == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    for (size_t p = 0; p < NUM_PROGRAMS; p++) {
+        Device device = { &programs[p], 0 };
+        ports_attach(ports, PORT, device_read, device_write, &device);
+        ports_set_stable(ports, PORT, true);
+
+        double best[2] = { 0 };
+        uint64_t hash[2] = { 0 };
+        uint64_t frames[2] = { 0 };
+        uint64_t loops = 0, skipped = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            for (int skip = 0; skip < 2; skip++) {
+                memset(memory, 0, BENCH_MEMORY_SIZE);
+                memcpy(memory + 0x100, programs[p].code, sizeof(programs[p].code));
+                memcpy(memory + 0x08, handler, sizeof(handler));
+                device.ready = 0;
+                Cpu cpu;
+                cpu_init(&cpu, memory);
+                cpu.ports = ports;
+                Scheduler sched;
+                sched_init(&sched);
+                sched.skip_polls = skip;
+                sched_post(&sched, PERIOD, frame, &device);
+
+                double start = bench_now();
+                sched_run(&sched, &cpu, cycles);
+                double seconds = bench_now() - start;
+                if (round == 0 || seconds < best[skip]) best[skip] = seconds;
+                hash[skip] = bench_state_hash(&cpu);
+                frames[skip] = cpu.b;
+                loops = sched.polls_skipped;
+                skipped = sched.poll_cycles_skipped;
+                cpu_free(&cpu);
+                sched_free(&sched);
+            }
+        }
+        printf("%-6s spin %8.3fs %9.2f MHz\n", programs[p].name, best[0], cycles / best[0] / 1e6);
+        printf("%-6s skip %8.3fs %9.2f MHz %6.2fx, %llu loops skipped, %.1f%% of T-states\n", programs[p].name,
+            best[1], cycles / best[1] / 1e6, best[0] / best[1], (unsigned long long)loops,
+            100.0 * skipped / cycles);
+        if (hash[0] != hash[1] || frames[0] != frames[1] || frames[0] == 0) {
+            printf("%-6s MISMATCH: state %016llx vs %016llx\n", programs[p].name, (unsigned long long)hash[0],
+                (unsigned long long)hash[1]);
+            status = EXIT_FAILURE;
+        }
+    }
+    ports_destroy(ports);
+    free(memory);
+    return status;
+}
@@ -0,0 +1,134 @@
+// Port I/O micro-benchmarks: tight OUT, IN and IN/OUT echo loops with no
+// port table, with an empty table, with a callback device and with a bulk
+// device, on every dispatch loop.
+// Usage: ports [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "ports.h"
+
+#define DEFAULT_CYCLES 50000000ULL
+#define ROUNDS 3
+#define PORT 0x10
+#define INPUT_SIZE 0x10000
+
+typedef struct {
+    const char* name;
+    uint8_t code[8];
+    unsigned loop_cycles; // T-states of one iteration
+    unsigned port_ops;    // IN and OUT per iteration
+} Program;
+
+static const Program programs[] = {
+    // MVI A,0; loop: OUT 10h; INR A; JMP loop
+    { "out", { 0x3E, 0x00, 0xD3, PORT, 0x3C, 0xC3, 0x02, 0x01 }, 25, 1 },
+    // loop: IN 10h; ADD B; MOV B,A; JMP loop
+    { "in", { 0xDB, PORT, 0x80, 0x47, 0xC3, 0x00, 0x01 }, 29, 1 },
+    // loop: IN 10h; OUT 10h; JMP loop
+    { "echo", { 0xDB, PORT, 0xD3, PORT, 0xC3, 0x00, 0x01 }, 30, 2 },
+};
+
+typedef enum { CONFIG_NONE, CONFIG_EMPTY, CONFIG_CALLBACK, CONFIG_BULK } Config;
+
+static const char* const config_names[] = { "none", "empty", "callback", "bulk" };
+
+#define NUM_PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+#define NUM_CONFIGS (sizeof(config_names) / sizeof(config_names[0]))
+
+typedef struct {
+    const char* name;
+    uint64_t (*run)(Cpu*, uint64_t);
+} Strategy;
+
+static const Strategy strategies[] = {
+    { "switch", cpu_run_switch },
+#ifdef CPU_HAVE_THREADED
+    { "threaded", cpu_run_threaded },
+    { "cached", cpu_run_cached },
+#endif
+};
+
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+typedef struct {
+    uint8_t next;
+    uint64_t writes;
+} Counter;
+
+static uint8_t counter_read(void* ctx, uint8_t port) {
+    (void)port;
+    Counter* counter = ctx;
+    return counter->next++;
+}
+
+static void counter_write(void* ctx, uint8_t port, uint8_t value) {
+    (void)port;
+    (void)value;
+    Counter* counter = ctx;
+    counter->writes++;
+}
+
+// The out loop writes 0, 1, 2, ... and the echo loop copies the input
+static bool check_output(const Program* program, const PortBulk* bulk, const uint8_t* input) {
+    for (size_t i = 0; i < bulk->output_len; i++) {
+        uint8_t expected = program->code[0] == 0x3E ? (uint8_t)i : i < INPUT_SIZE ? input[i] : bulk->end;
+        if (bulk->output[i] != expected) return false;
+    }
+    return !bulk->truncated;
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    uint8_t* input = malloc(INPUT_SIZE);
+    Ports* ports = ports_create();
+    if (memory == NULL || input == NULL || ports == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < INPUT_SIZE; i++) input[i] = i * 31 + 7;
+
+    int status = EXIT_SUCCESS;
+    for (size_t p = 0; p < NUM_PROGRAMS; p++) {
+        memcpy(memory + 0x100, programs[p].code, sizeof(programs[p].code));
+        for (size_t s = 0; s < NUM_STRATEGIES; s++) {
+            // Configs take turns and keep their best time, which evens out clock changes
+            double best[NUM_CONFIGS] = { 0 };
+            bool bad = false;
+            for (int round = 0; round < ROUNDS; round++) {
+                for (size_t c = 0; c < NUM_CONFIGS; c++) {
+                    Counter counter = { 0, 0 };
+                    PortBulk bulk;
+                    port_bulk_init(&bulk, input, INPUT_SIZE, 0x1A);
+                    ports_detach(ports, PORT);
+                    if (c == CONFIG_CALLBACK) ports_attach(ports, PORT, counter_read, counter_write, &counter);
+                    if (c == CONFIG_BULK) ports_attach_bulk(ports, PORT, &bulk);
+
+                    Cpu cpu;
+                    cpu_init(&cpu, memory);
+                    if (c != CONFIG_NONE) cpu.ports = ports;
+                    double start = bench_now();
+                    strategies[s].run(&cpu, cycles);
+                    double seconds = bench_now() - start;
+                    if (round == 0 || seconds < best[c]) best[c] = seconds;
+                    if (c == CONFIG_BULK && !check_output(&programs[p], &bulk, input)) bad = true;
+                    cpu_free(&cpu);
+                    port_bulk_free(&bulk);
+                }
+            }
+            for (size_t c = 0; c < NUM_CONFIGS; c++) {
+                double ops = (double)(cycles / programs[p].loop_cycles) * programs[p].port_ops;
+                printf("%-5s %-9s %-9s %8.3fs %9.2f MHz %8.2f M ports/s %6.2fx vs none\n", programs[p].name,
+                    strategies[s].name, config_names[c], best[c], cycles / best[c] / 1e6, ops / best[c] / 1e6,
+                    best[CONFIG_NONE] / best[c]);
+            }
+            if (bad) {
+                printf("%-5s %-9s bulk output MISMATCH\n", programs[p].name, strategies[s].name);
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+    ports_destroy(ports);
+    free(input);
+    free(memory);
+    return status;
+}
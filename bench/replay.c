@@ -0,0 +1,123 @@
+// Record and replay: a guest that sums a port fed with random bytes while a
+// timer interrupts it at random times, run plainly, while recording its
+// inputs, and replayed from the log with the device and timer replaced by
+// ones that give different values. The replay must end in the recorded state.
+// Usage: replay [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "input_log.h"
+#include "ports.h"
+#include "sched.h"
+
+#define DEFAULT_CYCLES 100000000ULL
+#define ROUNDS 3
+#define PORT 0x10
+
+// LXI SP,F000h; LXI H,2000h; EI
+// loop: IN 10h; ADD B; MOV B,A; MOV M,A; INX H; MOV A,H; ANI 0Fh; ORI 20h; MOV H,A; JMP loop
+static const uint8_t program[] = { 0x31, 0x00, 0xF0, 0x21, 0x00, 0x20, 0xFB, 0xDB, PORT, 0x80, 0x47, 0x77, 0x23,
+    0x7C, 0xE6, 0x0F, 0xF6, 0x20, 0x67, 0xC3, 0x07, 0x01 };
+// RST 1: PUSH PSW; LDA 0300h; INR A; STA 0300h; POP PSW; EI; RET
+static const uint8_t handler[] = { 0xF5, 0x3A, 0x00, 0x03, 0x3C, 0x32, 0x00, 0x03, 0xF1, 0xFB, 0xC9 };
+
+enum { PLAIN, RECORD, REPLAY };
+
+static uint32_t next_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint8_t device_read(void* ctx, uint8_t port) {
+    (void)port;
+    return (uint8_t)next_random(ctx);
+}
+
+static void timer(Scheduler* sched, void* ctx, uint64_t time) {
+    sched_request_interrupt(sched, 1);
+    sched_post(sched, time + 1000 + next_random(ctx) % 5000, timer, ctx);
+}
+
+// Runs the guest plainly, recording to fp or replaying from it, returns the state hash
+static uint64_t run(int mode, unsigned char* memory, uint64_t cycles, FILE* fp, double* seconds, bool* ok) {
+    memset(memory, 0, BENCH_MEMORY_SIZE);
+    memcpy(memory + 0x100, program, sizeof(program));
+    memcpy(memory + 0x08, handler, sizeof(handler));
+    // The replay gets a differently seeded device and no timer
+    uint32_t device_state = mode == REPLAY ? 99 : 12345;
+    uint32_t timer_state = 777;
+    Ports* ports = ports_create();
+    ports_attach(ports, PORT, device_read, NULL, &device_state);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    cpu.ports = ports;
+    Scheduler sched;
+    sched_init(&sched);
+    sched.skip_polls = false;
+    InputLog log;
+    *ok = true;
+    if (mode == RECORD) *ok = input_log_record(&log, fp);
+    if (mode == REPLAY) *ok = input_log_replay(&log, fp);
+    if (mode != PLAIN) {
+        input_log_attach_ports(&log, &cpu);
+        input_log_attach_sched(&log, &sched);
+    }
+    if (mode != REPLAY) sched_post(&sched, 1000, timer, &timer_state);
+
+    double start = bench_now();
+    sched_run(&sched, &cpu, cycles);
+    if (mode != PLAIN) *ok = input_log_close(&log, &cpu) && *ok;
+    *seconds = bench_now() - start;
+    if (mode != PLAIN) input_log_free(&log);
+    uint64_t hash = bench_state_hash(&cpu);
+    cpu_free(&cpu);
+    sched_free(&sched);
+    ports_destroy(ports);
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    if (memory == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    static const char* names[] = { "plain", "record", "replay" };
+    double best[3] = { 0 };
+    uint64_t hash[3] = { 0 };
+    bool ok[3] = { true, true, true };
+    long log_size = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        FILE* fp = tmpfile();
+        if (fp == NULL) exit(EXIT_FAILURE);
+        for (int mode = PLAIN; mode <= REPLAY; mode++) {
+            double seconds;
+            bool run_ok;
+            if (mode == REPLAY) {
+                log_size = ftell(fp);
+                rewind(fp);
+            }
+            hash[mode] = run(mode, memory, cycles, fp, &seconds, &run_ok);
+            ok[mode] = ok[mode] && run_ok;
+            if (round == 0 || seconds < best[mode]) best[mode] = seconds;
+        }
+        fclose(fp);
+    }
+    for (int mode = PLAIN; mode <= REPLAY; mode++) {
+        printf("%-6s %8.3fs %9.2f MHz", names[mode], best[mode], cycles / best[mode] / 1e6);
+        if (mode == PLAIN) printf("\n");
+        else printf(" %+6.1f%%\n", 100.0 * (best[mode] / best[PLAIN] - 1));
+    }
+    printf("log    %ld bytes, %.2f bytes per thousand T-states\n", log_size, 1000.0 * log_size / cycles);
+    int status = EXIT_SUCCESS;
+    if (!ok[RECORD] || !ok[REPLAY] || hash[PLAIN] != hash[RECORD] || hash[RECORD] != hash[REPLAY]) {
+        printf("MISMATCH: state %016llx recorded %016llx replayed %016llx\n", (unsigned long long)hash[PLAIN],
+            (unsigned long long)hash[RECORD], (unsigned long long)hash[REPLAY]);
+        status = EXIT_FAILURE;
+    }
+    free(memory);
+    return status;
+}
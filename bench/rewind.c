@@ -0,0 +1,103 @@
+// Rewind: runs each rom one instruction at a time plainly and through
+// rewind_execute, and reports the overhead of the checkpoints and the memory
+// they hold. Then steps back to an earlier instruction, which must give the
+// state the plain run had there, and runs back to the last push.
+// Usage: rewind [-c checkpoints] [-i interval] [-n limit] romfile...
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "rewind.h"
+
+#define DEFAULT_CHECKPOINTS 64
+#define DEFAULT_INTERVAL 100000ULL
+#define DEFAULT_LIMIT 20000000ULL
+
+static uint64_t limit = DEFAULT_LIMIT;
+
+// Runs the rom to completion or the limit, returns the instructions run and the state hash
+// after back of them were undone. back is cut down to the instructions run.
+static uint64_t plain_run(const char* filename, uint64_t* back, uint64_t* steps, double* seconds) {
+    unsigned char* memory = bench_load_rom(filename);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    uint64_t n = 0;
+    double start = bench_now();
+    for (; cpu.pc != 0x0000 && n < limit; n++) cpu_execute(&cpu);
+    *seconds = bench_now() - start;
+    *steps = n;
+    if (*back > n) *back = n;
+
+    cpu_free(&cpu);
+    free(memory);
+    memory = bench_load_rom(filename);
+    cpu_init(&cpu, memory);
+    for (uint64_t i = 0; i < n - *back; i++) cpu_execute(&cpu);
+    uint64_t hash = bench_state_hash(&cpu);
+    cpu_free(&cpu);
+    free(memory);
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    uint64_t checkpoints = DEFAULT_CHECKPOINTS;
+    uint64_t interval = DEFAULT_INTERVAL;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-c") == 0) checkpoints = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-i") == 0) interval = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-n") == 0) limit = strtoull(argv[i + 1], NULL, 10);
+        else break;
+    }
+    if (i >= argc || checkpoints == 0 || interval == 0 || limit == 0) {
+        fprintf(stderr, "Usage: %s [-c checkpoints] [-i interval] [-n limit] romfile...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    for (; i < argc; i++) {
+        // Far enough back to need an older checkpoint, close enough to stay in the ring
+        uint64_t back = interval + interval / 2;
+        uint64_t steps;
+        double plain_seconds;
+        uint64_t expected = plain_run(argv[i], &back, &steps, &plain_seconds);
+
+        unsigned char* memory = bench_load_rom(argv[i]);
+        Cpu cpu;
+        cpu_init(&cpu, memory);
+        Rewind rewind;
+        if (!rewind_init(&rewind, &cpu, checkpoints, interval)) exit(EXIT_FAILURE);
+        double start = bench_now();
+        while (cpu.pc != 0x0000 && rewind.step < limit) rewind_execute(&rewind, &cpu);
+        double seconds = bench_now() - start;
+        size_t pages = rewind_pages_held(&rewind);
+
+        printf("%-12s plain   %8.3fs %llu instructions\n", argv[i], plain_seconds, (unsigned long long)steps);
+        printf("%-12s rewind  %8.3fs %+6.1f%%, %zu checkpoints holding %zu KiB\n", argv[i], seconds,
+            100.0 * (seconds / plain_seconds - 1), rewind.count, pages * SNAPSHOT_PAGE_SIZE / 1024);
+
+        start = bench_now();
+        bool back_ok = rewind_step_back(&rewind, &cpu, back);
+        seconds = bench_now() - start;
+        if (!back_ok || bench_state_hash(&cpu) != expected) {
+            printf("%-12s MISMATCH: stepping back %llu instructions\n", argv[i], (unsigned long long)back);
+            status = EXIT_FAILURE;
+        }
+        else printf("%-12s stepped back %llu instructions in %.6fs\n", argv[i], (unsigned long long)back, seconds);
+
+        uint16_t addr = cpu.sp - 2;
+        uint64_t from = rewind.step;
+        uint64_t replayed = rewind.replayed;
+        start = bench_now();
+        if (rewind_to_write(&rewind, &cpu, addr)) {
+            printf("%-12s last write of %04x was %llu instructions back, at pc %04x, found in %.6fs replaying %llu\n",
+                argv[i], addr, (unsigned long long)(from - rewind.step), cpu.pc, bench_now() - start,
+                (unsigned long long)(rewind.replayed - replayed));
+        }
+        else printf("%-12s no write of %04x in the last %llu instructions\n", argv[i], addr,
+            (unsigned long long)(from - rewind.ring[rewind.first].step));
+
+        rewind_free(&rewind, &cpu);
+        cpu_free(&cpu);
+        free(memory);
+    }
+    return status;
+}
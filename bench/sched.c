@@ -0,0 +1,111 @@
+// Measures the cost of running through the event scheduler: a register loop
+// with interrupts enabled, run plain with cpu_run, through sched_run with no
+// events, and with a periodic timer raising RST 1 at video frame rate and at
+// a much higher rate. The halt config waits for the frame interrupt in a HLT
+// loop instead, which should cost next to no host time.
+// Usage: sched [cycles]
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "sched.h"
+
+#define DEFAULT_CYCLES 100000000ULL
+#define ROUNDS 3
+#define COUNT_ADDR 0x0200
+
+static const uint8_t program[] = {
+    0x31, 0x00, 0xF0, //       LXI SP,F000h
+    0xFB,             //       EI
+    0x04,             // loop: INR B
+    0x0D,             //       DCR C
+    0xC3, 0x04, 0x01, //       JMP loop
+};
+
+static const uint8_t idle_program[] = {
+    0x31, 0x00, 0xF0, //       LXI SP,F000h
+    0xFB,             //       EI
+    0x76,             // loop: HLT
+    0xC3, 0x04, 0x01, //       JMP loop
+};
+
+// RST 1: counts interrupts in the word at COUNT_ADDR
+static const uint8_t handler[] = {
+    0xE5,             // PUSH H
+    0x2A, 0x00, 0x02, // LHLD 0200h
+    0x23,             // INX H
+    0x22, 0x00, 0x02, // SHLD 0200h
+    0xE1,             // POP H
+    0xFB,             // EI
+    0xC9,             // RET
+};
+
+typedef struct {
+    const char* name;
+    bool scheduled;
+    uint64_t period; // T-states between interrupts, 0 for none
+    bool halt;       // runs idle_program
+} Config;
+
+// 33333 T-states is one 60 Hz frame at 2 MHz
+static const Config configs[] = {
+    { "plain", false, 0, false },
+    { "idle", true, 0, false },
+    { "frame", true, 33333, false },
+    { "timer", true, 1000, false },
+    { "halt", true, 33333, true },
+};
+
+#define NUM_CONFIGS (sizeof(configs) / sizeof(configs[0]))
+
+static void tick(Scheduler* sched, void* ctx, uint64_t time) {
+    const Config* config = ctx;
+    sched_request_interrupt(sched, 1);
+    sched_post(sched, time + config->period, tick, ctx);
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_CYCLES;
+    unsigned char* memory = calloc(BENCH_MEMORY_SIZE, 1);
+    if (memory == NULL || cycles == 0) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    double best[NUM_CONFIGS] = { 0 };
+    uint64_t taken[NUM_CONFIGS] = { 0 };
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t c = 0; c < NUM_CONFIGS; c++) {
+            memset(memory, 0, BENCH_MEMORY_SIZE);
+            if (configs[c].halt) memcpy(memory + 0x100, idle_program, sizeof(idle_program));
+            else memcpy(memory + 0x100, program, sizeof(program));
+            memcpy(memory + 0x08, handler, sizeof(handler));
+            Cpu cpu;
+            cpu_init(&cpu, memory);
+            Scheduler sched;
+            sched_init(&sched);
+            if (configs[c].period) sched_post(&sched, configs[c].period, tick, (void*)&configs[c]);
+
+            double start = bench_now();
+            if (configs[c].scheduled) sched_run(&sched, &cpu, cycles);
+            else cpu_run(&cpu, cycles);
+            double seconds = bench_now() - start;
+            if (round == 0 || seconds < best[c]) best[c] = seconds;
+
+            taken[c] = sched.interrupts_taken;
+            uint16_t counted = memory[COUNT_ADDR + 1] << 8 | memory[COUNT_ADDR];
+            if (counted != (uint16_t)taken[c] || (configs[c].period && taken[c] < cycles / configs[c].period - 1)) {
+                printf("%-6s MISMATCH: %llu interrupts taken, handler counted %u\n", configs[c].name,
+                    (unsigned long long)taken[c], counted);
+                status = EXIT_FAILURE;
+            }
+            cpu_free(&cpu);
+            sched_free(&sched);
+        }
+    }
+    for (size_t c = 0; c < NUM_CONFIGS; c++) {
+        printf("%-6s %8.3fs %9.2f MHz %10llu interrupts %6.2fx vs plain\n", configs[c].name, best[c],
+            cycles / best[c] / 1e6, (unsigned long long)taken[c], best[0] / best[c]);
+    }
+    free(memory);
+    return status;
+}
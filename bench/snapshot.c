@@ -0,0 +1,122 @@
+// Save states: runs each rom plainly and with copy-on-write snapshots taken
+// every interval T-states, and reports the tracking overhead and the pages
+// copied per snapshot. Restoring the snapshot taken halfway and running on,
+// and saving the final state to a file and loading it back, must both give
+// the state of the plain run.
+// Usage: snapshot [-i interval] romfile...
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include "snapshot.h"
+
+#define DEFAULT_INTERVAL 1000000ULL
+
+static uint64_t hash_of_rom(const char* filename, double* seconds, uint64_t* total) {
+    unsigned char* memory = bench_load_rom(filename);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    double start = bench_now();
+    *total = bench_run_rom(&cpu, cpu_run);
+    *seconds = bench_now() - start;
+    uint64_t hash = bench_state_hash(&cpu);
+    cpu_free(&cpu);
+    free(memory);
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    uint64_t interval = DEFAULT_INTERVAL;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-i") == 0) {
+        interval = strtoull(argv[2], NULL, 10);
+        first = 3;
+    }
+    if (first >= argc || interval == 0) {
+        fprintf(stderr, "Usage: %s [-i interval] romfile...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = first; i < argc; i++) {
+        double plain_seconds;
+        uint64_t total;
+        uint64_t expected = hash_of_rom(argv[i], &plain_seconds, &total);
+
+        unsigned char* memory = bench_load_rom(argv[i]);
+        Cpu cpu;
+        cpu_init(&cpu, memory);
+        static SnapshotTracker tracker;
+        Snapshot latest, middle;
+        bool have_latest = false, have_middle = false;
+        uint64_t snapshots = 0;
+        double take_seconds = 0;
+        double start = bench_now();
+        if (!snapshot_track(&tracker, &cpu)) exit(EXIT_FAILURE);
+        uint64_t next = interval;
+        while (!cpu.halted) {
+            cpu_run(&cpu, BENCH_SLICE);
+            if (cpu.cycles < next) continue;
+            next = cpu.cycles + interval;
+            double take_start = bench_now();
+            // Keep the first snapshot past halfway and the latest one
+            Snapshot snapshot;
+            if (!snapshot_take(&tracker, &cpu, &snapshot)) exit(EXIT_FAILURE);
+            if (!have_middle && snapshot.regs.cycles >= total / 2) {
+                middle = snapshot;
+                have_middle = true;
+            }
+            else {
+                if (have_latest) snapshot_release(&latest);
+                latest = snapshot;
+                have_latest = true;
+            }
+            take_seconds += bench_now() - take_start;
+            snapshots++;
+        }
+        double tracked_seconds = bench_now() - start;
+        uint64_t copied = tracker.pages_copied - SNAPSHOT_PAGES;
+
+        printf("%-12s plain   %8.3fs\n", argv[i], plain_seconds);
+        printf("%-12s tracked %8.3fs %+6.1f%%, %llu snapshots in %.3fs, %.1f of %d pages copied per snapshot\n",
+            argv[i], tracked_seconds, 100.0 * (tracked_seconds / plain_seconds - 1), (unsigned long long)snapshots,
+            take_seconds, snapshots ? (double)copied / snapshots : 0.0, SNAPSHOT_PAGES);
+        if (bench_state_hash(&cpu) != expected) {
+            printf("%-12s MISMATCH: tracked run\n", argv[i]);
+            status = EXIT_FAILURE;
+        }
+
+        if (have_middle) {
+            start = bench_now();
+            snapshot_restore(&tracker, &cpu, &middle);
+            double restore_seconds = bench_now() - start;
+            bench_run_rom(&cpu, cpu_run);
+            printf("%-12s restored at %llu T-states in %.6fs\n", argv[i], (unsigned long long)middle.regs.cycles,
+                restore_seconds);
+            if (bench_state_hash(&cpu) != expected) {
+                printf("%-12s MISMATCH: run from the restored snapshot\n", argv[i]);
+                status = EXIT_FAILURE;
+            }
+            snapshot_release(&middle);
+        }
+        if (have_latest) snapshot_release(&latest);
+        snapshot_untrack(&tracker, &cpu);
+
+        FILE* fp = tmpfile();
+        if (fp == NULL || !snapshot_save(&cpu, fp)) exit(EXIT_FAILURE);
+        long size = ftell(fp);
+        rewind(fp);
+        unsigned char* loaded_memory = calloc(BENCH_MEMORY_SIZE, 1);
+        Cpu loaded;
+        cpu_init(&loaded, loaded_memory);
+        if (!snapshot_load(&loaded, fp) || bench_state_hash(&loaded) != expected) {
+            printf("%-12s MISMATCH: saved and loaded state\n", argv[i]);
+            status = EXIT_FAILURE;
+        }
+        else printf("%-12s saved state %ld bytes\n", argv[i], size);
+        fclose(fp);
+        cpu_free(&loaded);
+        free(loaded_memory);
+        cpu_free(&cpu);
+        free(memory);
+    }
+    return status;
+}
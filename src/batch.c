@@ -0,0 +1,442 @@
+#include "batch.h"
+#include <string.h>
+#include "flags.h"
+
+// The kernels use the GNU vector extension, which becomes SSE2 code on any
+// x86-64 and AVX2 code when built with SIMD=avx2. Without it every lane runs
+// through cpu_execute.
+#ifdef __GNUC__
+#define BATCH_HAVE_SIMD
+#endif
+
+enum { REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_M, REG_A };
+
+void batch_init(CpuBatch* batch, unsigned lanes) {
+    memset(batch, 0, sizeof(*batch));
+    batch->lanes = lanes < BATCH_MAX_LANES ? lanes : BATCH_MAX_LANES;
+}
+
+static void put_lane(CpuBatch* batch, unsigned lane, Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    batch->reg[REG_B][lane] = cpu->b;
+    batch->reg[REG_C][lane] = cpu->c;
+    batch->reg[REG_D][lane] = cpu->d;
+    batch->reg[REG_E][lane] = cpu->e;
+    batch->reg[REG_H][lane] = cpu->h;
+    batch->reg[REG_L][lane] = cpu->l;
+    batch->reg[REG_A][lane] = cpu->a;
+    batch->f[lane] = cpu->f;
+    batch->sp[lane] = cpu->sp;
+    batch->pc[lane] = cpu->pc;
+    batch->cycles[lane] = cpu->cycles;
+    batch->interrupt[lane] = cpu->interrupt;
+    batch->memory[lane] = cpu->memory;
+}
+
+void batch_load(CpuBatch* batch, unsigned lane, Cpu* cpu) {
+    put_lane(batch, lane, cpu);
+    batch->active |= 1u << lane;
+}
+
+void batch_store(const CpuBatch* batch, unsigned lane, Cpu* cpu) {
+    cpu->b = batch->reg[REG_B][lane];
+    cpu->c = batch->reg[REG_C][lane];
+    cpu->d = batch->reg[REG_D][lane];
+    cpu->e = batch->reg[REG_E][lane];
+    cpu->h = batch->reg[REG_H][lane];
+    cpu->l = batch->reg[REG_L][lane];
+    cpu->a = batch->reg[REG_A][lane];
+    cpu->f = batch->f[lane];
+#ifdef CPU_LAZY_FLAGS
+    cpu->lazy_op = LAZY_NONE;
+#endif
+    cpu->sp = batch->sp[lane];
+    cpu->pc = batch->pc[lane];
+    cpu->cycles = batch->cycles[lane];
+    cpu->interrupt = batch->interrupt[lane];
+    cpu->memory = batch->memory[lane];
+}
+
+// Fallback for everything the kernels do not cover
+static void execute_lanes(CpuBatch* batch, uint32_t group) {
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        if (!(group >> lane & 1)) continue;
+        Cpu cpu;
+        cpu_init(&cpu, batch->memory[lane]);
+        batch_store(batch, lane, &cpu);
+        cpu_execute(&cpu);
+        put_lane(batch, lane, &cpu);
+        batch->lane_ops++;
+    }
+}
+
+#ifdef BATCH_HAVE_SIMD
+// One vector register of lanes: 32 with AVX2, 16 with SSE2. Wider GNU vectors
+// than the target has registers for turn into byte-at-a-time code.
+#ifdef __AVX2__
+#define LANE_VEC_BYTES 32
+#else
+#define LANE_VEC_BYTES 16
+#endif
+typedef uint8_t LaneVec __attribute__((vector_size(LANE_VEC_BYTES)));
+typedef uint16_t WordVec __attribute__((vector_size(LANE_VEC_BYTES)));
+
+static LaneVec vec_load(const uint8_t* p) {
+    LaneVec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Stores v in the lanes set in mask
+static void vec_store(uint8_t* p, LaneVec v, LaneVec mask) {
+    v = (v & mask) | (vec_load(p) & ~mask);
+    memcpy(p, &v, sizeof(v));
+}
+
+// x86 has no byte shifts, so shift 16-bit lanes and drop the bits that crossed over
+static LaneVec shr(LaneVec v, int n) {
+    return (LaneVec)((WordVec)v >> n) & (uint8_t)(0xFF >> n);
+}
+
+static LaneVec shl(LaneVec v, int n) {
+    return (LaneVec)((WordVec)v << n) & (uint8_t)(0xFF << n);
+}
+
+static LaneVec szp(LaneVec res) {
+    LaneVec p = res ^ shr(res, 4);
+    p ^= shr(p, 2);
+    p ^= shr(p, 1);
+    return (res & FLAG_S) | ((LaneVec)(res == 0) & FLAG_Z) | (shl(~p, 2) & FLAG_P);
+}
+
+// Carries out of bit 3 (as FLAG_A) and bit 7 (as 1) of res = x + y + carry in
+static LaneVec carry3(LaneVec x, LaneVec y, LaneVec res) {
+    return (x ^ y ^ res) & FLAG_A;
+}
+
+static LaneVec carry7(LaneVec x, LaneVec y, LaneVec res) {
+    return shr((x & y) | ((x | y) & ~res), 7);
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP, selected by op, on lanes i.. of A
+static void vec_alu(CpuBatch* batch, unsigned i, LaneVec mask, uint8_t op, LaneVec x) {
+    LaneVec a = vec_load(batch->reg[REG_A] + i);
+    LaneVec cy = vec_load(batch->f + i) & FLAG_C;
+    LaneVec res, f;
+    switch (op) {
+        case 0:
+            cy = (LaneVec){ 0 };
+            // fall through
+        case 1:
+            res = a + x + cy;
+            f = szp(res) | carry3(a, x, res) | carry7(a, x, res);
+            break;
+        case 2:
+        case 7:
+            cy = (LaneVec){ 0 };
+            // fall through
+        case 3:
+            // a - x - cy is a + ~x + !cy with the carry out inverted
+            x = ~x;
+            res = a + x + (cy ^ 1);
+            f = szp(res) | carry3(a, x, res) | (carry7(a, x, res) ^ 1);
+            break;
+        case 4:
+            res = a & x;
+            f = szp(res) | shl((a | x) & 0x08, 1);
+            break;
+        case 5:
+            res = a ^ x;
+            f = szp(res);
+            break;
+        default:
+            res = a | x;
+            f = szp(res);
+            break;
+    }
+    if (op != 7) vec_store(batch->reg[REG_A] + i, res, mask);
+    vec_store(batch->f + i, f | FLAG_FIXED, mask);
+}
+
+static void vec_inr_dcr(CpuBatch* batch, unsigned i, LaneVec mask, uint8_t reg, bool dcr) {
+    LaneVec res = vec_load(batch->reg[reg] + i) + (uint8_t)(dcr ? 0xFF : 1);
+    LaneVec nibble = res & 0xF;
+    LaneVec ac = (LaneVec)(dcr ? nibble != 0xF : nibble == 0) & FLAG_A;
+    vec_store(batch->reg[reg] + i, res, mask);
+    vec_store(batch->f + i, (vec_load(batch->f + i) & FLAG_C) | szp(res) | ac | FLAG_FIXED, mask);
+}
+
+// RLC RRC RAL RAR, selected by op
+static void vec_rotate(CpuBatch* batch, unsigned i, LaneVec mask, uint8_t op) {
+    LaneVec a = vec_load(batch->reg[REG_A] + i);
+    LaneVec f = vec_load(batch->f + i);
+    LaneVec in = op & 2 ? f & FLAG_C : (op & 1 ? a : shr(a, 7));
+    LaneVec out = op & 1 ? a & 1 : shr(a, 7);
+    a = op & 1 ? shr(a, 1) | shl(in, 7) : shl(a, 1) | (in & 1);
+    vec_store(batch->reg[REG_A] + i, a, mask);
+    vec_store(batch->f + i, (f & ~FLAG_C) | out, mask);
+}
+
+// INX and DCX of BC, DE or HL
+static void vec_step_pair(CpuBatch* batch, unsigned i, LaneVec mask, uint8_t rp, bool dcx) {
+    LaneVec hi = vec_load(batch->reg[rp * 2] + i);
+    LaneVec lo = vec_load(batch->reg[rp * 2 + 1] + i);
+    if (dcx) {
+        hi += (LaneVec)(lo == 0);
+        lo -= 1;
+    }
+    else {
+        lo += 1;
+        hi -= (LaneVec)(lo == 0);
+    }
+    vec_store(batch->reg[rp * 2] + i, hi, mask);
+    vec_store(batch->reg[rp * 2 + 1] + i, lo, mask);
+}
+
+// Instruction byte at addr for each lane in group
+static void fetch(const CpuBatch* batch, uint32_t group, unsigned lead, uint16_t addr, uint8_t* bytes) {
+    if (batch->shared_code) {
+        memset(bytes, batch->memory[lead][addr], BATCH_MAX_LANES);
+        return;
+    }
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        bytes[lane] = group >> lane & 1 ? batch->memory[lane][addr] : 0;
+    }
+}
+
+static void gather_hl(const CpuBatch* batch, uint32_t group, uint8_t* bytes) {
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        uint16_t hl = batch->reg[REG_H][lane] << 8 | batch->reg[REG_L][lane];
+        bytes[lane] = group >> lane & 1 ? batch->memory[lane][hl] : 0;
+    }
+}
+
+enum { KIND_MOV, KIND_ALU, KIND_INR_DCR, KIND_ROTATE, KIND_STEP_PAIR, KIND_LXI, KIND_NOP };
+
+// Runs a register-only instruction on the lanes set in mask, returns false for anything else
+static bool execute_vector(CpuBatch* batch, uint32_t group, unsigned lead, const uint8_t* mask, uint16_t pc, uint8_t opcode) {
+    uint8_t dst = opcode >> 3 & 7;
+    uint8_t src = opcode & 7;
+    uint8_t operand[BATCH_MAX_LANES];
+    uint8_t operand_hi[BATCH_MAX_LANES];
+    const uint8_t* x = src == REG_M ? operand : batch->reg[src];
+    bool immediate = false;
+    int kind;
+    if (opcode >= 0x40 && opcode < 0x80 && dst != REG_M) kind = KIND_MOV;
+    else if (opcode >= 0x80 && opcode < 0xC0) kind = KIND_ALU;
+    else if ((opcode & 0xC7) == 0xC6) {
+        kind = KIND_ALU;
+        immediate = true;
+    }
+    else if ((opcode & 0xC7) == 0x06 && dst != REG_M) {
+        // MVI
+        kind = KIND_MOV;
+        immediate = true;
+    }
+    else if ((opcode & 0xC6) == 0x04 && dst != REG_M) kind = KIND_INR_DCR;
+    else if ((opcode & 0xE7) == 0x07) kind = KIND_ROTATE;
+    else if ((opcode & 0xC7) == 0x03 && opcode < 0x30) kind = KIND_STEP_PAIR;
+    else if ((opcode & 0xCF) == 0x01 && opcode < 0x30) kind = KIND_LXI;
+    else if (opcode == 0x00) kind = KIND_NOP;
+    else return false;
+
+    if (immediate) fetch(batch, group, lead, pc + 1, operand);
+    else if (src == REG_M && (kind == KIND_MOV || kind == KIND_ALU)) gather_hl(batch, group, operand);
+    if (kind == KIND_LXI) {
+        fetch(batch, group, lead, pc + 1, operand);
+        fetch(batch, group, lead, pc + 2, operand_hi);
+    }
+
+    for (unsigned i = 0; i < batch->lanes; i += LANE_VEC_BYTES) {
+        LaneVec m = vec_load(mask + i);
+        switch (kind) {
+            case KIND_MOV: vec_store(batch->reg[dst] + i, vec_load(x + i), m); break;
+            case KIND_ALU: vec_alu(batch, i, m, dst, vec_load(x + i)); break;
+            case KIND_INR_DCR: vec_inr_dcr(batch, i, m, dst, opcode & 1); break;
+            case KIND_ROTATE: vec_rotate(batch, i, m, dst); break;
+            case KIND_STEP_PAIR: vec_step_pair(batch, i, m, opcode >> 4, opcode & 0x08); break;
+            case KIND_LXI:
+                vec_store(batch->reg[(opcode >> 4) * 2 + 1] + i, vec_load(operand + i), m);
+                vec_store(batch->reg[(opcode >> 4) * 2] + i, vec_load(operand_hi + i), m);
+                break;
+        }
+    }
+    return true;
+}
+#endif
+
+static const uint8_t condition_flag[4] = { FLAG_Z, FLAG_C, FLAG_P, FLAG_S };
+
+static bool is_jump(uint8_t opcode) {
+    return opcode == 0xC3 || (opcode & 0xC7) == 0xC2;
+}
+
+// Lanes in group that take the jump
+static uint32_t jump_taken(const CpuBatch* batch, uint32_t group, uint8_t opcode) {
+    if (opcode == 0xC3) return group;
+    uint8_t cond = opcode >> 3 & 7;
+    uint8_t flag = condition_flag[cond >> 1];
+    uint32_t taken = 0;
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        taken |= (uint32_t)(((batch->f[lane] & flag) != 0) == (cond & 1)) << lane;
+    }
+    return taken & group;
+}
+
+// Jumps where lanes part
+static void jump_lanes(CpuBatch* batch, uint32_t group, uint32_t taken, uint16_t pc) {
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        if (!(group >> lane & 1)) continue;
+        const uint8_t* memory = batch->memory[lane];
+        batch->pc[lane] = taken >> lane & 1 ? memory[(uint16_t)(pc + 2)] << 8 | memory[(uint16_t)(pc + 1)] : pc + 3;
+        batch->cycles[lane] += 10;
+    }
+}
+
+// Lanes in group whose memory holds opcode at pc
+static uint32_t same_opcode(const CpuBatch* batch, uint32_t group, uint16_t pc, uint8_t opcode) {
+    if (batch->shared_code) return group;
+    uint32_t same = 0;
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        if (group >> lane & 1 && batch->memory[lane][pc] == opcode) same |= 1u << lane;
+    }
+    return same;
+}
+
+// Picks the runnable lanes at the lowest pc that hold the same opcode there,
+// lanes that took different branches wait there until the others catch up.
+// *wait_pc is set to the lowest pc of the other runnable lanes, or above 0xFFFF.
+// The scans are branch-free as branches on diverged lanes mispredict.
+static uint32_t pick_group(const CpuBatch* batch, uint32_t runnable, uint32_t* wait_pc) {
+    uint32_t pc = 0x10000;
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        uint32_t key = batch->pc[lane] | (~runnable >> lane & 1) << 16;
+        pc = key < pc ? key : pc;
+    }
+    uint32_t group = 0;
+    uint32_t wait = 0x10000;
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        uint32_t key = batch->pc[lane] | (~runnable >> lane & 1) << 16;
+        group |= (uint32_t)(key == pc) << lane;
+        wait = key != pc && key < wait ? key : wait;
+    }
+    unsigned lead = 0;
+    while (!(group >> lead & 1)) lead++;
+    uint32_t same = same_opcode(batch, group, pc, batch->memory[lead][pc]);
+    *wait_pc = same != group ? pc : wait;
+    return same;
+}
+
+static void set_group_pc(CpuBatch* batch, uint32_t group, uint16_t pc, uint64_t cycles) {
+    for (unsigned lane = 0; lane < batch->lanes; lane++) {
+        bool in_group = group >> lane & 1;
+        batch->pc[lane] = in_group ? pc : batch->pc[lane];
+        batch->cycles[lane] += in_group ? cycles : 0;
+    }
+}
+
+static uint32_t lane_count(uint32_t group) {
+    unsigned count = 0;
+    for (; group; group &= group - 1) count++;
+    return count;
+}
+
+// Runs up to max_steps instructions on the lanes in group, which share a pc,
+// while they stay below wait_pc and have cycles_left. When a jump splits the
+// group the lanes at the lower pc carry on and the others wait. pc and cycles
+// only go back to the lanes when they leave the run.
+static void run_group(CpuBatch* batch, uint32_t group, uint32_t wait_pc, uint64_t cycles_left, uint64_t max_steps) {
+    unsigned lead = 0;
+    while (!(group >> lead & 1)) lead++;
+    unsigned count = lane_count(group);
+
+    const uint8_t* code = batch->memory[lead];
+    uint16_t pc = batch->pc[lead];
+    uint64_t cycles = 0;
+    uint64_t steps = 0;
+#ifdef BATCH_HAVE_SIMD
+    uint8_t mask[BATCH_MAX_LANES];
+    for (unsigned lane = 0; lane < BATCH_MAX_LANES; lane++) mask[lane] = -(group >> lane & 1);
+#endif
+    for (;;) {
+        uint8_t opcode = code[pc];
+        if (steps > 0 && same_opcode(batch, group, pc, opcode) != group) break;
+#ifdef BATCH_HAVE_SIMD
+        if (execute_vector(batch, group, lead, mask, pc, opcode)) {
+            pc += cpu_opcode_length(opcode);
+            cycles += cpu_opcode_cycles(opcode);
+        }
+        else
+#endif
+        if (is_jump(opcode) && batch->shared_code) {
+            uint32_t taken = jump_taken(batch, group, opcode);
+            uint16_t target = code[(uint16_t)(pc + 2)] << 8 | code[(uint16_t)(pc + 1)];
+            uint16_t next = pc + 3;
+            cycles += 10;
+            batch->vector_ops += count;
+            if (taken != 0 && taken != group) {
+                uint32_t low = target < next ? taken : group & ~taken;
+                uint16_t high_pc = target < next ? next : target;
+                set_group_pc(batch, group & ~low, high_pc, cycles);
+                if (high_pc < wait_pc) wait_pc = high_pc;
+                group = low;
+                count = lane_count(group);
+                while (!(group >> lead & 1)) lead++;
+#ifdef BATCH_HAVE_SIMD
+                for (unsigned lane = 0; lane < BATCH_MAX_LANES; lane++) mask[lane] = -(group >> lane & 1);
+#endif
+            }
+            pc = (group & taken) ? target : next;
+            if (++steps == max_steps || cycles >= cycles_left || pc >= wait_pc) break;
+            continue;
+        }
+        else if (is_jump(opcode)) {
+            uint32_t taken = jump_taken(batch, group, opcode);
+            set_group_pc(batch, group, pc, cycles);
+            jump_lanes(batch, group, taken, pc);
+            batch->vector_ops += count;
+            return;
+        }
+        else {
+            set_group_pc(batch, group, pc, cycles);
+            if (opcode == 0x76) batch->active &= ~group;
+            else execute_lanes(batch, group);
+            return;
+        }
+        batch->vector_ops += count;
+        if (++steps == max_steps || cycles >= cycles_left || pc >= wait_pc) break;
+    }
+    set_group_pc(batch, group, pc, cycles);
+}
+
+uint32_t batch_execute(CpuBatch* batch) {
+    if (batch->active == 0) return 0;
+    uint32_t wait_pc;
+    uint32_t group = pick_group(batch, batch->active, &wait_pc);
+    run_group(batch, group, wait_pc, UINT64_MAX, 1);
+    return group;
+}
+
+uint64_t batch_run(CpuBatch* batch, uint64_t cycle_budget) {
+    uint64_t start[BATCH_MAX_LANES];
+    memcpy(start, batch->cycles, sizeof(start));
+    uint32_t runnable = batch->active;
+    while (runnable) {
+        uint32_t wait_pc;
+        uint32_t group = pick_group(batch, runnable, &wait_pc);
+        uint64_t cycles_left = UINT64_MAX;
+        for (unsigned lane = 0; lane < batch->lanes; lane++) {
+            uint64_t left = group >> lane & 1 ? cycle_budget - (batch->cycles[lane] - start[lane]) : UINT64_MAX;
+            cycles_left = left < cycles_left ? left : cycles_left;
+        }
+        run_group(batch, group, wait_pc, cycles_left, UINT64_MAX);
+        for (unsigned lane = 0; lane < batch->lanes; lane++) {
+            bool spent = batch->cycles[lane] - start[lane] >= cycle_budget;
+            runnable &= ~((uint32_t)(group >> lane & 1 && spent) << lane);
+        }
+        runnable &= batch->active;
+    }
+    uint64_t cycles = 0;
+    for (unsigned lane = 0; lane < batch->lanes; lane++) cycles += batch->cycles[lane] - start[lane];
+    return cycles;
+}
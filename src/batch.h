@@ -0,0 +1,48 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+#define BATCH_MAX_LANES 32
+
+// Register files of up to BATCH_MAX_LANES Cpus in structure-of-arrays form,
+// run in lockstep. reg is indexed by the 3-bit register field of an opcode
+// (B C D E H L M A), the M row is unused.
+// Each lane has its own memory.
+typedef struct {
+    uint8_t reg[8][BATCH_MAX_LANES];
+    uint8_t f[BATCH_MAX_LANES];
+    uint16_t sp[BATCH_MAX_LANES];
+    uint16_t pc[BATCH_MAX_LANES];
+    uint64_t cycles[BATCH_MAX_LANES];
+    bool interrupt[BATCH_MAX_LANES];
+    uint8_t* memory[BATCH_MAX_LANES];
+    unsigned lanes;
+    uint32_t active; // lanes that have not reached HLT
+    // Set when every lane holds the same code and none modifies it. Instructions
+    // are then read from one lane instead of all of them, whose memories tend to
+    // share cache sets.
+    bool shared_code;
+
+    uint64_t vector_ops; // lane instructions run for a whole group at once
+    uint64_t lane_ops;   // lane instructions run one lane at a time through cpu_execute
+} CpuBatch;
+
+void batch_init(CpuBatch* batch, unsigned lanes);
+// Copies a Cpu into a lane and marks the lane active. Lanes address their
+// memory as flat RAM and have no ports, the bus and ports of the Cpu are not used.
+void batch_load(CpuBatch* batch, unsigned lane, Cpu* cpu);
+// Copies a lane back into a Cpu
+void batch_store(const CpuBatch* batch, unsigned lane, Cpu* cpu);
+// Executes one instruction on every active lane at the lowest pc that has the
+// same opcode there, so lanes that took different branches run apart until
+// they meet again. Lanes stop at HLT instead of executing it. Returns the
+// lanes that ran.
+uint32_t batch_execute(CpuBatch* batch);
+// Runs until every active lane has stopped or run at least cycle_budget
+// T-states, returns the T-states run over all lanes
+uint64_t batch_run(CpuBatch* batch, uint64_t cycle_budget);
+
+#endif
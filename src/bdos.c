@@ -0,0 +1,613 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bdos.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CPM_EOF 0x1A
+#define FCB_SIZE 36
+#define PATH_SIZE 4096
+
+// FCB fields
+enum { FCB_DR = 0, FCB_NAME = 1, FCB_EX = 12, FCB_S2 = 14, FCB_RC = 15, FCB_NEW_NAME = 17, FCB_CR = 32, FCB_R0 = 33 };
+
+static void return_byte(Cpu* cpu, uint8_t value) {
+    cpu->a = cpu->l = value;
+    cpu->b = cpu->h = 0;
+}
+
+static void return_word(Cpu* cpu, uint16_t value) {
+    cpu->hl = value;
+    cpu->a = cpu->l;
+    cpu->b = cpu->h;
+}
+
+static void load_fcb(Cpu* cpu, uint16_t addr, uint8_t* fcb) {
+    for (int i = 0; i < FCB_SIZE; i++) fcb[i] = cpu_get_content_addr(cpu, addr + i);
+}
+
+static void store_fcb(Cpu* cpu, uint16_t addr, const uint8_t* fcb) {
+    for (int i = 0; i < FCB_SIZE; i++) cpu_set_content_addr(cpu, addr + i, fcb[i]);
+}
+
+// Name and type without attribute bits, upper case
+static void fcb_name(const uint8_t* field, char* name) {
+    for (int i = 0; i < 11; i++) name[i] = (char)toupper(field[i] & 0x7F);
+}
+
+// Record number of the sequential position, s2 counts modules of 32 extents
+static uint32_t fcb_record(const uint8_t* fcb) {
+    return (uint32_t)(fcb[FCB_S2] & 0x3F) << 12 | (fcb[FCB_EX] & 0x1F) << 7 | (fcb[FCB_CR] & 0x7F);
+}
+
+static uint32_t file_records(uint64_t size) {
+    return (uint32_t)((size + BDOS_RECORD_SIZE - 1) / BDOS_RECORD_SIZE);
+}
+
+// Moves the sequential position to record and sets the record count of its extent
+static void fcb_seek(uint8_t* fcb, uint32_t record, uint64_t size) {
+    fcb[FCB_CR] = record & 0x7F;
+    fcb[FCB_EX] = record >> 7 & 0x1F;
+    fcb[FCB_S2] = record >> 12 & 0x3F;
+    uint32_t extent_start = record & ~0x7Fu;
+    uint32_t records = file_records(size);
+    fcb[FCB_RC] = records <= extent_start ? 0 : records - extent_start >= 128 ? 128 : records - extent_start;
+}
+
+// Host file name as an FCB name and type, false if it has no 8.3 form
+static bool host_to_fcb(const char* host, char* name) {
+    const char* dot = strrchr(host, '.');
+    size_t base = dot ? (size_t)(dot - host) : strlen(host);
+    size_t ext = dot ? strlen(dot + 1) : 0;
+    if (base == 0 || base > 8 || ext > 3) return false;
+    memset(name, ' ', 11);
+    for (size_t i = 0; i < base + ext; i++) {
+        char c = i < base ? host[i] : dot[1 + i - base];
+        if (c <= ' ' || c > '~' || strchr("<>.,;:=?*[]/", c)) return false;
+        name[i < base ? i : 8 + i - base] = (char)toupper((unsigned char)c);
+    }
+    return true;
+}
+
+// Name and type as an upper case host name, NAME.TYP or NAME
+static void fcb_to_host(const char* name, char* host) {
+    size_t len = 0;
+    for (int i = 0; i < 8 && name[i] != ' '; i++) host[len++] = name[i];
+    if (name[8] != ' ') host[len++] = '.';
+    for (int i = 8; i < 11 && name[i] != ' '; i++) host[len++] = name[i];
+    host[len] = '\0';
+}
+
+static bool matches(const char* pattern, const char* name) {
+    for (int i = 0; i < 11; i++) {
+        if (pattern[i] != '?' && pattern[i] != name[i]) return false;
+    }
+    return true;
+}
+
+static bool make_path(const Bdos* bdos, const char* host, char* path) {
+    int len = snprintf(path, PATH_SIZE, "%s/%s", bdos->dir, host);
+    return len > 0 && len < PATH_SIZE;
+}
+
+static bool regular_file(const Bdos* bdos, const char* host, struct stat* st) {
+    char path[PATH_SIZE];
+    return make_path(bdos, host, path) && stat(path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+// First host file in FCB name order matching pattern, its host name goes to
+// host. Returns false if there is none.
+static bool find_host(const Bdos* bdos, const char* pattern, char* name, char* host) {
+    DIR* dir = opendir(bdos->dir);
+    if (dir == NULL) return false;
+    bool found = false;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char candidate[11];
+        struct stat st;
+        if (!host_to_fcb(entry->d_name, candidate) || !matches(pattern, candidate)) continue;
+        if (found && memcmp(candidate, name, 11) >= 0) continue;
+        if (strlen(entry->d_name) >= 256 || !regular_file(bdos, entry->d_name, &st)) continue;
+        memcpy(name, candidate, 11);
+        strcpy(host, entry->d_name);
+        found = true;
+    }
+    closedir(dir);
+    return found;
+}
+
+static bool flush_file(Bdos* bdos, BdosFile* file) {
+    if (file->dirty_hi > file->dirty_lo) {
+        size_t len = file->dirty_hi - file->dirty_lo;
+        bdos->host_writes++;
+        if (pwrite(file->fd, file->window + file->dirty_lo, len, file->window_pos + file->dirty_lo) != (ssize_t)len) {
+            file->write_error = bdos->write_error = true;
+        }
+    }
+    file->dirty_lo = file->dirty_hi = 0;
+    return !file->write_error;
+}
+
+static bool close_file(Bdos* bdos, BdosFile* file, bool write_back) {
+    bool ok = !write_back || flush_file(bdos, file);
+    close(file->fd);
+    free(file->window);
+    memset(file, 0, sizeof(*file));
+    file->fd = -1;
+    return ok;
+}
+
+static bool flush_all(Bdos* bdos) {
+    bool ok = true;
+    for (int i = 0; i < BDOS_MAX_FILES; i++) {
+        if (bdos->files[i].fd >= 0) ok = flush_file(bdos, &bdos->files[i]) && ok;
+    }
+    return ok;
+}
+
+static BdosFile* find_open(Bdos* bdos, const char* name) {
+    for (int i = 0; i < BDOS_MAX_FILES; i++) {
+        BdosFile* file = &bdos->files[i];
+        if (file->fd >= 0 && memcmp(file->name, name, 11) == 0) {
+            file->last_use = ++bdos->uses;
+            return file;
+        }
+    }
+    return NULL;
+}
+
+// Opens host in a free slot, closing the least recently used file if there is none
+static BdosFile* open_host(Bdos* bdos, const char* name, const char* host, int flags) {
+    char path[PATH_SIZE];
+    if (!make_path(bdos, host, path)) return NULL;
+    BdosFile* file = &bdos->files[0];
+    for (int i = 0; i < BDOS_MAX_FILES && file->fd >= 0; i++) {
+        if (bdos->files[i].fd < 0 || bdos->files[i].last_use < file->last_use) file = &bdos->files[i];
+    }
+    // An evicted file whose buffered records cannot be written back fails the open
+    if (file->fd >= 0 && !close_file(bdos, file, true)) return NULL;
+    uint8_t* window = malloc(bdos->block_size);
+    if (window == NULL) return NULL;
+    int fd = open(path, O_RDWR | flags, 0666);
+    if (fd < 0 && !(flags & O_CREAT)) fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        free(window);
+        return NULL;
+    }
+    memcpy(file->name, name, 11);
+    file->fd = fd;
+    file->window = window;
+    file->size = (uint64_t)st.st_size;
+    file->last_use = ++bdos->uses;
+    return file;
+}
+
+// The open file named by the FCB, opened again if it was closed meanwhile
+static BdosFile* fcb_file(Bdos* bdos, const uint8_t* fcb) {
+    char name[11], found[11], host[256];
+    fcb_name(fcb + FCB_NAME, name);
+    BdosFile* file = find_open(bdos, name);
+    if (file || memchr(name, '?', 11) || !find_host(bdos, name, found, host)) return file;
+    return open_host(bdos, name, host, 0);
+}
+
+// Moves the window to start at pos, reading ahead count bytes
+static void move_window(Bdos* bdos, BdosFile* file, uint64_t pos, size_t count) {
+    flush_file(bdos, file);
+    file->window_pos = pos;
+    file->window_len = 0;
+    if (count == 0 || pos >= file->size) return;
+    bdos->host_reads++;
+    ssize_t len = pread(file->fd, file->window, count, pos);
+    file->window_len = len > 0 ? (size_t)len : 0;
+}
+
+// Reads record into the DMA buffer. Returns 0, or 1 past the end of the file.
+static uint8_t read_record(Bdos* bdos, Cpu* cpu, BdosFile* file, uint32_t record) {
+    uint64_t pos = (uint64_t)record * BDOS_RECORD_SIZE;
+    if (pos >= file->size) return 1;
+    uint64_t end = file->window_pos + file->window_len;
+    if (pos < file->window_pos || pos >= end || (end - pos < BDOS_RECORD_SIZE && end < file->size)) {
+        // Read ahead only when continuing where the window ends
+        move_window(bdos, file, pos, pos == end ? bdos->block_size : BDOS_RECORD_SIZE);
+        end = file->window_pos + file->window_len;
+    }
+    size_t offset = (size_t)(pos - file->window_pos);
+    size_t len = pos < end ? (size_t)(end - pos) : 0;
+    if (len > BDOS_RECORD_SIZE) len = BDOS_RECORD_SIZE;
+    for (size_t i = 0; i < BDOS_RECORD_SIZE; i++) {
+        cpu_set_content_addr(cpu, bdos->dma + i, i < len ? file->window[offset + i] : CPM_EOF);
+    }
+    return 0;
+}
+
+// Writes the DMA buffer to record. Returns 0, or 2 if the file is read only.
+static uint8_t write_record(Bdos* bdos, Cpu* cpu, BdosFile* file, uint32_t record) {
+    uint64_t pos = (uint64_t)record * BDOS_RECORD_SIZE;
+    uint64_t end = file->window_pos + file->window_len;
+    if (pos < file->window_pos || pos > end || pos + BDOS_RECORD_SIZE - file->window_pos > bdos->block_size) {
+        move_window(bdos, file, pos, 0);
+    }
+    size_t offset = (size_t)(pos - file->window_pos);
+    for (size_t i = 0; i < BDOS_RECORD_SIZE; i++) file->window[offset + i] = cpu_get_content_addr(cpu, bdos->dma + i);
+    if (file->dirty_hi == file->dirty_lo) file->dirty_lo = offset;
+    if (offset < file->dirty_lo) file->dirty_lo = offset;
+    if (offset + BDOS_RECORD_SIZE > file->dirty_hi) file->dirty_hi = offset + BDOS_RECORD_SIZE;
+    if (offset + BDOS_RECORD_SIZE > file->window_len) file->window_len = offset + BDOS_RECORD_SIZE;
+    if (pos + BDOS_RECORD_SIZE > file->size) file->size = pos + BDOS_RECORD_SIZE;
+    // A full window goes out now rather than on the next move
+    if (file->window_len == bdos->block_size) flush_file(bdos, file);
+    return file->write_error ? 2 : 0;
+}
+
+static int compare_entries(const void* x, const void* y) {
+    return memcmp(((const BdosEntry*)x)->name, ((const BdosEntry*)y)->name, 11);
+}
+
+// Collects every host file matching pattern, in name order
+static void search(Bdos* bdos, const char* pattern) {
+    flush_all(bdos);
+    bdos->found_count = bdos->found_next = 0;
+    DIR* dir = opendir(bdos->dir);
+    if (dir == NULL) return;
+    size_t cap = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char name[11];
+        struct stat st;
+        if (!host_to_fcb(entry->d_name, name) || !matches(pattern, name)) continue;
+        if (!regular_file(bdos, entry->d_name, &st)) continue;
+        if (bdos->found_count == cap) {
+            cap = cap ? cap * 2 : 64;
+            BdosEntry* found = realloc(bdos->found, cap * sizeof(BdosEntry));
+            if (found == NULL) break;
+            bdos->found = found;
+        }
+        BdosEntry* found = &bdos->found[bdos->found_count++];
+        memcpy(found->name, name, 11);
+        found->records = file_records((uint64_t)st.st_size);
+    }
+    closedir(dir);
+    qsort(bdos->found, bdos->found_count, sizeof(BdosEntry), compare_entries);
+}
+
+// Puts the next entry found in the DMA buffer as the first of four directory
+// entries, the last extent of the file standing for all of them
+static uint8_t search_next(Bdos* bdos, Cpu* cpu) {
+    if (bdos->found_next == bdos->found_count) return 0xFF;
+    const BdosEntry* found = &bdos->found[bdos->found_next++];
+    uint8_t entry[FCB_SIZE] = { 0 };
+    entry[0] = bdos->user;
+    memcpy(entry + FCB_NAME, found->name, 11);
+    uint32_t last = found->records ? found->records - 1 : 0;
+    fcb_seek(entry, last, (uint64_t)found->records * BDOS_RECORD_SIZE);
+    for (int i = 0; i < BDOS_RECORD_SIZE; i++) cpu_set_content_addr(cpu, bdos->dma + i, i < 32 ? entry[i] : 0xE5);
+    return 0;
+}
+
+static uint8_t open_fcb(Bdos* bdos, Cpu* cpu, uint8_t* fcb) {
+    char pattern[11], name[11], host[256];
+    fcb_name(fcb + FCB_NAME, pattern);
+    BdosFile* file = memchr(pattern, '?', 11) ? NULL : find_open(bdos, pattern);
+    if (file == NULL) {
+        if (!find_host(bdos, pattern, name, host)) return 0xFF;
+        file = find_open(bdos, name);
+        if (file == NULL) file = open_host(bdos, name, host, 0);
+        if (file == NULL) return 0xFF;
+    }
+    memcpy(fcb + FCB_NAME, file->name, 11);
+    fcb_seek(fcb, fcb_record(fcb), file->size);
+    store_fcb(cpu, cpu->de, fcb);
+    return 0;
+}
+
+static uint8_t make_fcb(Bdos* bdos, Cpu* cpu, uint8_t* fcb) {
+    char name[11], found[11], host[256];
+    fcb_name(fcb + FCB_NAME, name);
+    if (memchr(name, '?', 11)) return 0xFF;
+    BdosFile* file = find_open(bdos, name);
+    if (file) close_file(bdos, file, false);
+    // An existing file of the name in another case is replaced
+    if (!find_host(bdos, name, found, host)) fcb_to_host(name, host);
+    file = open_host(bdos, name, host, O_CREAT | O_TRUNC);
+    if (file == NULL) return 0xFF;
+    fcb_seek(fcb, fcb_record(fcb), 0);
+    store_fcb(cpu, cpu->de, fcb);
+    return 0;
+}
+
+static uint8_t close_fcb(Bdos* bdos, const uint8_t* fcb) {
+    char name[11], found[11], host[256];
+    fcb_name(fcb + FCB_NAME, name);
+    BdosFile* file = find_open(bdos, name);
+    if (file) return close_file(bdos, file, true) ? 0 : 0xFF;
+    return find_host(bdos, name, found, host) ? 0 : 0xFF;
+}
+
+static uint8_t delete_fcb(Bdos* bdos, const uint8_t* fcb) {
+    char pattern[11], name[11], host[256], path[PATH_SIZE];
+    fcb_name(fcb + FCB_NAME, pattern);
+    uint8_t result = 0xFF;
+    while (find_host(bdos, pattern, name, host)) {
+        BdosFile* file = find_open(bdos, name);
+        if (file) close_file(bdos, file, false);
+        if (!make_path(bdos, host, path) || unlink(path) != 0) break;
+        result = 0;
+    }
+    return result;
+}
+
+static uint8_t rename_fcb(Bdos* bdos, const uint8_t* fcb) {
+    char name[11], new_name[11], found[11], host[256], new_host[256], path[PATH_SIZE], new_path[PATH_SIZE];
+    fcb_name(fcb + FCB_NAME, name);
+    fcb_name(fcb + FCB_NEW_NAME, new_name);
+    if (memchr(new_name, '?', 11) || !find_host(bdos, name, found, host)) return 0xFF;
+    BdosFile* file = find_open(bdos, found);
+    if (file && !close_file(bdos, file, true)) return 0xFF;
+    file = find_open(bdos, new_name);
+    if (file) close_file(bdos, file, false);
+    fcb_to_host(new_name, new_host);
+    if (!make_path(bdos, host, path) || !make_path(bdos, new_host, new_path)) return 0xFF;
+    return rename(path, new_path) == 0 ? 0 : 0xFF;
+}
+
+static uint8_t sequential(Bdos* bdos, Cpu* cpu, uint8_t* fcb, bool write) {
+    BdosFile* file = fcb_file(bdos, fcb);
+    if (file == NULL) return write ? 2 : 1;
+    uint32_t record = fcb_record(fcb);
+    uint8_t result = write ? write_record(bdos, cpu, file, record) : read_record(bdos, cpu, file, record);
+    if (result == 0) record++;
+    fcb_seek(fcb, record, file->size);
+    store_fcb(cpu, cpu->de, fcb);
+    return result;
+}
+
+// Writes zeros from the end of the file up to pos. Without it a gap is a hole
+// in the host file, which reads as zeros too but is not allocated.
+static void zero_fill(Bdos* bdos, BdosFile* file, uint64_t pos) {
+    static const uint8_t zeros[4096];
+    if (pos <= file->size) return;
+    flush_file(bdos, file);
+    for (uint64_t at = file->size; at < pos && !file->write_error; at += sizeof(zeros)) {
+        size_t len = pos - at < sizeof(zeros) ? (size_t)(pos - at) : sizeof(zeros);
+        bdos->host_writes++;
+        if (pwrite(file->fd, zeros, len, at) != (ssize_t)len) file->write_error = bdos->write_error = true;
+    }
+    if (!file->write_error) file->size = pos;
+}
+
+// Random records stay the current record, a sequential read after one reads it again
+static uint8_t random_access(Bdos* bdos, Cpu* cpu, uint8_t* fcb, bool write, bool fill) {
+    if (fcb[FCB_R0 + 2]) return 6;
+    BdosFile* file = fcb_file(bdos, fcb);
+    if (file == NULL) return write ? 5 : 4;
+    uint32_t record = fcb[FCB_R0] | fcb[FCB_R0 + 1] << 8;
+    if (fill) zero_fill(bdos, file, (uint64_t)record * BDOS_RECORD_SIZE);
+    uint8_t result = write ? write_record(bdos, cpu, file, record) : read_record(bdos, cpu, file, record);
+    fcb_seek(fcb, record, file->size);
+    store_fcb(cpu, cpu->de, fcb);
+    return result;
+}
+
+static void set_random(uint8_t* fcb, uint32_t record) {
+    fcb[FCB_R0] = record & 0xFF;
+    fcb[FCB_R0 + 1] = record >> 8 & 0xFF;
+    fcb[FCB_R0 + 2] = record >> 16 & 0xFF;
+}
+
+static uint8_t file_size(Bdos* bdos, Cpu* cpu, uint8_t* fcb) {
+    BdosFile* file = fcb_file(bdos, fcb);
+    if (file == NULL) return 0xFF;
+    set_random(fcb, file_records(file->size));
+    store_fcb(cpu, cpu->de, fcb);
+    return 0;
+}
+
+// Writes the string at addr up to the $, which flat memory finds with memchr
+// and copies in one go. A string without one ends after all 64 KiB.
+static void print_string(Console* console, Cpu* cpu, uint16_t addr) {
+    if (cpu->bus) {
+        for (uint32_t i = 0; i < 0x10000 && cpu_get_content_addr(cpu, addr + i) != '$'; i++) {
+            console_putc(console, cpu_get_content_addr(cpu, addr + i));
+        }
+        return;
+    }
+    const char* memory = (const char*)cpu->memory;
+    const char* end = memchr(memory + addr, '$', 0x10000 - addr);
+    if (end) {
+        console_write(console, memory + addr, end - (memory + addr));
+        return;
+    }
+    // Runs on past the top of memory
+    console_write(console, memory + addr, 0x10000 - addr);
+    end = memchr(memory, '$', addr);
+    console_write(console, memory, end ? (size_t)(end - memory) : addr);
+}
+
+static void console_call(Bdos* bdos, Cpu* cpu) {
+    Console* console = bdos->console;
+    switch (cpu->c) {
+        case 0x01: {
+            uint8_t c = console_getc(console, cpu->cycles);
+            console_putc(console, c);
+            return_byte(cpu, c);
+            break;
+        }
+        case 0x02:
+            console_putc(console, cpu->e);
+            break;
+        case 0x06:
+            if (cpu->e == 0xFF) {
+                return_byte(cpu, console_status(console, cpu->cycles) ? console_getc(console, cpu->cycles) : 0);
+            }
+            else console_putc(console, cpu->e);
+            break;
+        case 0x09: print_string(console, cpu, cpu->de); break;
+        case 0x0A: {
+            // Reads a line into the buffer at DE: size, count, then the characters
+            uint8_t size = cpu_get_content_addr(cpu, cpu->de);
+            uint8_t count = 0;
+            while (count < size) {
+                uint8_t c = console_getc(console, cpu->cycles);
+                if (c == '\n' || c == CPM_EOF) break;
+                if (c == '\r') continue;
+                console_putc(console, c);
+                cpu_set_content_addr(cpu, cpu->de + 2 + count++, c);
+            }
+            console_putc(console, '\n');
+            cpu_set_content_addr(cpu, cpu->de + 1, count);
+            break;
+        }
+        case 0x0B:
+            return_byte(cpu, console_status(console, cpu->cycles));
+            break;
+    }
+}
+
+void bdos_call(Bdos* bdos, Cpu* cpu) {
+    uint8_t fcb[FCB_SIZE];
+    uint8_t function = cpu->c;
+    if (function >= 15 && function <= 40) load_fcb(cpu, cpu->de, fcb);
+    switch (function) {
+        case 0: cpu->pc = 0x0000; break;
+        case 1: case 2: case 6: case 9: case 10: case 11: console_call(bdos, cpu); break;
+        case 3: return_byte(cpu, CPM_EOF); break;
+        case 4: case 5: break; // punch and list go nowhere
+        case 7: return_byte(cpu, bdos->iobyte); break;
+        case 8: bdos->iobyte = cpu->e; break;
+        case 12: return_word(cpu, 0x0022); break;
+        case 13:
+            flush_all(bdos);
+            bdos->drive = 0;
+            bdos->dma = 0x0080;
+            return_byte(cpu, 0);
+            break;
+        case 14: bdos->drive = cpu->e & 0x0F; return_byte(cpu, 0); break;
+        case 15: return_byte(cpu, open_fcb(bdos, cpu, fcb)); break;
+        case 16: return_byte(cpu, close_fcb(bdos, fcb)); break;
+        case 17: {
+            char pattern[11];
+            fcb_name(fcb + FCB_NAME, pattern);
+            if (fcb[FCB_DR] == '?') memset(pattern, '?', 11);
+            search(bdos, pattern);
+            return_byte(cpu, search_next(bdos, cpu));
+            break;
+        }
+        case 18: return_byte(cpu, search_next(bdos, cpu)); break;
+        case 19: return_byte(cpu, delete_fcb(bdos, fcb)); break;
+        case 20: return_byte(cpu, sequential(bdos, cpu, fcb, false)); break;
+        case 21: return_byte(cpu, sequential(bdos, cpu, fcb, true)); break;
+        case 22: return_byte(cpu, make_fcb(bdos, cpu, fcb)); break;
+        case 23: return_byte(cpu, rename_fcb(bdos, fcb)); break;
+        case 24: return_word(cpu, 1 << bdos->drive | 1); break;
+        case 25: return_byte(cpu, bdos->drive); break;
+        case 26: bdos->dma = cpu->de; break;
+        case 28: case 29: case 31: return_word(cpu, 0); break;
+        case 30: return_byte(cpu, fcb_file(bdos, fcb) ? 0 : 0xFF); break;
+        case 32:
+            if (cpu->e == 0xFF) return_byte(cpu, bdos->user);
+            else bdos->user = cpu->e & 0x0F;
+            break;
+        case 33: return_byte(cpu, random_access(bdos, cpu, fcb, false, false)); break;
+        case 34: return_byte(cpu, random_access(bdos, cpu, fcb, true, false)); break;
+        case 35: return_byte(cpu, file_size(bdos, cpu, fcb)); break;
+        case 36:
+            set_random(fcb, fcb_record(fcb));
+            store_fcb(cpu, cpu->de, fcb);
+            break;
+        case 40: return_byte(cpu, random_access(bdos, cpu, fcb, true, true)); break;
+        default: return_word(cpu, 0); break;
+    }
+}
+
+static HookResult bdos_entry(Cpu* cpu, void* ctx, uint16_t addr) {
+    (void)addr;
+    bdos_call(ctx, cpu);
+    return HOOK_CONTINUE;
+}
+
+static HookResult warm_boot(Cpu* cpu, void* ctx, uint16_t addr) {
+    (void)cpu;
+    (void)ctx;
+    (void)addr;
+    return HOOK_STOP;
+}
+
+void bdos_init(Bdos* bdos, Console* console, const char* dir) {
+    memset(bdos, 0, sizeof(*bdos));
+    bdos->console = console;
+    bdos->dir = dir;
+    bdos->block_size = BDOS_BLOCK_SIZE;
+    bdos->dma = 0x0080;
+    for (int i = 0; i < BDOS_MAX_FILES; i++) bdos->files[i].fd = -1;
+}
+
+bool bdos_free(Bdos* bdos) {
+    bool ok = true;
+    for (int i = 0; i < BDOS_MAX_FILES; i++) {
+        if (bdos->files[i].fd >= 0) ok = close_file(bdos, &bdos->files[i], true) && ok;
+    }
+    free(bdos->found);
+    bdos->found = NULL;
+    bdos->found_count = bdos->found_next = 0;
+    return ok && !bdos->write_error;
+}
+
+bool bdos_attach(Bdos* bdos, Hooks* hooks, Cpu* cpu) {
+    cpu_set_content_addr(cpu, 0x0007, 0xC9);
+    return hooks_add(hooks, cpu, 0x0000, warm_boot, NULL) && hooks_add(hooks, cpu, 0x0005, bdos_entry, bdos);
+}
+
+// One CCP argument as the name and type of an FCB, * filling its field with ?
+static void parse_fcb(const char* arg, size_t len, uint8_t* fcb) {
+    memset(fcb, 0, 16);
+    memset(fcb + FCB_NAME, ' ', 11);
+    if (len >= 2 && arg[1] == ':') {
+        fcb[FCB_DR] = (uint8_t)(toupper((unsigned char)arg[0]) - 'A' + 1);
+        arg += 2;
+        len -= 2;
+    }
+    int field = FCB_NAME, limit = FCB_NAME + 8;
+    for (size_t i = 0; i < len; i++) {
+        if (arg[i] == '.') {
+            field = FCB_NAME + 8;
+            limit = FCB_NAME + 11;
+        }
+        else if (arg[i] == '*') {
+            while (field < limit) fcb[field++] = '?';
+        }
+        else if (field < limit) fcb[field++] = (uint8_t)toupper((unsigned char)arg[i]);
+    }
+}
+
+void bdos_set_command_line(Cpu* cpu, const char* args) {
+    uint8_t page[0x80 - 0x5C];
+    memset(page, 0, sizeof(page));
+    const char* arg[2] = { "", "" };
+    size_t len[2] = { 0, 0 };
+    const char* p = args;
+    for (int i = 0; i < 2; i++) {
+        while (*p == ' ') p++;
+        arg[i] = p;
+        while (*p && *p != ' ') p++;
+        len[i] = p - arg[i];
+    }
+    parse_fcb(arg[0], len[0], page);
+    parse_fcb(arg[1], len[1], page + 16);
+    for (size_t i = 0; i < sizeof(page); i++) cpu_set_content_addr(cpu, 0x5C + i, page[i]);
+
+    // The tail keeps the space before the first argument, upper cased
+    size_t len_args = strlen(args) < 126 ? strlen(args) : 126;
+    uint8_t tail[128] = { 0 };
+    if (len_args) tail[1] = ' ';
+    for (size_t i = 0; i < len_args; i++) tail[2 + i] = (uint8_t)toupper((unsigned char)args[i]);
+    tail[0] = len_args ? (uint8_t)(len_args + 1) : 0;
+    for (size_t i = 0; i < sizeof(tail); i++) cpu_set_content_addr(cpu, 0x80 + i, tail[i]);
+}
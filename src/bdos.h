@@ -0,0 +1,75 @@
+#ifndef BDOS_H
+#define BDOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "console.h"
+#include "cpu.h"
+#include "hooks.h"
+
+#define BDOS_RECORD_SIZE 128
+#define BDOS_MAX_FILES 16
+// Host bytes read ahead or written behind at once, a multiple of BDOS_RECORD_SIZE
+#define BDOS_BLOCK_SIZE 65536
+
+// A host file behind one or more FCBs. The window holds the file bytes
+// [window_pos, window_pos + window_len) and is read in one host read, ahead
+// of sequential reads, or collects sequential writes until it is full.
+typedef struct {
+    char name[11]; // FCB name and type, upper case
+    int fd;        // -1 while the slot is free
+    uint8_t* window;
+    uint64_t window_pos;
+    size_t window_len;
+    size_t dirty_lo, dirty_hi; // window bytes not written to the host yet
+    uint64_t size;             // file size, including the unwritten bytes
+    uint64_t last_use;
+    bool write_error;
+} BdosFile;
+
+// Directory entry found by search first, handed out by search next
+typedef struct {
+    char name[11];
+    uint32_t records;
+} BdosEntry;
+
+// CP/M 2.2 BDOS on the host. Every drive maps to the host directory dir,
+// files are found by their 8.3 name in any case and created in upper case.
+// FCBs keep the file position as in CP/M, the host side is a small table of
+// open files keyed by name, so an FCB that was never closed, or copied, or
+// whose file was closed behind its back still works. A random write past the
+// end leaves a hole in the host file, Write Random with Zero Fill writes zeros
+// up to its record.
+typedef struct {
+    Console* console;
+    const char* dir;
+    size_t block_size; // host read ahead and write behind, BDOS_BLOCK_SIZE unless changed before any file is opened
+    uint16_t dma;
+    uint8_t drive;
+    uint8_t user;
+    uint8_t iobyte;
+    BdosFile files[BDOS_MAX_FILES];
+    uint64_t uses;
+    BdosEntry* found;
+    size_t found_count;
+    size_t found_next;
+    uint64_t host_reads;
+    uint64_t host_writes;
+    bool write_error; // some write to a host file failed, even of a file closed since
+} Bdos;
+
+void bdos_init(Bdos* bdos, Console* console, const char* dir);
+// Writes back and closes every file, returns false if any write failed since bdos_init
+bool bdos_free(Bdos* bdos);
+// Hooks the BDOS entry at 0x0005 and the warm boot at 0x0000, which stops the
+// cpu. The entry is the trap, a NOP and a RET, so 0x0006 holds the top of memory.
+bool bdos_attach(Bdos* bdos, Hooks* hooks, Cpu* cpu);
+// Runs BDOS function C with argument DE and returns in A and L, or in HL with
+// A = L and B = H
+void bdos_call(Bdos* bdos, Cpu* cpu);
+// Sets the command tail at 0x0080 and the default FCBs at 0x005C and 0x006C
+// from the first two arguments, as the CCP does
+void bdos_set_command_line(Cpu* cpu, const char* args);
+
+#endif
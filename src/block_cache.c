@@ -0,0 +1,70 @@
+#include "block_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+BlockCache* block_cache_create(void) {
+    BlockCache* cache = malloc(sizeof(BlockCache));
+    if (cache == NULL) return NULL;
+    block_cache_flush(cache);
+    cache->blocks_built = 0;
+    cache->invalidations = 0;
+    cache->flushes = 0;
+    cache->idiom_cycles = 0;
+    cache->mapping = 0;
+    return cache;
+}
+
+void block_cache_destroy(BlockCache* cache) {
+    free(cache);
+}
+
+void block_cache_flush(BlockCache* cache) {
+    memset(cache->block_at, 0, sizeof(cache->block_at));
+    memset(cache->code_map, 0, sizeof(cache->code_map));
+    cache->num_blocks = 0;
+    cache->num_ops = 0;
+    cache->invalidated = true;
+    cache->flushes++;
+}
+
+// Drops every block holding the instruction byte at addr. Only blocks starting
+// up to BLOCK_MAX_BYTES before it can overlap it. Other bytes of the dropped
+// blocks stay marked in the code map and are cleared when next written.
+void block_cache_invalidate(BlockCache* cache, uint16_t addr) {
+    for (int offset = 0; offset < BLOCK_MAX_BYTES; offset++) {
+        uint16_t start = addr - offset;
+        Block* block = block_cache_lookup(cache, start);
+        if (block == NULL) continue;
+        if ((int)(block->end - block->start) > offset) {
+            cache->block_at[start] = 0;
+            cache->invalidated = true;
+            cache->invalidations++;
+        }
+    }
+    cache->code_map[addr] = 0;
+}
+
+Block* block_cache_begin(BlockCache* cache, uint16_t start) {
+    if (cache->num_blocks == BLOCK_CACHE_MAX_BLOCKS || cache->num_ops + BLOCK_MAX_OPS > BLOCK_CACHE_MAX_OPS) {
+        block_cache_flush(cache);
+    }
+    Block* block = &cache->blocks[cache->num_blocks];
+    block->ops = &cache->ops[cache->num_ops];
+    block->num_ops = 0;
+    block->start = start;
+    block->end = start;
+    block->hits = 0;
+    block->native = NULL;
+    block->max_cycles = 0;
+    block->idiom.kind = IDIOM_NONE;
+    return block;
+}
+
+void block_cache_commit(BlockCache* cache, Block* block) {
+    for (uint32_t addr = block->start; addr != block->end; addr++) {
+        cache->code_map[(uint16_t)addr] = 1;
+    }
+    cache->block_at[block->start] = ++cache->num_blocks;
+    cache->num_ops += block->num_ops;
+    cache->blocks_built++;
+}
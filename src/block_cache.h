@@ -0,0 +1,72 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "idiom.h"
+
+#define BLOCK_MAX_OPS 32
+#define BLOCK_MAX_BYTES (BLOCK_MAX_OPS * 3)
+#define BLOCK_CACHE_MAX_BLOCKS 0x4000
+#define BLOCK_CACHE_MAX_OPS 0x20000
+
+// One predecoded instruction
+typedef struct {
+    const void* handler; // dispatch target of the opcode body
+    uint16_t operand;    // immediate byte or word
+    uint16_t next_pc;    // address of the following instruction
+    uint8_t opcode;
+    uint8_t cycles;
+} DecodedOp;
+
+// A straight-line run of instructions ending at a control transfer
+typedef struct {
+    DecodedOp* ops;
+    uint16_t num_ops;
+    uint16_t start;
+    uint32_t end; // one past the last instruction byte
+
+    uint32_t hits;       // executions counted while a JIT is attached
+    void* native;        // JIT translation, NULL if none
+    uint16_t max_cycles; // upper bound on the T-states of one native run
+    Idiom idiom;         // block memory loop starting here, see idiom.h
+} Block;
+
+typedef struct BlockCache {
+    uint16_t block_at[0x10000]; // block index + 1 for every start address, 0 if none
+    uint8_t code_map[0x10000];  // nonzero where a cached block holds instruction bytes
+    Block blocks[BLOCK_CACHE_MAX_BLOCKS];
+    DecodedOp ops[BLOCK_CACHE_MAX_OPS];
+    uint32_t num_blocks;
+    uint32_t num_ops;
+
+    bool invalidated; // a write hit cached code, the current block must be abandoned
+    uint32_t mapping; // bus generation the blocks were decoded under
+
+    uint64_t blocks_built;
+    uint64_t invalidations;
+    uint64_t flushes;
+    uint64_t idiom_cycles; // T-states of loop rounds run by idiom_run
+} BlockCache;
+
+BlockCache* block_cache_create(void);
+void block_cache_destroy(BlockCache* cache);
+void block_cache_flush(BlockCache* cache);
+void block_cache_invalidate(BlockCache* cache, uint16_t addr);
+// Returns room for a block of up to BLOCK_MAX_OPS instructions at start, flushing if full
+Block* block_cache_begin(BlockCache* cache, uint16_t start);
+// Publishes a block filled in after block_cache_begin
+void block_cache_commit(BlockCache* cache, Block* block);
+
+static inline Block* block_cache_lookup(BlockCache* cache, uint16_t pc) {
+    uint16_t index = cache->block_at[pc];
+    return index ? &cache->blocks[index - 1] : NULL;
+}
+
+// Called for every guest memory write
+static inline void block_cache_write(BlockCache* cache, uint16_t addr) {
+    if (cache->code_map[addr]) block_cache_invalidate(cache, addr);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include "bus.h"
+#include <stdlib.h>
+
+static void map(Bus* bus, unsigned first_page, unsigned num_pages, uint8_t* read, uint8_t* write, BusHandler handler) {
+    for (unsigned page = first_page; page < first_page + num_pages && page < BUS_NUM_PAGES; page++) {
+        unsigned offset = (page - first_page) * BUS_PAGE_SIZE;
+        bus->read_page[page] = read ? read + offset : NULL;
+        bus->write_page[page] = write ? write + offset : NULL;
+        bus->handler[page] = handler;
+    }
+    bus->generation++;
+}
+
+Bus* bus_create(uint8_t* ram) {
+    Bus* bus = calloc(1, sizeof(Bus));
+    if (bus == NULL) return NULL;
+    bus_map_ram(bus, 0, BUS_NUM_PAGES, ram);
+    return bus;
+}
+
+void bus_destroy(Bus* bus) {
+    if (bus == NULL) return;
+    free(bus->banks);
+    free(bus);
+}
+
+void bus_map_ram(Bus* bus, unsigned first_page, unsigned num_pages, uint8_t* host) {
+    map(bus, first_page, num_pages, host, host, (BusHandler){ 0 });
+}
+
+void bus_map_rom(Bus* bus, unsigned first_page, unsigned num_pages, const uint8_t* host, BusWriteFn write, void* ctx) {
+    map(bus, first_page, num_pages, (uint8_t*)host, NULL, (BusHandler){ NULL, write, ctx });
+}
+
+void bus_map_io(Bus* bus, unsigned first_page, unsigned num_pages, BusReadFn read, BusWriteFn write, void* ctx) {
+    map(bus, first_page, num_pages, NULL, NULL, (BusHandler){ read, write, ctx });
+}
+
+bool bus_set_banks(Bus* bus, unsigned first_page, unsigned num_pages, unsigned num_banks) {
+    if (num_pages == 0 || num_banks == 0 || first_page + num_pages > BUS_NUM_PAGES) return false;
+    size_t bank_size = (size_t)num_pages * BUS_PAGE_SIZE;
+    uint8_t* banks = calloc(num_banks, bank_size);
+    if (banks == NULL) return false;
+    for (unsigned page = 0; page < num_pages; page++) {
+        for (unsigned i = 0; i < BUS_PAGE_SIZE; i++) {
+            banks[page * BUS_PAGE_SIZE + i] = bus_read(bus, (first_page + page) << BUS_PAGE_BITS | i);
+        }
+    }
+    free(bus->banks);
+    bus->banks = banks;
+    bus->bank_first = first_page;
+    bus->bank_pages = num_pages;
+    bus->num_banks = num_banks;
+    bus->bank = 0;
+    bus_map_ram(bus, first_page, num_pages, banks);
+    return true;
+}
+
+void bus_select_bank(Bus* bus, unsigned bank) {
+    if (bank >= bus->num_banks || bank == bus->bank) return;
+    bus->bank = bank;
+    size_t bank_size = (size_t)bus->bank_pages * BUS_PAGE_SIZE;
+    bus_map_ram(bus, bus->bank_first, bus->bank_pages, bus->banks + bank * bank_size);
+}
+
+uint8_t bus_read_slow(Bus* bus, uint16_t addr) {
+    const BusHandler* handler = &bus->handler[addr >> BUS_PAGE_BITS];
+    return handler->read ? handler->read(handler->ctx, addr) : 0xFF;
+}
+
+void bus_write_slow(Bus* bus, uint16_t addr, uint8_t value) {
+    const BusHandler* handler = &bus->handler[addr >> BUS_PAGE_BITS];
+    if (handler->write) handler->write(handler->ctx, addr, value);
+}
@@ -0,0 +1,69 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BUS_PAGE_BITS 8
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_BITS)
+#define BUS_NUM_PAGES (0x10000 >> BUS_PAGE_BITS)
+
+typedef uint8_t (*BusReadFn)(void* ctx, uint16_t addr);
+typedef void (*BusWriteFn)(void* ctx, uint16_t addr, uint8_t value);
+
+// Called for accesses a page has no host pointer for. A missing read handler
+// reads 0xFF, a missing write handler drops the write.
+typedef struct {
+    BusReadFn read;
+    BusWriteFn write;
+    void* ctx;
+} BusHandler;
+
+// Page table of the 64 KiB address space. RAM pages hold a host pointer for
+// both directions, ROM pages for reads only and MMIO pages for neither.
+typedef struct Bus {
+    uint8_t* read_page[BUS_NUM_PAGES];  // host bytes of the page, NULL if reads go to the handler
+    uint8_t* write_page[BUS_NUM_PAGES]; // NULL if writes go to the handler
+    BusHandler handler[BUS_NUM_PAGES];
+    uint32_t generation; // bumped by every change to the mapping
+
+    // Bank switched window, for machines with more than 64 KiB of RAM
+    uint8_t* banks;
+    unsigned bank_first, bank_pages, num_banks, bank;
+} Bus;
+
+// Maps every page as RAM at ram[0..0xFFFF]
+Bus* bus_create(uint8_t* ram);
+void bus_destroy(Bus* bus);
+void bus_map_ram(Bus* bus, unsigned first_page, unsigned num_pages, uint8_t* host);
+// Writes to ROM pages go to write, or are dropped when it is NULL
+void bus_map_rom(Bus* bus, unsigned first_page, unsigned num_pages, const uint8_t* host, BusWriteFn write, void* ctx);
+void bus_map_io(Bus* bus, unsigned first_page, unsigned num_pages, BusReadFn read, BusWriteFn write, void* ctx);
+// Backs num_pages from first_page with num_banks banks of RAM owned by the bus.
+// Bank 0 starts with the window's current contents and is selected. Returns
+// false if the window is out of range or the banks could not be allocated.
+bool bus_set_banks(Bus* bus, unsigned first_page, unsigned num_pages, unsigned num_banks);
+// Maps bank into the window, out of range banks are ignored
+void bus_select_bank(Bus* bus, unsigned bank);
+
+uint8_t bus_read_slow(Bus* bus, uint16_t addr);
+void bus_write_slow(Bus* bus, uint16_t addr, uint8_t value);
+
+static inline uint8_t bus_read(Bus* bus, uint16_t addr) {
+    const uint8_t* page = bus->read_page[addr >> BUS_PAGE_BITS];
+    if (page) return page[addr & (BUS_PAGE_SIZE - 1)];
+    return bus_read_slow(bus, addr);
+}
+
+// Returns true if the write landed in RAM
+static inline bool bus_write(Bus* bus, uint16_t addr, uint8_t value) {
+    uint8_t* page = bus->write_page[addr >> BUS_PAGE_BITS];
+    if (page) {
+        page[addr & (BUS_PAGE_SIZE - 1)] = value;
+        return true;
+    }
+    bus_write_slow(bus, addr, value);
+    return false;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include "console.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "input_log.h"
+
+// CP/M end of file
+#define CONSOLE_EOF 0x1A
+
+static bool file_sink(void* ctx, const char* data, size_t len) {
+    return fwrite(data, 1, len, ctx) == len && fflush(ctx) == 0;
+}
+
+static bool fd_sink(void* ctx, const char* data, size_t len) {
+    int fd = (int)(intptr_t)ctx;
+    while (len) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+void console_init(Console* console, FILE* stream) {
+    console->sink = NULL;
+    console->input = NULL;
+    console->peeked = EOF;
+    console->log = NULL;
+    console->data = NULL;
+    console->len = 0;
+    console->cap = 0;
+    console->truncated = false;
+    console->write_error = false;
+    if (stream) console_set_file(console, stream, isatty(fileno(stream)) ? CONSOLE_FLUSH_LINE : CONSOLE_FLUSH_FULL);
+    else console_set_sink(console, NULL, NULL, CONSOLE_FLUSH_EXIT);
+}
+
+void console_free(Console* console) {
+    console_flush(console);
+    free(console->data);
+    console->data = NULL;
+    console->len = 0;
+    console->cap = 0;
+}
+
+void console_set_file(Console* console, FILE* fp, ConsoleFlush flush) {
+    console_set_sink(console, file_sink, fp, flush);
+}
+
+void console_set_fd(Console* console, int fd, ConsoleFlush flush) {
+    console_set_sink(console, fd_sink, (void*)(intptr_t)fd, flush);
+}
+
+void console_set_sink(Console* console, ConsoleSink sink, void* ctx, ConsoleFlush flush) {
+    console_flush(console);
+    console->sink = sink;
+    console->sink_ctx = ctx;
+    console->flush = flush;
+}
+
+bool console_flush(Console* console) {
+    if (console->sink && console->len) {
+        if (!console->sink(console->sink_ctx, console->data, console->len)) console->write_error = true;
+        console->len = 0;
+    }
+    return !console->write_error;
+}
+
+static bool reserve(Console* console, size_t len) {
+    if (console->cap - console->len >= len) return true;
+    size_t cap = console->cap ? console->cap : 256;
+    while (cap - console->len < len) cap *= 2;
+    char* data = realloc(console->data, cap);
+    if (data == NULL) return false;
+    console->data = data;
+    console->cap = cap;
+    return true;
+}
+
+void console_write(Console* console, const char* data, size_t len) {
+    if (console->sink && console->flush != CONSOLE_FLUSH_EXIT && console->len + len > CONSOLE_BUFFER_SIZE) {
+        console_flush(console);
+        // Too big to be worth buffering
+        if (len >= CONSOLE_BUFFER_SIZE) {
+            if (!console->sink(console->sink_ctx, data, len)) console->write_error = true;
+            return;
+        }
+    }
+    if (!reserve(console, len)) {
+        console->truncated = true;
+        return;
+    }
+    memcpy(console->data + console->len, data, len);
+    console->len += len;
+    if (console->sink == NULL) return;
+    switch (console->flush) {
+        case CONSOLE_FLUSH_WRITE: console_flush(console); break;
+        case CONSOLE_FLUSH_LINE:
+            if (memchr(data, '\n', len) || console->len >= CONSOLE_BUFFER_SIZE) console_flush(console);
+            break;
+        case CONSOLE_FLUSH_FULL:
+            if (console->len >= CONSOLE_BUFFER_SIZE) console_flush(console);
+            break;
+        case CONSOLE_FLUSH_EXIT: break;
+    }
+}
+
+void console_putc(Console* console, char c) {
+    console_write(console, &c, 1);
+}
+
+// Replays the next console record, or reads one with read and records it.
+// Output waiting for a flush goes first, it may be the prompt.
+static uint8_t console_input(Console* console, uint64_t time, uint8_t (*read)(Console*)) {
+    uint8_t value;
+    console_flush(console);
+    if (console->log && console->log->replaying) {
+        return input_log_next(console->log, INPUT_CONSOLE, &time, &value, NULL) ? value : CONSOLE_EOF;
+    }
+    value = read(console);
+    if (console->log) input_log_append(console->log, INPUT_CONSOLE, time, value, 0);
+    return value;
+}
+
+static uint8_t read_byte(Console* console) {
+    int c = console->peeked;
+    console->peeked = EOF;
+    if (c == EOF && console->input) c = fgetc(console->input);
+    return c == EOF ? CONSOLE_EOF : (uint8_t)c;
+}
+
+// True when a read of input would not block. Streams without a descriptor,
+// such as fmemopen ones, never block.
+static bool input_ready(FILE* input) {
+    int fd = fileno(input);
+    if (fd < 0) return true;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Reads ahead one byte when one is ready, without waiting for a key
+static uint8_t read_status(Console* console) {
+    if (console->peeked != EOF) return 0xFF;
+    if (console->input == NULL || !input_ready(console->input)) return 0;
+    console->peeked = fgetc(console->input);
+    return console->peeked == EOF ? 0 : 0xFF;
+}
+
+uint8_t console_getc(Console* console, uint64_t time) {
+    return console_input(console, time, read_byte);
+}
+
+uint8_t console_status(Console* console, uint64_t time) {
+    return console_input(console, time, read_status);
+}
@@ -0,0 +1,66 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct InputLog;
+
+// Output bytes buffered before a CONSOLE_FLUSH_FULL console hands them on
+#define CONSOLE_BUFFER_SIZE 65536
+
+// When buffered output goes to the sink. Every policy flushes before input
+// is read and on console_flush().
+typedef enum {
+    CONSOLE_FLUSH_WRITE, // after every write
+    CONSOLE_FLUSH_LINE,  // after a write holding a newline, or once the buffer is full
+    CONSOLE_FLUSH_FULL,  // once the buffer is full
+    CONSOLE_FLUSH_EXIT   // only on console_flush(), the buffer grows until then
+} ConsoleFlush;
+
+// Takes len bytes of output, returns false on a write error
+typedef bool (*ConsoleSink)(void* ctx, const char* data, size_t len);
+
+// Guest console. Output collects in data and goes to the sink as the flush
+// policy says. Without a sink it stays in data, so guests running side by side
+// do not interleave and test harnesses can read it back. Input comes from
+// input, which reads as end of file when NULL. Make input unbuffered, or the
+// status check misses bytes stdio has read ahead.
+typedef struct {
+    ConsoleSink sink;
+    void* sink_ctx;
+    ConsoleFlush flush;
+    FILE* input;
+    int peeked; // byte read ahead by a status check, EOF for none
+    struct InputLog* log; // records input, or replays it instead of reading input
+    char* data;
+    size_t len;
+    size_t cap;
+    bool truncated;   // ran out of memory, later output was dropped
+    bool write_error; // the sink failed
+} Console;
+
+// Writes to stream, or captures output in data when stream is NULL. A stream
+// on a terminal flushes by line, any other by CONSOLE_BUFFER_SIZE.
+void console_init(Console* console, FILE* stream);
+// Flushes and frees the buffer
+void console_free(Console* console);
+// stdio stream, one fwrite and fflush per flush
+void console_set_file(Console* console, FILE* fp, ConsoleFlush flush);
+// File descriptor, such as a pipe, one write per flush and no stdio locking
+void console_set_fd(Console* console, int fd, ConsoleFlush flush);
+// NULL sink captures output in data
+void console_set_sink(Console* console, ConsoleSink sink, void* ctx, ConsoleFlush flush);
+void console_putc(Console* console, char c);
+void console_write(Console* console, const char* data, size_t len);
+// Hands buffered output to the sink, returns false if it ever failed
+bool console_flush(Console* console);
+// Next input byte, ^Z at end of file. time stamps it in the log.
+uint8_t console_getc(Console* console, uint64_t time);
+// 0xFF when an input byte is ready, 0 at end of file or when none has arrived yet.
+// Never waits.
+uint8_t console_status(Console* console, uint64_t time);
+
+#endif
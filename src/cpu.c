@@ -1,787 +1,803 @@
 #include "cpu.h"
+#include "flags.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "bus.h"
+#include "ports.h"
+#include "hooks.h"
+#include "profile.h"
+#include "sampler.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-#define SET_SZP(cpu, val) \
-    do { \
-        cpu->zf = (val) == 0; \
-        cpu->sf = (val) >> 7; \
-        cpu->pf = parity(val); \
-    } while(0)
+#define SET_SZP(cpu, val) (cpu->f = (cpu->f & ~(FLAG_S | FLAG_Z | FLAG_P)) | szp_table[(uint8_t)(val)])
+
+static const uint8_t cycles_table[256] = {
+    // Conditional CALL/RET entries hold the not-taken cost; taken adds 6
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0
+        4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 1
+        4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 2
+        4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 3
+        5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 4
+        5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 5
+        5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 6
+        7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 7
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 8
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 9
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // A
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // B
+        5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10,  4, 11, 17,  7, 11, // C
+        5, 10, 10, 10, 11, 11,  7, 11,  5,  4, 10, 10, 11,  4,  7, 11, // D
+        5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11,  4,  7, 11, // E
+        5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11,  4,  7, 11, // F
+};
+
+static const uint8_t length_table[256] = {
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1, // 0
+        1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1, // 1
+        1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1, // 2
+        1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1, // 3
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 4
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 5
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 6
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 7
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 8
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 9
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // A
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // B
+        1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1, // C
+        1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  1,  2,  1, // D
+        1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1, // E
+        1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1, // F
+};
+
+// Opcodes that may leave straight-line flow: jumps, calls, returns, RST, PCHL, HLT
+// and the hook trap
+static const bool block_end_table[256] = {
+    [0x76] = 1,
+    [0xc0] = 1, [0xc2] = 1, [0xc3] = 1, [0xc4] = 1, [0xc7] = 1, [0xc8] = 1, [0xc9] = 1, [0xca] = 1,
+    [0xcc] = 1, [0xcd] = 1, [0xcf] = 1, [0xd0] = 1, [0xd2] = 1, [0xd4] = 1, [0xd7] = 1, [0xd8] = 1,
+    [0xda] = 1, [0xdc] = 1, [0xdf] = 1, [0xe0] = 1, [0xe2] = 1, [0xe4] = 1, [0xe7] = 1, [0xe8] = 1,
+    [0xe9] = 1, [0xea] = 1, [0xec] = 1, [0xed] = 1, [0xef] = 1, [0xf0] = 1, [0xf2] = 1, [0xf4] = 1, [0xf7] = 1,
+    [0xf8] = 1, [0xfa] = 1, [0xfc] = 1, [0xff] = 1,
+};
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define NOINLINE __attribute__((noinline))
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define ALWAYS_INLINE inline
+#define NOINLINE
+#define UNLIKELY(x) (x)
+#endif
+
+// Flat memory stays a single load. Behind a bus, RAM and ROM pages cost a page
+// table lookup and only MMIO pages a call. The switch loop passes on_bus as a
+// constant, so each of its copies tests for a bus once per run, not per access.
+static ALWAYS_INLINE uint8_t load(Cpu* cpu, uint16_t addr, bool on_bus) {
+    if (on_bus) return bus_read(cpu->bus, addr);
+    return *(cpu->memory + addr);
+}
+
+static ALWAYS_INLINE uint8_t read_memory(Cpu* cpu, uint16_t addr) {
+    return load(cpu, addr, UNLIKELY(cpu->bus != NULL));
+}
+
+static ALWAYS_INLINE uint8_t fetch_byte(Cpu* cpu, bool on_bus) {
+    return load(cpu, cpu->pc++, on_bus);
+}
+
+// Behind a bus both bytes take one page lookup unless they straddle two pages
+static ALWAYS_INLINE uint16_t fetch_word(Cpu* cpu, bool on_bus) {
+    if (on_bus && (cpu->pc & (BUS_PAGE_SIZE - 1)) != BUS_PAGE_SIZE - 1) {
+        const uint8_t* page = cpu->bus->read_page[cpu->pc >> BUS_PAGE_BITS];
+        if (page) {
+            const uint8_t* at = page + (cpu->pc & (BUS_PAGE_SIZE - 1));
+            cpu->pc += 2;
+            return at[1] << 8 | at[0];
+        }
+    }
+    uint16_t word = load(cpu, cpu->pc + 1, on_bus) << 8 | load(cpu, cpu->pc, on_bus);
+    cpu->pc += 2;
+    return word;
+}
+
+static ALWAYS_INLINE uint8_t next_byte(Cpu* cpu) {
+    return fetch_byte(cpu, UNLIKELY(cpu->bus != NULL));
+}
+
+static ALWAYS_INLINE uint16_t next_word(Cpu* cpu) {
+    return fetch_word(cpu, UNLIKELY(cpu->bus != NULL));
+}
 
 uint8_t cpu_read_byte(Cpu* cpu) {
-    return *(cpu->memory + cpu->pc++);
+    return next_byte(cpu);
 }
 
 uint8_t cpu_read_next_byte(Cpu* cpu) {
-    return *(cpu->memory + cpu->pc + 1);
+    return read_memory(cpu, cpu->pc + 1);
 }
 
 uint16_t cpu_read_word(Cpu* cpu) {
-    uint16_t word = *(cpu->memory + cpu->pc + 1) << 8 | *(cpu->memory + cpu->pc);
-    cpu->pc += 2;
-    return word;
+    return next_word(cpu);
 }
 
 uint8_t cpu_get_content_addr(Cpu* cpu, uint16_t addr) {
-    return *(cpu->memory + addr);
+    return read_memory(cpu, addr);
+}
+
+static void set_flags(Cpu* cpu, uint8_t f) {
+    cpu->f = f | FLAG_FIXED;
+#ifdef CPU_LAZY_FLAGS
+    cpu->lazy_op = LAZY_NONE;
+#endif
+}
+
+// Flag producers (flags_*) and consumers (flag_*). The eager core updates f
+// right away. The lazy core only records the last flag-setting operation and
+// derives a flag when something reads it.
+#ifdef CPU_LAZY_FLAGS
+static void record_flags(Cpu* cpu, uint8_t op, uint8_t x, uint8_t y, uint8_t cy, uint8_t res) {
+    cpu->lazy_op = op;
+    cpu->lazy_x = x;
+    cpu->lazy_y = y;
+    cpu->lazy_cy = cy;
+    cpu->lazy_res = res;
+}
+
+static bool flag_s(const Cpu* cpu) {
+    return cpu->lazy_op ? cpu->lazy_res >> 7 : (cpu->f & FLAG_S) != 0;
 }
 
-static uint8_t parity(uint8_t val) {
-    uint8_t num_bits = 0;
-    for (uint8_t i = 0; i < 8; i++) {
-        if (val & 0x1) num_bits++;
-        val = val >> 1;
+static bool flag_z(const Cpu* cpu) {
+    return cpu->lazy_op ? cpu->lazy_res == 0 : (cpu->f & FLAG_Z) != 0;
+}
+
+static bool flag_p(const Cpu* cpu) {
+    return ((cpu->lazy_op ? szp_table[cpu->lazy_res] : cpu->f) & FLAG_P) != 0;
+}
+
+static bool flag_c(const Cpu* cpu) {
+    switch (cpu->lazy_op) {
+        case LAZY_NONE: return cpu->f & FLAG_C;
+        case LAZY_ADD: return cpu->lazy_x + cpu->lazy_y + cpu->lazy_cy > 0xFF;
+        case LAZY_SUB: return cpu->lazy_x < cpu->lazy_y + cpu->lazy_cy;
+        case LAZY_LOGIC: return 0;
+        default: return cpu->lazy_cy;
     }
-    return (num_bits % 2 == 0);
 }
 
-static uint8_t carry_add(uint8_t a, uint8_t b, uint8_t cy) {
-    uint16_t result = a + b + cy;
-    return (result > UINT8_MAX);
+void cpu_sync_flags(Cpu* cpu) {
+    uint8_t f = szp_table[cpu->lazy_res];
+    switch (cpu->lazy_op) {
+        case LAZY_NONE: return;
+        case LAZY_ADD: f = add_flags_table[cpu->lazy_cy][cpu->lazy_x][cpu->lazy_y]; break;
+        case LAZY_SUB: f = sub_flags_table[cpu->lazy_cy][cpu->lazy_x][cpu->lazy_y]; break;
+        case LAZY_LOGIC: if (cpu->lazy_x) f |= FLAG_A; break;
+        case LAZY_INR: if ((cpu->lazy_res & 0xF) == 0) f |= FLAG_A; f |= cpu->lazy_cy; break;
+        case LAZY_DCR: if ((cpu->lazy_res & 0xF) != 0xF) f |= FLAG_A; f |= cpu->lazy_cy; break;
+    }
+    set_flags(cpu, f);
+}
+
+static void flags_add(Cpu* cpu, uint8_t x, uint8_t y, uint8_t cy) {
+    record_flags(cpu, LAZY_ADD, x, y, cy, x + y + cy);
 }
 
-static uint8_t carry_sub(uint8_t a, uint8_t b, uint8_t cy) {
-    int16_t difference = a - b - cy;
-    return (difference < 0);
+static void flags_sub(Cpu* cpu, uint8_t x, uint8_t y, uint8_t cy) {
+    record_flags(cpu, LAZY_SUB, x, y, cy, x - y - cy);
 }
 
-static uint8_t get_content_addr_in_reg(Cpu* cpu, uint8_t rh, uint8_t rl) {
-    return *(cpu->memory + ((rh << 8) | rl));
+static void flags_logic(Cpu* cpu, uint8_t res, bool af) {
+    record_flags(cpu, LAZY_LOGIC, af, 0, 0, res);
 }
 
-static void set_content_addr(Cpu* cpu, uint16_t addr, uint8_t content) {
-    *(cpu->memory + addr) = content;
+static void flags_inr(Cpu* cpu, uint8_t res) {
+    record_flags(cpu, LAZY_INR, 0, 0, flag_c(cpu), res);
 }
 
-static void set_content_addr_in_reg(Cpu* cpu, uint8_t rh, uint8_t rl, uint8_t content) {
-    *(cpu->memory + ((rh << 8) | rl)) = content;
+static void flags_dcr(Cpu* cpu, uint8_t res) {
+    record_flags(cpu, LAZY_DCR, 0, 0, flag_c(cpu), res);
+}
+#else
+static bool flag_s(const Cpu* cpu) {
+    return (cpu->f & FLAG_S) != 0;
 }
 
-static uint16_t get_reg_pair(uint8_t rh, uint8_t rl) {
-    return ((rh << 8) | rl);
+static bool flag_z(const Cpu* cpu) {
+    return (cpu->f & FLAG_Z) != 0;
 }
 
-static void set_reg_pair(uint8_t* rh, uint8_t* rl, uint16_t word) {
-    *rh = word >> 8;
-    *rl = word & 0xFF;
+static bool flag_p(const Cpu* cpu) {
+    return (cpu->f & FLAG_P) != 0;
+}
+
+static bool flag_c(const Cpu* cpu) {
+    return cpu->f & FLAG_C;
+}
+
+void cpu_sync_flags(Cpu* cpu) {
+    (void)cpu;
+}
+
+static void flags_add(Cpu* cpu, uint8_t x, uint8_t y, uint8_t cy) {
+    set_flags(cpu, add_flags_table[cy][x][y]);
+}
+
+static void flags_sub(Cpu* cpu, uint8_t x, uint8_t y, uint8_t cy) {
+    set_flags(cpu, sub_flags_table[cy][x][y]);
+}
+
+static void flags_logic(Cpu* cpu, uint8_t res, bool af) {
+    set_flags(cpu, szp_table[res] | (af ? FLAG_A : 0));
+}
+
+static void flags_inr(Cpu* cpu, uint8_t res) {
+    SET_SZP(cpu, res);
+    // carry when value before incrementing is 0xF
+    cpu->f = (res & 0xF) == 0 ? cpu->f | FLAG_A : cpu->f & ~FLAG_A;
+}
+
+static void flags_dcr(Cpu* cpu, uint8_t res) {
+    SET_SZP(cpu, res);
+    // always a carry except when value before decrementing is 0x0
+    cpu->f = (res & 0xF) != 0xF ? cpu->f | FLAG_A : cpu->f & ~FLAG_A;
+}
+#endif
+
+static NOINLINE void write_device(Cpu* cpu, uint16_t addr, uint8_t content) {
+    uint32_t generation = cpu->bus->generation;
+    bus_write_slow(cpu->bus, addr, content);
+    // A device that switched banks ends the current block
+    if (cpu->block_cache && cpu->bus->generation != generation) cpu->block_cache->invalidated = true;
+}
+
+static ALWAYS_INLINE void store(Cpu* cpu, uint16_t addr, uint8_t content, bool on_bus) {
+    if (on_bus) {
+        uint8_t* page = cpu->bus->write_page[addr >> BUS_PAGE_BITS];
+        if (page == NULL) {
+            write_device(cpu, addr, content);
+            return;
+        }
+        page[addr & (BUS_PAGE_SIZE - 1)] = content;
+    }
+    else *(cpu->memory + addr) = content;
+    if (cpu->block_cache) block_cache_write(cpu->block_cache, addr);
+    if (UNLIKELY(cpu->dirty != NULL)) cpu->dirty[addr >> 8] = 1;
+}
+
+static ALWAYS_INLINE void set_content_addr(Cpu* cpu, uint16_t addr, uint8_t content) {
+    store(cpu, addr, content, UNLIKELY(cpu->bus != NULL));
+}
+
+void cpu_set_content_addr(Cpu* cpu, uint16_t addr, uint8_t content) {
+    set_content_addr(cpu, addr, content);
+}
+
+static ALWAYS_INLINE uint16_t get_word(Cpu* cpu, uint16_t addr) {
+    return cpu_get_content_addr(cpu, addr + 1) << 8 | cpu_get_content_addr(cpu, addr);
+}
+
+static void set_word(Cpu* cpu, uint16_t addr, uint16_t word) {
+    set_content_addr(cpu, addr, word & 0xFF);
+    set_content_addr(cpu, addr + 1, word >> 8);
 }
 
 static void NOP(void) {
     return;
 }
 
-static void pop(Cpu* cpu, uint8_t* rh, uint8_t* rl) {
-    *rl = *(cpu->memory + cpu->sp);
-    *rh = *(cpu->memory + cpu->sp + 1);
+static ALWAYS_INLINE void pop(Cpu* cpu, uint16_t* pair) {
+    *pair = get_word(cpu, cpu->sp);
     cpu->sp += 2;
 }
 
 static void pop_psw(Cpu* cpu) {
-    uint8_t content = cpu_get_content_addr(cpu, cpu->sp);
-    cpu->cf = content & 0x1;  // 0001
-    cpu->pf = content & 0x4;  // 0100
-    cpu->af = content & 0x10; // 10000
-    cpu->zf = content & 0x40; // 1000000
-    cpu->sf = content & 0x80; // 10000000
-    cpu->a = cpu_get_content_addr(cpu, cpu->sp + 1);
+    uint16_t word = get_word(cpu, cpu->sp);
+    cpu->a = word >> 8;
+    set_flags(cpu, word & (FLAG_S | FLAG_Z | FLAG_A | FLAG_P | FLAG_C));
     cpu->sp += 2;
 }
 
-static void push(Cpu* cpu, uint8_t rh, uint8_t rl) {
-    set_content_addr(cpu, cpu->sp - 1, rh);
-    set_content_addr(cpu, cpu->sp - 2, rl);
+static void push(Cpu* cpu, uint16_t pair) {
+    set_content_addr(cpu, cpu->sp - 1, pair >> 8);
+    set_content_addr(cpu, cpu->sp - 2, pair & 0xFF);
     cpu->sp -= 2;
 }
 
 static void push_psw(Cpu* cpu) {
-    set_content_addr(cpu, cpu->sp - 1, cpu->a);
-    uint8_t content = 0x00;
-    content |= cpu->cf;
-    content |= (uint8_t)(1 << 1); // Not needed but w/e
-    content |= (cpu->pf << 2);
-    content |= (uint8_t)(0 << 3);
-    content |= (cpu->af << 4);
-    content |= (uint8_t)(0 << 5);
-    content |= (cpu->zf << 6);
-    content |= (cpu->sf << 7);
-    set_content_addr(cpu, cpu->sp - 2, content);
-    cpu->sp -= 2;
+    cpu_sync_flags(cpu);
+    push(cpu, cpu->psw);
+}
+
+static void set_carry(Cpu* cpu, bool cy) {
+    cpu->f = (cpu->f & ~FLAG_C) | cy;
 }
 
 static void RRC(Cpu* cpu) {
+    cpu_sync_flags(cpu);
     uint8_t bit0 = cpu->a & 0x1;
-    cpu->a = cpu->a >> 1;
-    if (bit0) cpu->a |= (bit0 << 7); // Set bit7 while keeping all other bits
-    else cpu->a &= (0xFF >> 1); // Clear bit7 while keeping all other bits
-    cpu->cf = bit0;
+    cpu->a = cpu->a >> 1 | bit0 << 7;
+    set_carry(cpu, bit0);
 }
 
 static void RAR(Cpu* cpu) {
+    cpu_sync_flags(cpu);
     uint8_t bit0 = cpu->a & 0x1;
-    cpu->a = cpu->a >> 1;
-    if (cpu->cf) cpu->a |= (cpu->cf << 7); // Set bit7 while keeping all other bits
-    else cpu->a &= (0xFF >> 1); // Clear bit7 while keeping all other bits
-    cpu->cf = bit0;
+    cpu->a = cpu->a >> 1 | (cpu->f & FLAG_C) << 7;
+    set_carry(cpu, bit0);
 }
 
 static void RLC(Cpu* cpu) {
+    cpu_sync_flags(cpu);
     uint8_t bit7 = cpu->a >> 7;
-    cpu->a = cpu->a << 1;
-    cpu->a = (cpu->a) | bit7;
-    cpu->cf = bit7;
+    cpu->a = cpu->a << 1 | bit7;
+    set_carry(cpu, bit7);
 }
 
 static void RAL(Cpu* cpu) {
+    cpu_sync_flags(cpu);
     uint8_t bit7 = cpu->a >> 7;
-    cpu->a = cpu->a << 1;
-    cpu->a = (cpu->a) | cpu->cf;
-    cpu->cf = bit7;
+    cpu->a = cpu->a << 1 | (cpu->f & FLAG_C);
+    set_carry(cpu, bit7);
 }
 
 static void CALL(Cpu* cpu, uint16_t word) {
-    *(cpu->memory + (uint16_t)(cpu->sp - 1)) = cpu->pc >> 8;
-    *(cpu->memory + (uint16_t)(cpu->sp - 2)) = cpu->pc & 0xFF;
-    cpu->sp -= 2;
+    push(cpu, cpu->pc);
     cpu->pc = word;
 }
 
-static void RET(Cpu* cpu) {
-    cpu->pc = cpu_get_content_addr(cpu, cpu->sp);
-    cpu->pc |= cpu_get_content_addr(cpu, cpu->sp + 1) << 8;
-    cpu->sp += 2;
+static ALWAYS_INLINE void RET(Cpu* cpu) {
+    pop(cpu, &cpu->pc);
 }
 
 static void DCR(Cpu* cpu, uint8_t* reg) {
     *reg -= 1;
-    SET_SZP(cpu, *reg);
-    cpu->af = !((*reg & 0xF) == 0xF); // always a carry except when value before decrementing is 0x0
+    flags_dcr(cpu, *reg);
 }
 
-static void DCX(uint8_t* rh, uint8_t* rl) {
-    uint16_t reg_pair = get_reg_pair(*rh, *rl);
-    uint16_t result = reg_pair -= 1;
-    set_reg_pair(rh, rl, result);
+static void DCR_M(Cpu* cpu) {
+    uint8_t content = cpu_get_content_addr(cpu, cpu->hl);
+    DCR(cpu, &content);
+    set_content_addr(cpu, cpu->hl, content);
 }
 
 static void INR(Cpu* cpu, uint8_t* reg) {
     *reg += 1;
-    SET_SZP(cpu, *reg);
-    cpu->af = (*reg & 0xF) == 0; // carry when value before incrementing is 0xF
+    flags_inr(cpu, *reg);
 }
 
-static void INX(uint8_t* rh, uint8_t* rl) {
-    uint16_t reg_pair = get_reg_pair(*rh, *rl);
-    uint16_t result = reg_pair += 1;
-    set_reg_pair(rh, rl, result);
+static void INR_M(Cpu* cpu) {
+    uint8_t content = cpu_get_content_addr(cpu, cpu->hl);
+    INR(cpu, &content);
+    set_content_addr(cpu, cpu->hl, content);
 }
 
 static void XRA(Cpu* cpu, uint8_t reg) {
     cpu->a ^= reg;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = 0;
-    cpu->cf = 0;
+    flags_logic(cpu, cpu->a, 0);
 }
 
 static void ADD(Cpu* cpu, uint8_t reg) {
-    uint8_t prev = cpu->a;
+    flags_add(cpu, cpu->a, reg, 0);
     cpu->a += reg;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = ((prev & 0xF) + (reg & 0xF)) & 0x10;
-    cpu->cf = carry_add(prev, reg, 0);
 }
 
 static void SUB(Cpu* cpu, uint8_t reg) {
-    uint8_t prev = cpu->a;
+    flags_sub(cpu, cpu->a, reg, 0);
     cpu->a -= reg;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = ((prev & 0xF) + ((~reg & 0xF) + 1)) & 0x10; // a - b = a + (-b)
-    cpu->cf = carry_sub(prev, reg, 0);
 }
 
 static void ADC(Cpu* cpu, uint8_t reg) {
-    uint8_t prev = cpu->a;
-    cpu->a = prev + reg + cpu->cf;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = ((prev & 0xF) + (reg & 0xF) + cpu->cf) & 0x10;
-    cpu->cf = carry_add(prev, reg, cpu->cf);
+    uint8_t cy = flag_c(cpu);
+    flags_add(cpu, cpu->a, reg, cy);
+    cpu->a += reg + cy;
 }
 
 static void SBB(Cpu* cpu, uint8_t reg) {
-    uint8_t prev = cpu->a;
-    cpu->a = prev - reg - cpu->cf;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = ((prev & 0xF) + (~reg & 0xF) + !cpu->cf) & 0x10;
-    cpu->cf = carry_sub(prev, reg, cpu->cf);
+    uint8_t cy = flag_c(cpu);
+    flags_sub(cpu, cpu->a, reg, cy);
+    cpu->a -= reg + cy;
 }
 
 static void ANA(Cpu* cpu, uint8_t reg) {
     uint8_t prev = cpu->a;
     cpu->a &= reg;
-    SET_SZP(cpu, cpu->a);
-    cpu->af = ((prev | reg) & 0x08) != 0; // https://www.quora.com/What-is-the-auxiliary-carry-set-when-ANA-R-instruction-is-executed-in-an-8085-CPU
-    cpu->cf = 0;
+    flags_logic(cpu, cpu->a, ((prev | reg) & 0x08) != 0); // https://www.quora.com/What-is-the-auxiliary-carry-set-when-ANA-R-instruction-is-executed-in-an-8085-CPU
 }
 
 static void ORA(Cpu* cpu, uint8_t reg) {
     cpu->a |= reg;
-    SET_SZP(cpu, cpu->a);
-    cpu->cf = 0;
-    cpu->af = 0;
+    flags_logic(cpu, cpu->a, 0);
 }
 
 static void CMP(Cpu* cpu, uint8_t reg) {
-    uint8_t result = cpu->a - reg;
-    SET_SZP(cpu, result);
-    cpu->cf = carry_sub(cpu->a, reg, 0);
-    cpu->af = ((cpu->a & 0xF) + ((~reg & 0xF) + 1)) & 0x10;
+    flags_sub(cpu, cpu->a, reg, 0);
 }
 
-static void LDAX(Cpu* cpu, uint8_t rh, uint8_t rl) {
-    uint16_t reg_pair = get_reg_pair(rh, rl);
-    cpu->a = cpu_get_content_addr(cpu, reg_pair);
+static void DAD(Cpu* cpu, uint16_t pair) {
+    uint32_t sum = cpu->hl + pair;
+    cpu_sync_flags(cpu);
+    cpu->hl = sum;
+    set_carry(cpu, sum > UINT16_MAX);
 }
 
-static void STAX(Cpu* cpu, uint8_t rh, uint8_t rl) {
-    uint16_t reg_pair = get_reg_pair(rh, rl);
-    set_content_addr(cpu, reg_pair, cpu->a);
+static void DAA(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    uint16_t entry = daa_table[(cpu->f & FLAG_C) << 1 | (cpu->f & FLAG_A) >> 4][cpu->a];
+    cpu->a = entry >> 8;
+    set_flags(cpu, entry & 0xFF);
 }
 
-static void DAD(Cpu* cpu, uint8_t rh, uint8_t rl) {
-    uint16_t hl = get_reg_pair(cpu->h, cpu->l);
-    uint16_t old_hl = hl;
-    uint16_t reg_pair = get_reg_pair(rh, rl);
-    hl += reg_pair;
-    set_reg_pair(&cpu->h, &cpu->l, hl);
-    cpu->cf = (uint32_t)(old_hl + reg_pair > UINT16_MAX);
+static void STC(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    cpu->f |= FLAG_C;
 }
 
-static void DAA(Cpu* cpu) {
-    uint8_t cy = 0;
-    uint8_t least_sig_4_bits = cpu->a & 0xF;
-    uint8_t correction = 0;
-    if (least_sig_4_bits > 9 || cpu->af) {
-        correction |= 0x06;
+static void CMC(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    cpu->f ^= FLAG_C;
+}
+
+static void OUT(Cpu* cpu, uint8_t port) {
+    if (cpu->ports) ports_out(cpu->ports, port, cpu->a);
+}
+
+static void IN(Cpu* cpu, uint8_t port) {
+    cpu->a = cpu->ports ? ports_in(cpu->ports, port) : 0xFF;
+}
+
+bool cpu_interrupt(Cpu* cpu, uint8_t n) {
+    if (!cpu->interrupt || cpu->cycles == cpu->ei_cycles) return false;
+    cpu->interrupt = 0;
+    // pc stays on the HLT while halted, the handler returns past it
+    if (cpu->halted) cpu->pc += 1;
+    cpu->halted = 0;
+    CALL(cpu, (n & 7) << 3);
+    cpu->cycles += cycles_table[0xc7];
+    return true;
+}
+
+uint8_t cpu_opcode_cycles(uint8_t opcode) {
+    return cycles_table[opcode];
+}
+
+uint8_t cpu_opcode_length(uint8_t opcode) {
+    return length_table[opcode];
+}
+
+bool cpu_opcode_ends_block(uint8_t opcode) {
+    return block_end_table[opcode];
+}
+
+static ALWAYS_INLINE uint8_t execute_opcode(Cpu* cpu, uint8_t opcode, bool on_bus) {
+    uint8_t cycles = cycles_table[opcode];
+    switch (opcode) {
+#define OP(n) case n:
+#define NEXT break
+#define HALT break
+#define TAKEN cycles += 6
+#define REFUND cycles = 0
+#define IMM8 fetch_byte(cpu, on_bus)
+#define IMM16 fetch_word(cpu, on_bus)
+#define LOAD(addr) load(cpu, addr, on_bus)
+#define STORE(addr, value) store(cpu, addr, value, on_bus)
+#include "cpu_ops.inc"
+#undef OP
+#undef NEXT
+#undef HALT
+#undef TAKEN
+#undef REFUND
+#undef IMM8
+#undef IMM16
+#undef LOAD
+#undef STORE
+        default: break;
     }
-    uint8_t most_sig_4_bits = cpu->a >> 4;
-    if (most_sig_4_bits > 9 || cpu->cf || (most_sig_4_bits >= 9 && least_sig_4_bits > 9)) {
-        correction |= 0x60;
-        cy = 1;
+    cpu->cycles += cycles;
+    return cycles;
+}
+
+uint8_t cpu_execute(Cpu* cpu) {
+    if (cpu->bus) return execute_opcode(cpu, fetch_byte(cpu, true), true);
+    return execute_opcode(cpu, fetch_byte(cpu, false), false);
+}
+
+static ALWAYS_INLINE uint64_t run_switch(Cpu* cpu, uint64_t cycle_budget, bool on_bus) {
+    uint64_t start = cpu->cycles;
+    while (cpu->cycles - start < cycle_budget && !cpu->halted) {
+        execute_opcode(cpu, fetch_byte(cpu, on_bus), on_bus);
     }
-    ADD(cpu, correction);
-    cpu->cf = cy;
+    return cpu->cycles - start;
 }
 
-static void OUT() {
-    return;
+// One copy of the loop for flat memory and one for a bus
+uint64_t cpu_run_switch(Cpu* cpu, uint64_t cycle_budget) {
+    if (cpu->bus) return run_switch(cpu, cycle_budget, true);
+    return run_switch(cpu, cycle_budget, false);
 }
 
-static void IN() {
-    return;
+uint64_t cpu_run_profiled(Cpu* cpu, uint64_t cycle_budget, Profile* profile) {
+    uint64_t start = cpu->cycles;
+    while (cpu->cycles - start < cycle_budget && !cpu->halted) {
+        uint16_t pc = cpu->pc;
+        uint8_t opcode = next_byte(cpu);
+        profile_count(profile, pc, opcode, execute_opcode(cpu, opcode, UNLIKELY(cpu->bus != NULL)));
+    }
+    return cpu->cycles - start;
 }
 
-void cpu_execute(Cpu* cpu) {
-    uint8_t opcode = cpu_read_byte(cpu);
-    switch (opcode) {
-        case 0x00: NOP(); break;
-                   // LXI
-        case 0x01: set_reg_pair(&cpu->b, &cpu->c, cpu_read_word(cpu)); break;
-        case 0x02: STAX(cpu, cpu->b, cpu->c); break;
-        case 0x03: INX(&cpu->b, &cpu->c); break;
-        case 0x04: INR(cpu, &cpu->b); break;
-        case 0x05: DCR(cpu, &cpu->b); break;
-                   // MVI
-        case 0x06: cpu->b = cpu_read_byte(cpu); break;
-        case 0x07: RLC(cpu); break;
-        case 0x08: NOP(); break;
-        case 0x09: DAD(cpu, cpu->b, cpu->c); break;
-        case 0x0A: LDAX(cpu, cpu->b, cpu->c); break;
-        case 0x0B: DCX(&cpu->b, &cpu->c); break;
-        case 0x0C: INR(cpu, &cpu->c); break;
-        case 0x0D: DCR(cpu, &cpu->c); break;
-                   // MVI
-        case 0x0E: cpu->c = cpu_read_byte(cpu); break;
-        case 0x0F: RRC(cpu); break;
-        case 0x10: NOP(); break;
-                   // LXI
-        case 0x11: set_reg_pair(&cpu->d, &cpu->e, cpu_read_word(cpu)); break;
-        case 0x12: STAX(cpu, cpu->d, cpu->e); break;
-        case 0x13: INX(&cpu->d, &cpu->e); break;
-        case 0x14: INR(cpu, &cpu->d); break;
-        case 0x15: DCR(cpu, &cpu->d); break;
-                   // MVI
-        case 0x16: cpu->d = cpu_read_byte(cpu); break;
-        case 0x17: RAL(cpu); break;
-        case 0x18: NOP(); break;
-        case 0x19: DAD(cpu, cpu->d, cpu->e); break;
-        case 0x1A: LDAX(cpu, cpu->d, cpu->e); break;
-        case 0x1B: DCX(&cpu->d, &cpu->e); break;
-        case 0x1C: INR(cpu, &cpu->e); break;
-        case 0x1D: DCR(cpu, &cpu->e); break;
-                   // MVI
-        case 0x1E: cpu->e = cpu_read_byte(cpu); break;
-        case 0x1F: RAR(cpu); break;
-        case 0x20: NOP(); break;
-                   // LXI
-        case 0x21: set_reg_pair(&cpu->h, &cpu->l, cpu_read_word(cpu)); break;
-                  // SHLD
-        case 0x22: {
-            uint16_t word = cpu_read_word(cpu);
-            set_content_addr(cpu, word, cpu->l);
-            set_content_addr(cpu, word + 1, cpu->h);
-            break;
-        }
-        case 0x23: INX(&cpu->h, &cpu->l); break;
-        case 0x24: INR(cpu, &cpu->h); break;
-        case 0x25: DCR(cpu, &cpu->h); break;
-                   // MVI
-        case 0x26: cpu->h = cpu_read_byte(cpu); break;
-        case 0x27: DAA(cpu); break;
-        case 0x28: NOP(); break;
-        case 0x29: DAD(cpu, cpu->h, cpu->l); break;
-                   // LHLD
-        case 0x2A: {
-            uint16_t word = cpu_read_word(cpu);
-            cpu->l = cpu_get_content_addr(cpu, word);
-            cpu->h = cpu_get_content_addr(cpu, word + 1);
-            break;
-        }
-        case 0x2B: DCX(&cpu->h, &cpu->l); break;
-        case 0x2C: INR(cpu, &cpu->l); break;
-        case 0x2D: DCR(cpu, &cpu->l); break;
-                   // MVI
-        case 0x2E: cpu->l = cpu_read_byte(cpu); break;
-                   // CMA
-        case 0x2F: cpu->a = ~cpu->a; break;
-        case 0x30: NOP(); break;
-                   // LXI
-        case 0x31: cpu->sp = cpu_read_word(cpu); break;
-                   // STA
-        case 0x32: set_content_addr(cpu, cpu_read_word(cpu), cpu->a); break;
-                   // INX
-        case 0x33: cpu->sp += 1; break;
-        case 0x34: INR(cpu, (cpu->memory + get_reg_pair(cpu->h, cpu->l))); break;
-        case 0x35: DCR(cpu, (cpu->memory + get_reg_pair(cpu->h, cpu->l))); break;
-                   // MVI
-        case 0x36: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu_read_byte(cpu)); break;
-                   // STC
-        case 0x37: cpu->cf = 1; break;
-        case 0x38: NOP(); break;
-        case 0x39: DAD(cpu, cpu->sp >> 8, cpu->sp & 0xFF); break;
-                   // LDA
-        case 0x3A: {
-            uint16_t word = cpu_read_word(cpu);
-            cpu->a = cpu_get_content_addr(cpu, word);
-            break;
-        }
-                   // DCX
-        case 0x3B: cpu->sp -= 1; break;
-        case 0x3C: INR(cpu, &cpu->a); break;
-        case 0x3D: DCR(cpu, &cpu->a); break;
-                   // MVI
-        case 0x3E: cpu->a = cpu_read_byte(cpu); break;
-                   // CMC
-        // MOV Instructions
-        case 0x3F: cpu->cf = !cpu->cf; break;
-        case 0x40: cpu->b = cpu->b; break;
-        case 0x41: cpu->b = cpu->c; break;
-        case 0x42: cpu->b = cpu->d; break;
-        case 0x43: cpu->b = cpu->e; break;
-        case 0x44: cpu->b = cpu->h; break;
-        case 0x45: cpu->b = cpu->l; break;
-        case 0x46: cpu->b = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x47: cpu->b = cpu->a; break;
-        case 0x48: cpu->c = cpu->b; break;
-        case 0x49: cpu->c = cpu->c; break;
-        case 0x4A: cpu->c = cpu->d; break;
-        case 0x4B: cpu->c = cpu->e; break;
-        case 0x4C: cpu->c = cpu->h; break;
-        case 0x4D: cpu->c = cpu->l; break;
-        case 0x4E: cpu->c = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x4F: cpu->c = cpu->a; break;
-        case 0x50: cpu->d = cpu->b; break;
-        case 0x51: cpu->d = cpu->c; break;
-        case 0x52: cpu->d = cpu->d; break;
-        case 0x53: cpu->d = cpu->e; break;
-        case 0x54: cpu->d = cpu->h; break;
-        case 0x55: cpu->d = cpu->l; break;
-        case 0x56: cpu->d = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x57: cpu->d = cpu->a; break;
-        case 0x58: cpu->e = cpu->b; break;
-        case 0x59: cpu->e = cpu->c; break;
-        case 0x5A: cpu->e = cpu->d; break;
-        case 0x5B: cpu->e = cpu->e; break;
-        case 0x5C: cpu->e = cpu->h; break;
-        case 0x5D: cpu->e = cpu->l; break;
-        case 0x5E: cpu->e = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x5F: cpu->e = cpu->a; break;
-        case 0x60: cpu->h = cpu->b; break;
-        case 0x61: cpu->h = cpu->c; break;
-        case 0x62: cpu->h = cpu->d; break;
-        case 0x63: cpu->h = cpu->e; break;
-        case 0x64: cpu->h = cpu->h; break;
-        case 0x65: cpu->h = cpu->l; break;
-        case 0x66: cpu->h = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x67: cpu->h = cpu->a; break;
-        case 0x68: cpu->l = cpu->b; break;
-        case 0x69: cpu->l = cpu->c; break;
-        case 0x6a: cpu->l = cpu->d; break;
-        case 0x6b: cpu->l = cpu->e; break;
-        case 0x6c: cpu->l = cpu->h; break;
-        case 0x6d: cpu->l = cpu->l; break;
-        case 0x6e: cpu->l = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x6f: cpu->l = cpu->a; break;
-        case 0x70: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->b); break;
-        case 0x71: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->c); break;
-        case 0x72: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->d); break;
-        case 0x73: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->e); break;
-        case 0x74: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->h); break;
-        case 0x75: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->l); break;
-        case 0x76: NOP(); break;
-        case 0x77: set_content_addr_in_reg(cpu, cpu->h, cpu->l, cpu->a); break;
-        case 0x78: cpu->a = cpu->b; break;
-        case 0x79: cpu->a = cpu->c; break;
-        case 0x7a: cpu->a = cpu->d; break;
-        case 0x7b: cpu->a = cpu->e; break;
-        case 0x7c: cpu->a = cpu->h; break;
-        case 0x7d: cpu->a = cpu->l; break;
-        case 0x7e: cpu->a = get_content_addr_in_reg(cpu, cpu->h, cpu->l); break;
-        case 0x7f: cpu->a = cpu->a; break;
-        case 0x80: ADD(cpu, cpu->b); break;
-        case 0x81: ADD(cpu, cpu->c); break;
-        case 0x82: ADD(cpu, cpu->d); break;
-        case 0x83: ADD(cpu, cpu->e); break;
-        case 0x84: ADD(cpu, cpu->h); break;
-        case 0x85: ADD(cpu, cpu->l); break;
-        case 0x86: ADD(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0x87: ADD(cpu, cpu->a); break;
-        case 0x88: ADC(cpu, cpu->b); break;
-        case 0x89: ADC(cpu, cpu->c); break;
-        case 0x8a: ADC(cpu, cpu->d); break;
-        case 0x8b: ADC(cpu, cpu->e); break;
-        case 0x8c: ADC(cpu, cpu->h); break;
-        case 0x8d: ADC(cpu, cpu->l); break;
-        case 0x8e: ADC(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0x8f: ADC(cpu, cpu->a); break;
-        case 0x90: SUB(cpu, cpu->b); break;
-        case 0x91: SUB(cpu, cpu->c); break;
-        case 0x92: SUB(cpu, cpu->d); break;
-        case 0x93: SUB(cpu, cpu->e); break;
-        case 0x94: SUB(cpu, cpu->h); break;
-        case 0x95: SUB(cpu, cpu->l); break;
-        case 0x96: SUB(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0x97: SUB(cpu, cpu->a); break;
-        case 0x98: SBB(cpu, cpu->b); break;
-        case 0x99: SBB(cpu, cpu->c); break;
-        case 0x9a: SBB(cpu, cpu->d); break;
-        case 0x9b: SBB(cpu, cpu->e); break;
-        case 0x9c: SBB(cpu, cpu->h); break;
-        case 0x9d: SBB(cpu, cpu->l); break;
-        case 0x9e: SBB(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0x9f: SBB(cpu, cpu->a); break;
-        case 0xa0: ANA(cpu, cpu->b); break;
-        case 0xa1: ANA(cpu, cpu->c); break;
-        case 0xa2: ANA(cpu, cpu->d); break;
-        case 0xa3: ANA(cpu, cpu->e); break;
-        case 0xa4: ANA(cpu, cpu->h); break;
-        case 0xa5: ANA(cpu, cpu->l); break;
-        case 0xa6: ANA(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0xa7: ANA(cpu, cpu->a); break;
-        case 0xa8: XRA(cpu, cpu->b); break;
-        case 0xa9: XRA(cpu, cpu->c); break;
-        case 0xaa: XRA(cpu, cpu->d); break;
-        case 0xab: XRA(cpu, cpu->e); break;
-        case 0xac: XRA(cpu, cpu->h); break;
-        case 0xad: XRA(cpu, cpu->l); break;
-        case 0xae: XRA(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0xaf: XRA(cpu, cpu->a); break;
-        case 0xb0: ORA(cpu, cpu->b); break;
-        case 0xb1: ORA(cpu, cpu->c); break;
-        case 0xb2: ORA(cpu, cpu->d); break;
-        case 0xb3: ORA(cpu, cpu->e); break;
-        case 0xb4: ORA(cpu, cpu->h); break;
-        case 0xb5: ORA(cpu, cpu->l); break;
-        case 0xb6: ORA(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0xb7: ORA(cpu, cpu->a); break;
-        case 0xb8: CMP(cpu, cpu->b); break;
-        case 0xb9: CMP(cpu, cpu->c); break;
-        case 0xba: CMP(cpu, cpu->d); break;
-        case 0xbb: CMP(cpu, cpu->e); break;
-        case 0xbc: CMP(cpu, cpu->h); break;
-        case 0xbd: CMP(cpu, cpu->l); break;
-        case 0xbe: CMP(cpu, get_content_addr_in_reg(cpu, cpu->h, cpu->l)); break;
-        case 0xbf: CMP(cpu, cpu->a); break;
-                   // RNZ
-        case 0xc0: if (!cpu->zf) RET(cpu); break;
-        case 0xc1: pop(cpu, &cpu->b, &cpu->c); break;
-                   // JNZ
-        case 0xc2: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->zf) cpu->pc = word;
-            break;
-        }
-                   // JMP
-        case 0xc3: cpu->pc = cpu_read_word(cpu); break;
-                   // CNZ
-        case 0xc4: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->zf) CALL(cpu, word);
-            break;
-        }
-        case 0xc5: push(cpu, cpu->b, cpu->c); break;
-                   // ADI
-        case 0xc6: {
-            uint8_t prev = cpu->a;
-            uint8_t byte = cpu_read_byte(cpu);
-            cpu->a += byte;
-            SET_SZP(cpu, cpu->a);
-            cpu->af = ((prev & 0xF) + (byte & 0xF)) & 0x10;
-            cpu->cf = carry_add(prev, byte, 0);
-            break;
-        }
-                   // RST 0
-        case 0xc7: CALL(cpu, 0x00); break;
-                   // RZ
-        case 0xc8: if (cpu->zf) RET(cpu); break;
-        case 0xc9: RET(cpu); break;
-                   // JZ
-        case 0xca: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->zf) cpu->pc = word;
-            break;
-        }
-        case 0xcb: NOP(); break;
-                   // CZ
-        case 0xcc: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->zf) CALL(cpu, word);
-            break;
-        }
-        case 0xcd: CALL(cpu, cpu_read_word(cpu)); break;
-                   // ACI
-        case 0xce: {
-            uint8_t prev = cpu->a;
-            uint8_t byte = cpu_read_byte(cpu);
-            cpu->a = prev + byte + cpu->cf;
-            SET_SZP(cpu, cpu->a);
-            cpu->af = ((prev & 0xF) + (byte & 0xF) + cpu->cf) & 0x10;
-            cpu->cf = carry_add(prev, byte, cpu->cf);
-            break;
-        }
-                   // RST 1
-        case 0xcf: CALL(cpu, 0x08); break;
-                   // RNC
-        case 0xd0: if (!cpu->cf) RET(cpu); break;
-        case 0xd1: pop(cpu, &cpu->d, &cpu->e); break;
-                   // JNC
-        case 0xd2: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->cf) cpu->pc = word;
-            break;
-        }
-        case 0xd3: OUT(); break;
-                   // CNC
-        case 0xd4: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->cf) CALL(cpu, word);
-            break;
-        }
-        case 0xd5: push(cpu, cpu->d, cpu->e); break;
-                   // SUI
-        case 0xd6: {
-            uint8_t prev = cpu->a;
-            uint8_t byte = cpu_read_byte(cpu);
-            cpu->a -= byte;
-            SET_SZP(cpu, cpu->a);
-            cpu->af = ((prev & 0xF) + ((~byte & 0xF) + 1)) & 0x10;
-            cpu->cf = carry_sub(prev, byte, 0);
-            break;
-        }
-                   // RST 2
-        case 0xd7: CALL(cpu, 0x10); break;
-                   // RC
-        case 0xd8: if (cpu->cf) RET(cpu); break;
-        case 0xd9: NOP(); break;
-                   // JC
-        case 0xda: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->cf) cpu->pc = word;
-            break;
-        }
-        case 0xdb: IN(); break;
-                   // CC
-        case 0xdc: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->cf) CALL(cpu, word);
-            break;
-        }
-        case 0xdd: NOP(); break;
-                   // SBI
-        case 0xde: {
-            uint8_t prev = cpu->a;
-            uint8_t byte = cpu_read_byte(cpu);
-            cpu->a = prev - byte - cpu->cf;
-            SET_SZP(cpu, cpu->a);
-            cpu->af = ((prev & 0xF) + (~byte & 0xF) + !cpu->cf) & 0x10;
-            cpu->cf = carry_sub(prev, byte, cpu->cf);
-            break;
-        }
-                   // RST 3
-        case 0xdf: CALL(cpu, 0x18); break;
-                   // RPO
-        case 0xe0: if (!cpu->pf) RET(cpu); break;
-        case 0xe1: pop(cpu, &cpu->h, &cpu->l); break;
-                   // JPO
-        case 0xe2: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->pf) cpu->pc = word;
-            break;
-        }
-                   // XTHL
-        case 0xe3: {
-            uint8_t old_h = cpu->h;
-            uint8_t old_l = cpu->l;
-            cpu->l = cpu_get_content_addr(cpu, cpu->sp);
-            cpu->h = cpu_get_content_addr(cpu, cpu->sp + 1);
-            set_content_addr(cpu, cpu->sp, old_l);
-            set_content_addr(cpu, cpu->sp + 1, old_h);
-            break;
-        }
-                   // CPO
-        case 0xe4: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->pf) CALL(cpu, word);
-            break;
-        }
-        case 0xe5: push(cpu, cpu->h, cpu->l); break;
-                   // ANI
-        case 0xe6: {
-            uint8_t prev = cpu->a;
-            uint8_t byte = cpu_read_byte(cpu);
-            cpu->a &= byte;
-            SET_SZP(cpu, cpu->a);
-            cpu->af = ((prev | byte) & 0x08) != 0;
-            cpu->cf = 0;
-            break;
-        }
-                   // RST 4
-        case 0xe7: CALL(cpu, 0x20); break;
-                   // RPE
-        case 0xe8: if (cpu->pf) RET(cpu); break;
-                   // PCHL
-        case 0xe9: cpu->pc = get_reg_pair(cpu->h, cpu->l); break;
-                   // JPE
-        case 0xea: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->pf) cpu->pc = word;
-            break;
-        }
-                   // XCHG
-        case 0xeb: {
-            uint8_t d_temp = cpu->d;
-            uint8_t e_temp = cpu->e;
-            cpu->d = cpu->h;
-            cpu->e = cpu->l;
-            cpu->h = d_temp;
-            cpu->l = e_temp;
-            break;
-        }
-                   // CPE
-        case 0xec: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->pf) CALL(cpu, word);
-            break;
-        }
-        case 0xed: NOP(); break;
-                   // XRI
-        case 0xee: {
-            cpu->a ^= cpu_read_byte(cpu);
-            SET_SZP(cpu, cpu->a);
-            cpu->cf = 0;
-            cpu->af = 0;
-            break;
-        }
-                   // RST 5
-        case 0xef: CALL(cpu, 0x28); break;
-                   // RP
-        case 0xf0: if (!cpu->sf) RET(cpu); break;
-        case 0xf1: pop_psw(cpu); break;
-                   // JP
-        case 0xf2: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->sf) cpu->pc = word;
-            break;
-        }
-                   // DI
-        case 0xf3: cpu->interrupt = 0; break;
-                   // CP
-        case 0xf4: {
-            uint16_t word = cpu_read_word(cpu);
-            if (!cpu->sf) CALL(cpu, word);
-            break;
-        }
-        case 0xf5: push_psw(cpu); break;
-                   // ORI
-        case 0xf6: {
-            cpu->a |= cpu_read_byte(cpu);
-            SET_SZP(cpu, cpu->a);
-            cpu->cf = 0;
-            cpu->af = 0;
-            break;
-        }
-                   // RST 6
-        case 0xf7: CALL(cpu, 0x30); break;
-                   // RM
-        case 0xf8: if (cpu->sf) RET(cpu); break;
-                   // SPHL
-        case 0xf9: cpu->sp = get_reg_pair(cpu->h, cpu->l); break;
-                   // JM
-        case 0xfa: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->sf) cpu->pc = word;
-            break;
+uint64_t cpu_run_sampled(Cpu* cpu, uint64_t cycle_budget, Sampler* sampler) {
+    uint64_t start = cpu->cycles;
+    while (cpu->cycles - start < cycle_budget && !cpu->halted) {
+        uint16_t sp = cpu->sp;
+        uint8_t opcode = next_byte(cpu);
+        execute_opcode(cpu, opcode, UNLIKELY(cpu->bus != NULL));
+        sampler_step(sampler, cpu, opcode, sp);
+    }
+    return cpu->cycles - start;
+}
+
+#ifdef CPU_HAVE_THREADED
+#define OP_LABELS { \
+    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0a, &&op_0x0b, &&op_0x0c, &&op_0x0d, &&op_0x0e, &&op_0x0f, \
+    &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1a, &&op_0x1b, &&op_0x1c, &&op_0x1d, &&op_0x1e, &&op_0x1f, \
+    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2a, &&op_0x2b, &&op_0x2c, &&op_0x2d, &&op_0x2e, &&op_0x2f, \
+    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3a, &&op_0x3b, &&op_0x3c, &&op_0x3d, &&op_0x3e, &&op_0x3f, \
+    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4a, &&op_0x4b, &&op_0x4c, &&op_0x4d, &&op_0x4e, &&op_0x4f, \
+    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5a, &&op_0x5b, &&op_0x5c, &&op_0x5d, &&op_0x5e, &&op_0x5f, \
+    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6a, &&op_0x6b, &&op_0x6c, &&op_0x6d, &&op_0x6e, &&op_0x6f, \
+    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7a, &&op_0x7b, &&op_0x7c, &&op_0x7d, &&op_0x7e, &&op_0x7f, \
+    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8a, &&op_0x8b, &&op_0x8c, &&op_0x8d, &&op_0x8e, &&op_0x8f, \
+    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9a, &&op_0x9b, &&op_0x9c, &&op_0x9d, &&op_0x9e, &&op_0x9f, \
+    &&op_0xa0, &&op_0xa1, &&op_0xa2, &&op_0xa3, &&op_0xa4, &&op_0xa5, &&op_0xa6, &&op_0xa7, &&op_0xa8, &&op_0xa9, &&op_0xaa, &&op_0xab, &&op_0xac, &&op_0xad, &&op_0xae, &&op_0xaf, \
+    &&op_0xb0, &&op_0xb1, &&op_0xb2, &&op_0xb3, &&op_0xb4, &&op_0xb5, &&op_0xb6, &&op_0xb7, &&op_0xb8, &&op_0xb9, &&op_0xba, &&op_0xbb, &&op_0xbc, &&op_0xbd, &&op_0xbe, &&op_0xbf, \
+    &&op_0xc0, &&op_0xc1, &&op_0xc2, &&op_0xc3, &&op_0xc4, &&op_0xc5, &&op_0xc6, &&op_0xc7, &&op_0xc8, &&op_0xc9, &&op_0xca, &&op_0xcb, &&op_0xcc, &&op_0xcd, &&op_0xce, &&op_0xcf, \
+    &&op_0xd0, &&op_0xd1, &&op_0xd2, &&op_0xd3, &&op_0xd4, &&op_0xd5, &&op_0xd6, &&op_0xd7, &&op_0xd8, &&op_0xd9, &&op_0xda, &&op_0xdb, &&op_0xdc, &&op_0xdd, &&op_0xde, &&op_0xdf, \
+    &&op_0xe0, &&op_0xe1, &&op_0xe2, &&op_0xe3, &&op_0xe4, &&op_0xe5, &&op_0xe6, &&op_0xe7, &&op_0xe8, &&op_0xe9, &&op_0xea, &&op_0xeb, &&op_0xec, &&op_0xed, &&op_0xee, &&op_0xef, \
+    &&op_0xf0, &&op_0xf1, &&op_0xf2, &&op_0xf3, &&op_0xf4, &&op_0xf5, &&op_0xf6, &&op_0xf7, &&op_0xf8, &&op_0xf9, &&op_0xfa, &&op_0xfb, &&op_0xfc, &&op_0xfd, &&op_0xfe, &&op_0xff \
+}
+
+// Same instruction bodies as cpu_execute, but every handler ends with its own
+// indirect jump to the next one instead of returning to a shared switch. A cpu
+// with a bus runs through cpu_run_switch, so memory accesses need no bus check.
+uint64_t cpu_run_threaded(Cpu* cpu, uint64_t cycle_budget) {
+    static void* const dispatch_table[256] = OP_LABELS;
+    if (cpu->bus) return cpu_run_switch(cpu, cycle_budget);
+    uint64_t cycles = 0;
+    uint8_t opcode;
+
+#define DISPATCH() \
+    do { \
+        if (cycles >= cycle_budget) goto done; \
+        opcode = fetch_byte(cpu, false); \
+        cycles += cycles_table[opcode]; \
+        goto *dispatch_table[opcode]; \
+    } while (0)
+#define OP(n) op_##n:
+#define NEXT DISPATCH()
+#define HALT goto done
+#define TAKEN cycles += 6
+#define REFUND cycles -= cycles_table[opcode]
+#define IMM8 fetch_byte(cpu, false)
+#define IMM16 fetch_word(cpu, false)
+#define LOAD(addr) load(cpu, addr, false)
+#define STORE(addr, value) store(cpu, addr, value, false)
+
+    if (cpu->halted) goto done;
+    DISPATCH();
+#include "cpu_ops.inc"
+
+#undef DISPATCH
+#undef OP
+#undef NEXT
+#undef HALT
+#undef TAKEN
+#undef REFUND
+#undef IMM8
+#undef IMM16
+#undef LOAD
+#undef STORE
+done:
+    cpu->cycles += cycles;
+    return cycles;
+}
+
+// Opcode pairs with a superinstruction in cpu_fused.inc
+#define FUSED_PAIRS(X) \
+    X(0x05, 0xc2) X(0x0d, 0xc2) X(0x15, 0xc2) X(0x1d, 0xc2) X(0xb1, 0xc2) X(0xfe, 0xc2) X(0xfe, 0xca) \
+    X(0x78, 0xb1) X(0x7e, 0xfe) X(0x1a, 0xa8) X(0x0f, 0x4f) X(0x7e, 0x23) X(0x46, 0x23) X(0x4e, 0x23) \
+    X(0x56, 0x23) X(0x5e, 0x23) X(0x13, 0x23) X(0x23, 0x13) X(0x21, 0x7e) X(0x11, 0x19) X(0x01, 0xcd) \
+    X(0x11, 0xcd) X(0x21, 0xcd)
+
+// Index of the superinstruction for first followed by second, -1 if there is none
+static int fused_index(uint8_t first, uint8_t second) {
+#define PAIR(a, b) (a) << 8 | (b),
+    static const uint16_t pairs[] = { FUSED_PAIRS(PAIR) };
+#undef PAIR
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (pairs[i] == (first << 8 | second)) return (int)i;
+    }
+    return -1;
+}
+
+static Block* decode_block(Cpu* cpu, void* const* handlers, void* const* fused) {
+    BlockCache* cache = cpu->block_cache;
+    Block* block = block_cache_begin(cache, cpu->pc);
+    uint16_t pc = cpu->pc;
+    uint8_t page = pc >> 8;
+    while (block->num_ops < BLOCK_MAX_OPS) {
+        uint8_t opcode = cpu_get_content_addr(cpu, pc);
+        DecodedOp* op = &block->ops[block->num_ops++];
+        op->handler = handlers[opcode];
+        op->opcode = opcode;
+        op->cycles = cycles_table[opcode];
+        op->operand = cpu_get_content_addr(cpu, pc + 2) << 8 | cpu_get_content_addr(cpu, pc + 1);
+        op->next_pc = pc + length_table[opcode];
+        block->end += length_table[opcode];
+        pc = op->next_pc;
+        if (block_end_table[opcode] || pc >> 8 != page) break;
+    }
+    for (uint16_t i = 0; i + 1 < block->num_ops; i++) {
+        int index = fused_index(block->ops[i].opcode, block->ops[i + 1].opcode);
+        if (index >= 0) block->ops[i++].handler = fused[index];
+    }
+    // A compare loop runs on past the block, its bytes must invalidate it too
+    if (cpu->bus == NULL && idiom_match(cpu->memory, block->start, &block->idiom)) {
+        if (block->start + block->idiom.length > block->end) block->end = block->start + block->idiom.length;
+    }
+    block_cache_commit(cache, block);
+    return block;
+}
+
+// Runs predecoded basic blocks. Blocks are decoded once per entry address and
+// reused until a guest write lands in their instruction bytes. Copy, fill and
+// compare loops on flat memory run most of their rounds through idiom_run. With
+// a JIT attached, hot blocks run as native code whenever they fit in the budget.
+static uint64_t run_blocks(Cpu* cpu, uint64_t cycle_budget, uint64_t max_blocks) {
+    static void* const dispatch_table[256] = OP_LABELS;
+#define FUSED_LABEL(a, b) &&fused_##a##_##b,
+    static void* const fused_table[] = { FUSED_PAIRS(FUSED_LABEL) };
+#undef FUSED_LABEL
+    if (cpu->block_cache == NULL) cpu->block_cache = block_cache_create();
+    if (cpu->block_cache == NULL) return cpu_run_threaded(cpu, cycle_budget);
+    BlockCache* cache = cpu->block_cache;
+    uint64_t cycles = 0;
+    const DecodedOp* op;
+    const DecodedOp* end;
+
+#define EXECUTE() \
+    do { \
+        cpu->pc = op->next_pc; \
+        cycles += op->cycles; \
+        goto *op->handler; \
+    } while (0)
+#define OP(n) op_##n:
+#define NEXT \
+    do { \
+        if (++op != end && cycles < cycle_budget && !cache->invalidated) EXECUTE(); \
+        goto next_block; \
+    } while (0)
+#define HALT goto done
+#define TAKEN cycles += 6
+#define REFUND cycles -= op->cycles
+#define IMM8 ((uint8_t)op->operand)
+#define IMM16 (op->operand)
+#define LOAD(addr) read_memory(cpu, addr)
+#define STORE(addr, value) set_content_addr(cpu, addr, value)
+#define FUSED(a, b) fused_##a##_##b:
+#define SECOND \
+    do { \
+        if (cycles >= cycle_budget) goto next_block; \
+        ++op; \
+        cpu->pc = op->next_pc; \
+        cycles += op->cycles; \
+    } while (0)
+
+    if (cpu->halted) goto done;
+next_block:
+    if (cycles >= cycle_budget || max_blocks-- == 0) goto done;
+    {
+        // Blocks decoded under another bus mapping may hold the wrong bytes
+        if (cpu->bus && cpu->bus->generation != cache->mapping) {
+            block_cache_flush(cache);
+            cache->mapping = cpu->bus->generation;
         }
-                   // EI
-        case 0xfb: cpu->interrupt = 1; break;
-                   // CM
-        case 0xfc: {
-            uint16_t word = cpu_read_word(cpu);
-            if (cpu->sf) CALL(cpu, word);
-            break;
+        Block* block = block_cache_lookup(cache, cpu->pc);
+        if (block == NULL) block = decode_block(cpu, dispatch_table, fused_table);
+        if (block->idiom.kind != IDIOM_NONE && !cpu->bus) {
+            uint64_t idiom_cycles = idiom_run(cpu, &block->idiom, cycle_budget - cycles);
+            cycles += idiom_cycles;
+            cache->idiom_cycles += idiom_cycles;
         }
-        case 0xfd: NOP(); break;
-                   // CPI
-        case 0xfe: {
-            uint8_t byte = cpu_read_byte(cpu);
-            uint8_t result = cpu->a - byte;
-            SET_SZP(cpu, result);
-            cpu->cf = carry_sub(cpu->a, byte, 0);
-            cpu->af = ((cpu->a & 0xF) + ((~byte & 0xF) + 1)) & 0x10;
-            break;
+#ifdef CPU_HAVE_JIT
+        if (cpu->jit && !cpu->bus && !cpu->dirty) {
+            if (block->native == NULL && ++block->hits == JIT_HOT_THRESHOLD) jit_translate(cpu, block);
+            if (block->native && cycle_budget - cycles >= block->max_cycles) {
+                cycles += jit_call(cpu, block, cycle_budget - cycles);
+                goto next_block;
+            }
         }
-                   // RST 7
-        case 0xff: CALL(cpu, 0x38); break;
-        default: break;
+#endif
+        cache->invalidated = false;
+        op = block->ops;
+        end = op + block->num_ops;
     }
+    EXECUTE();
+#include "cpu_ops.inc"
+#include "cpu_fused.inc"
+
+#undef EXECUTE
+#undef FUSED
+#undef SECOND
+#undef OP
+#undef NEXT
+#undef HALT
+#undef TAKEN
+#undef REFUND
+#undef IMM8
+#undef IMM16
+#undef LOAD
+#undef STORE
+done:
+    cpu->cycles += cycles;
+    return cycles;
+}
+
+uint64_t cpu_run_cached(Cpu* cpu, uint64_t cycle_budget) {
+    return run_blocks(cpu, cycle_budget, UINT64_MAX);
+}
+
+uint64_t cpu_execute_block(Cpu* cpu, uint64_t cycle_budget) {
+    return run_blocks(cpu, cycle_budget, 1);
+}
+#undef OP_LABELS
+#endif
+
+uint64_t cpu_run(Cpu* cpu, uint64_t cycle_budget) {
+#if defined(CPU_DISPATCH_CACHED) && defined(CPU_HAVE_THREADED)
+    return cpu_run_cached(cpu, cycle_budget);
+#elif defined(CPU_DISPATCH_THREADED) && defined(CPU_HAVE_THREADED)
+    return cpu_run_threaded(cpu, cycle_budget);
+#else
+    return cpu_run_switch(cpu, cycle_budget);
+#endif
 }
 
 void cpu_init(Cpu* cpu, unsigned char* rom) {
     cpu->a = 0;
-    cpu->b = 0;
-    cpu->c = 0;
-    cpu->d = 0;
-    cpu->e = 0;
-    cpu->h = 0;
-    cpu->l = 0;
+    cpu->f = FLAG_FIXED;
+    cpu->bc = 0;
+    cpu->de = 0;
+    cpu->hl = 0;
     cpu->sp = 0;
     cpu->pc = 0x100;
     cpu->memory = rom;
 
-    cpu->zf = 0;
-    cpu->sf = 0;
-    cpu->pf = 0;
-    cpu->cf = 0;
-    cpu->af = 0;
+#ifdef CPU_LAZY_FLAGS
+    cpu->lazy_op = LAZY_NONE;
+#endif
 
     cpu->interrupt = 0;
+    cpu->ei_cycles = 0;
+    cpu->halted = 0;
+    cpu->cycles = 0;
+    cpu->block_cache = NULL;
+    cpu->jit = NULL;
+    cpu->bus = NULL;
+    cpu->ports = NULL;
+    cpu->dirty = NULL;
+    cpu->hooks = NULL;
+}
+
+void cpu_free(Cpu* cpu) {
+    if (cpu->block_cache) block_cache_destroy(cpu->block_cache);
+    cpu->block_cache = NULL;
+#ifdef CPU_HAVE_JIT
+    if (cpu->jit) jit_destroy(cpu->jit);
+    cpu->jit = NULL;
+#endif
 }
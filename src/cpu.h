@@ -4,27 +4,105 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Computed-goto dispatch needs the GNU labels-as-values extension
+#ifdef __GNUC__
+#define CPU_HAVE_THREADED
+#endif
+
+// The JIT backend emits x86-64 code into an mmap'd arena
+#if defined(CPU_HAVE_THREADED) && defined(__x86_64__) && defined(__unix__)
+#define CPU_HAVE_JIT
+#endif
+
+struct BlockCache;
+struct Jit;
+struct Bus;
+struct Ports;
+struct Hooks;
+struct Profile;
+struct Sampler;
+
+#ifdef CPU_LAZY_FLAGS
+// Flag-setting operation recorded by the lazy flags core
+enum { LAZY_NONE, LAZY_ADD, LAZY_SUB, LAZY_LOGIC, LAZY_INR, LAZY_DCR };
+#endif
+
+// A register pair is a host-endian word overlaid on its two 8-bit halves
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CPU_PAIR(pair, hi, lo) union { uint16_t pair; struct { uint8_t hi, lo; }; }
+#else
+#define CPU_PAIR(pair, hi, lo) union { uint16_t pair; struct { uint8_t lo, hi; }; }
+#endif
+
+// Everything the instruction bodies touch is packed into the first 32 bytes, so
+// it shares a cache line whenever the Cpu is at least 32-byte aligned
 typedef struct {
-    uint8_t a;
-    uint8_t b;
-    uint8_t c;
-    uint8_t d;
-    uint8_t e;
-    uint8_t h;
-    uint8_t l;
+    CPU_PAIR(psw, a, f); // f holds the flags in PUSH PSW layout, see flags.h
+    CPU_PAIR(bc, b, c);
+    CPU_PAIR(de, d, e);
+    CPU_PAIR(hl, h, l);
     uint16_t sp;
     uint16_t pc;
     uint8_t* memory;
+    uint64_t cycles; // T-states executed since cpu_init
+#ifdef CPU_LAZY_FLAGS
+    // f is stale while lazy_op is set. S, Z and P follow from lazy_res.
+    // ADD/SUB keep operands and carry in in x, y and cy, LOGIC keeps AC in x and
+    // INR/DCR the untouched carry in cy.
+    uint8_t lazy_op;
+    uint8_t lazy_x, lazy_y, lazy_cy, lazy_res;
+#endif
 
-    bool sf : 1, zf : 1, af : 1, pf : 1, cf : 1;
+    bool interrupt;     // INTE, set by EI and cleared by DI and by accepting an interrupt
+    uint64_t ei_cycles; // cycles when the last EI finished, interrupts wait for one more instruction
+    bool halted;        // set by HLT, which keeps pc on itself, cleared by accepting an interrupt
 
-    bool interrupt;
+    struct BlockCache* block_cache; // created by cpu_run_cached, NULL otherwise
+    struct Jit* jit;                // set by jit_attach, NULL otherwise
+    struct Bus* bus;                // owned by the caller, memory is flat RAM when NULL
+    struct Ports* ports;            // owned by the caller, IN reads 0xFF and OUT is dropped when NULL
+    uint8_t* dirty;                 // set by snapshot_track, writes mark their 256-byte page
+    struct Hooks* hooks;            // set by hooks_init, 0xED is a plain NOP when NULL
 } Cpu;
 
+#undef CPU_PAIR
+
 void cpu_init(Cpu*, unsigned char*);
+void cpu_free(Cpu*);
 uint8_t cpu_get_content_addr(Cpu* cpu, uint16_t addr);
+// Stores like a guest write, through the bus, block cache and dirty page tracking
+void cpu_set_content_addr(Cpu* cpu, uint16_t addr, uint8_t content);
 uint8_t cpu_read_byte(Cpu*);
 uint8_t cpu_read_next_byte(Cpu*);
 uint16_t cpu_read_word(Cpu*);
-void cpu_execute(Cpu*);
+// Executes one instruction and returns its T-states. A halted cpu runs HLT again.
+uint8_t cpu_execute(Cpu*);
+// Accepts a RST n interrupt, unless INTE is clear or the instruction after an
+// EI has not run yet. Returns whether it was accepted. Wakes a halted cpu.
+bool cpu_interrupt(Cpu* cpu, uint8_t n);
+// Base T-states and length in bytes of an opcode. Taken conditional CALL/RET cost 6 more.
+uint8_t cpu_opcode_cycles(uint8_t opcode);
+uint8_t cpu_opcode_length(uint8_t opcode);
+// True for opcodes that end a basic block: jumps, calls, returns, RST, HLT and the hook trap
+bool cpu_opcode_ends_block(uint8_t opcode);
+// Brings f up to date. Call before reading it from outside the core, it may lag
+// behind when built with CPU_LAZY_FLAGS.
+void cpu_sync_flags(Cpu* cpu);
+// Executes until at least cycle_budget T-states have elapsed or the cpu halts,
+// returns the T-states consumed
+uint64_t cpu_run(Cpu* cpu, uint64_t cycle_budget);
+// cpu_run() uses the loop selected by CPU_DISPATCH_THREADED or CPU_DISPATCH_CACHED, all stay callable
+uint64_t cpu_run_switch(Cpu* cpu, uint64_t cycle_budget);
+// The switch loop counting every instruction into profile
+uint64_t cpu_run_profiled(Cpu* cpu, uint64_t cycle_budget, struct Profile* profile);
+// The switch loop shadowing calls and returns for sampler and taking its samples
+uint64_t cpu_run_sampled(Cpu* cpu, uint64_t cycle_budget, struct Sampler* sampler);
+#ifdef CPU_HAVE_THREADED
+uint64_t cpu_run_threaded(Cpu* cpu, uint64_t cycle_budget);
+uint64_t cpu_run_cached(Cpu* cpu, uint64_t cycle_budget);
+// Runs the basic block at pc through the block cache and returns its T-states.
+// Translated blocks also run the translated blocks they chain into while
+// they fit in cycle_budget.
+uint64_t cpu_execute_block(Cpu* cpu, uint64_t cycle_budget);
+#endif
 #endif
@@ -1,12 +1,17 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "cpu.h"
 
+// Longest text disassemble_opcode() writes, with the terminating NUL
+#define DISASSEMBLY_SIZE 48
+
+// Writes the mnemonic and operands of opcode to out and returns the instruction length
+uint16_t disassemble_opcode(char* out, size_t size, uint8_t opcode, uint8_t loworder, uint8_t highorder);
 uint16_t disassemble(Cpu* cpu);
 void register_state(Cpu* cpu);
 void print_memory(Cpu* cpu, uint16_t memory_size);
-void sys_call(Cpu* cpu);
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <stdint.h>
+
+// Flag bits in their PUSH PSW positions. Bit 1 always reads as 1.
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_A 0x10
+#define FLAG_P 0x04
+#define FLAG_C 0x01
+#define FLAG_FIXED 0x02
+
+// Lookup tables generated at build time by tools/gen_flags.c
+
+// S, Z and P of a result
+extern const uint8_t szp_table[256];
+// All five flags of a + b + cy and a - b - cy, indexed [cy][a][b]
+extern const uint8_t add_flags_table[2][256][256];
+extern const uint8_t sub_flags_table[2][256][256];
+// DAA result in the high byte and flags in the low byte, indexed [cf << 1 | af][a]
+extern const uint16_t daa_table[4][256];
+
+#endif
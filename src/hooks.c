@@ -0,0 +1,48 @@
+#include "hooks.h"
+#include <string.h>
+
+static bool is_hooked(const Hooks* hooks, uint16_t addr) {
+    return hooks->bitmap[addr >> 3] >> (addr & 7) & 1;
+}
+
+void hooks_init(Hooks* hooks, Cpu* cpu) {
+    memset(hooks, 0, sizeof(*hooks));
+    cpu->hooks = hooks;
+}
+
+void hooks_free(Hooks* hooks, Cpu* cpu) {
+    for (size_t i = 0; i < hooks->count; i++) {
+        Hook* hook = &hooks->hooks[i];
+        if (cpu_get_content_addr(cpu, hook->addr) == HOOK_OPCODE) cpu_set_content_addr(cpu, hook->addr, hook->replaced);
+    }
+    memset(hooks->bitmap, 0, sizeof(hooks->bitmap));
+    hooks->count = 0;
+    if (cpu->hooks == hooks) cpu->hooks = NULL;
+}
+
+bool hooks_add(Hooks* hooks, Cpu* cpu, uint16_t addr, HookFn fn, void* ctx) {
+    if (hooks->count == HOOKS_MAX || is_hooked(hooks, addr)) return false;
+    hooks->hooks[hooks->count++] = (Hook){ addr, cpu_get_content_addr(cpu, addr), fn, ctx };
+    hooks->bitmap[addr >> 3] |= 1 << (addr & 7);
+    cpu_set_content_addr(cpu, addr, HOOK_OPCODE);
+    return true;
+}
+
+bool hooks_trap(Cpu* cpu, uint64_t pending) {
+    Hooks* hooks = cpu->hooks;
+    uint16_t addr = cpu->pc - 1;
+    if (!is_hooked(hooks, addr)) return false;
+    for (size_t i = 0; i < hooks->count; i++) {
+        Hook* hook = &hooks->hooks[i];
+        if (hook->addr != addr) continue;
+        cpu->cycles += pending;
+        HookResult result = hook->fn(cpu, hook->ctx, addr);
+        cpu->cycles -= pending;
+        if (result == HOOK_CONTINUE) return false;
+        cpu->pc = addr;
+        cpu->halted = true;
+        hooks->stopped = true;
+        return true;
+    }
+    return false;
+}
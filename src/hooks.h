@@ -0,0 +1,55 @@
+#ifndef HOOKS_H
+#define HOOKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+// Undocumented NOP alias patched over every hooked address
+#define HOOK_OPCODE 0xED
+#define HOOKS_MAX 32
+
+typedef enum {
+    HOOK_CONTINUE, // go on at cpu->pc, which the hook may have changed
+    HOOK_STOP      // halt the cpu on the hooked address
+} HookResult;
+
+// Runs in place of the instruction at addr, with cpu->pc on the byte after it,
+// cpu->cycles counting the trap and flags possibly stale, see cpu_sync_flags
+typedef HookResult (*HookFn)(Cpu* cpu, void* ctx, uint16_t addr);
+
+typedef struct {
+    uint16_t addr;
+    uint8_t replaced; // byte the trap opcode went over
+    HookFn fn;
+    void* ctx;
+} Hook;
+
+// High-level emulation traps. Each hooked address holds HOOK_OPCODE, which
+// every run loop and the JIT treat as a NOP that ends its block. Only when one
+// executes is its address looked up in the bitmap, so the loops do no per
+// instruction work for hooks. A guest reading a hooked address sees the trap
+// opcode. A guest store over it disables the trap until HOOK_OPCODE is stored
+// there again, and hooks_free then leaves the stored byte in place.
+typedef struct Hooks {
+    uint8_t bitmap[0x10000 / 8];
+    Hook hooks[HOOKS_MAX];
+    size_t count;
+    bool stopped; // a hook returned HOOK_STOP
+} Hooks;
+
+void hooks_init(Hooks* hooks, Cpu* cpu);
+// Removes every hook, putting back the bytes they replaced where the trap
+// opcode is still in place
+void hooks_free(Hooks* hooks, Cpu* cpu);
+// Patches the trap opcode over addr, returns false once HOOKS_MAX are set or
+// if addr is already hooked
+bool hooks_add(Hooks* hooks, Cpu* cpu, uint16_t addr, HookFn fn, void* ctx);
+
+// Runs the hook of the trap opcode just fetched, with cpu->pc past it and
+// pending T-states the run loop has not added to cpu->cycles yet. Returns true
+// if it stopped the cpu, which is then halted with pc back on the trap.
+bool hooks_trap(Cpu* cpu, uint64_t pending);
+
+#endif
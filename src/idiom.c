@@ -0,0 +1,127 @@
+#include "idiom.h"
+#include <string.h>
+#include "block_cache.h"
+
+#define MAX_IDIOM_BYTES 16
+
+// INX H / INX D in either order
+static bool is_inx_pair(const uint8_t* code) {
+    return (code[0] == 0x23 && code[1] == 0x13) || (code[0] == 0x13 && code[1] == 0x23);
+}
+
+// DCX B / MOV A,B / ORA C (or MOV A,C / ORA B), DCR B or DCR C. Returns its length, 0 if none.
+static unsigned match_count(const uint8_t* code, Idiom* idiom) {
+    if (code[0] == 0x0B && ((code[1] == 0x78 && code[2] == 0xB1) || (code[1] == 0x79 && code[2] == 0xB0))) {
+        idiom->count = IDIOM_COUNT_BC;
+        return 3;
+    }
+    if (code[0] == 0x05 || code[0] == 0x0D) {
+        idiom->count = code[0] == 0x05 ? IDIOM_COUNT_B : IDIOM_COUNT_C;
+        return 1;
+    }
+    return 0;
+}
+
+bool idiom_match(const uint8_t* memory, uint16_t pc, Idiom* idiom) {
+    uint8_t code[MAX_IDIOM_BYTES];
+    for (int i = 0; i < MAX_IDIOM_BYTES; i++) code[i] = memory[(uint16_t)(pc + i)];
+    *idiom = (Idiom){ 0 };
+
+    unsigned body;
+    if (((code[0] == 0x7E && code[1] == 0x12) || (code[0] == 0x1A && code[1] == 0x77)) && is_inx_pair(code + 2)) {
+        idiom->kind = IDIOM_COPY;
+        idiom->to_hl = code[0] == 0x1A;
+        body = 4;
+    }
+    else if (code[0] == 0x1A && code[1] == 0xBE && code[2] == 0xC2 && is_inx_pair(code + 5)) {
+        idiom->kind = IDIOM_COMPARE;
+        body = 7;
+    }
+    else if (code[0] == 0x36 && code[2] == 0x23) {
+        idiom->kind = IDIOM_FILL;
+        idiom->fill = IDIOM_FILL_IMM;
+        idiom->value = code[1];
+        body = 3;
+    }
+    else if ((code[0] == 0x77 || code[0] == 0x72 || code[0] == 0x73) && code[1] == 0x23) {
+        idiom->kind = IDIOM_FILL;
+        idiom->fill = code[0] == 0x77 ? IDIOM_FILL_A : code[0] == 0x72 ? IDIOM_FILL_D : IDIOM_FILL_E;
+        body = 2;
+    }
+    else {
+        return false;
+    }
+
+    unsigned count = match_count(code + body, idiom);
+    unsigned jump = body + count;
+    // MOV A,B would overwrite the byte a MOV M,A fill stores
+    bool clobbered = idiom->kind == IDIOM_FILL && idiom->fill == IDIOM_FILL_A && idiom->count == IDIOM_COUNT_BC;
+    if (count == 0 || clobbered || code[jump] != 0xC2 || (code[jump + 2] << 8 | code[jump + 1]) != pc) {
+        idiom->kind = IDIOM_NONE;
+        return false;
+    }
+    idiom->length = jump + 3;
+    idiom->cycles = 0;
+    for (unsigned i = 0; i < idiom->length; i += cpu_opcode_length(code[i])) idiom->cycles += cpu_opcode_cycles(code[i]);
+    return true;
+}
+
+static uint8_t* counter(Cpu* cpu, const Idiom* idiom) {
+    return idiom->count == IDIOM_COUNT_B ? &cpu->b : &cpu->c;
+}
+
+uint64_t idiom_run(Cpu* cpu, const Idiom* idiom, uint64_t cycles_left) {
+    uint32_t left;
+    if (idiom->count == IDIOM_COUNT_BC) left = cpu->bc ? cpu->bc : 0x10000;
+    else left = *counter(cpu, idiom) ? *counter(cpu, idiom) : 0x100;
+    // One whole round must still fit after the rounds run here
+    uint64_t fit = (cycles_left - 1) / idiom->cycles;
+    uint32_t rounds = left - 1;
+    if (rounds + 1 > fit) rounds = fit ? fit - 1 : 0;
+
+    // Pointers wrapping past 0xFFFF are left to the interpreter
+    uint32_t hl = cpu->hl;
+    uint32_t de = cpu->de;
+    if (rounds > 0x10000 - hl) rounds = 0x10000 - hl;
+    if (idiom->kind != IDIOM_FILL && rounds > 0x10000 - de) rounds = 0x10000 - de;
+
+    uint8_t* memory = cpu->memory;
+    if (idiom->kind == IDIOM_COMPARE) {
+        if (memcmp(memory + de, memory + hl, rounds) != 0) {
+            uint32_t equal = 0;
+            while (memory[de + equal] == memory[hl + equal]) equal++;
+            rounds = equal;
+        }
+    }
+    else {
+        uint32_t dst = idiom->kind == IDIOM_COPY && !idiom->to_hl ? de : hl;
+        // Stop short of the loop's own code
+        uint32_t pc = cpu->pc;
+        if (dst < pc + idiom->length && pc < dst + rounds) rounds = dst <= pc ? pc - dst : 0;
+        if (idiom->kind == IDIOM_FILL) {
+            uint8_t value = idiom->fill == IDIOM_FILL_IMM ? idiom->value :
+                idiom->fill == IDIOM_FILL_A ? cpu->a : idiom->fill == IDIOM_FILL_D ? cpu->d : cpu->e;
+            memset(memory + dst, value, rounds);
+        }
+        else {
+            uint32_t src = idiom->to_hl ? de : hl;
+            // A forward byte copy onto the bytes just ahead repeats the pattern, which memmove would not
+            if (dst > src && dst - src < rounds) {
+                for (uint32_t i = 0; i < rounds; i++) memory[dst + i] = memory[src + i];
+            }
+            else {
+                memmove(memory + dst, memory + src, rounds);
+            }
+        }
+        if (cpu->block_cache) {
+            for (uint32_t i = 0; i < rounds; i++) block_cache_write(cpu->block_cache, dst + i);
+        }
+        if (cpu->dirty && rounds) memset(cpu->dirty + (dst >> 8), 1, ((dst + rounds - 1) >> 8) - (dst >> 8) + 1);
+    }
+
+    cpu->hl += rounds;
+    if (idiom->kind != IDIOM_FILL) cpu->de += rounds;
+    if (idiom->count == IDIOM_COUNT_BC) cpu->bc -= rounds;
+    else *counter(cpu, idiom) -= rounds;
+    return (uint64_t)rounds * idiom->cycles;
+}
@@ -0,0 +1,40 @@
+#ifndef IDIOM_H
+#define IDIOM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+enum { IDIOM_NONE, IDIOM_COPY, IDIOM_FILL, IDIOM_COMPARE };
+
+// Counter of a recognized loop: DCX B / MOV A,B / ORA C, or DCR B or DCR C
+enum { IDIOM_COUNT_BC, IDIOM_COUNT_B, IDIOM_COUNT_C };
+
+// Fill source, an immediate from MVI M or the register stored by MOV M,r
+enum { IDIOM_FILL_IMM, IDIOM_FILL_A, IDIOM_FILL_D, IDIOM_FILL_E };
+
+// A block memory loop recognized at the start of a basic block:
+//   copy     MOV A,M / STAX D or LDAX D / MOV M,A, INX H, INX D, count, JNZ loop
+//   fill     MOV M,r or MVI M,n, INX H, count, JNZ loop
+//   compare  LDAX D / CMP M / JNZ out, INX H, INX D, count, JNZ loop
+// where count is DCX B / MOV A,B / ORA C or DCR B or DCR C. Every round
+// overwrites A and the flags it uses before it can leave the loop.
+typedef struct {
+    uint8_t kind;
+    uint8_t count;
+    uint8_t fill;
+    uint8_t value;   // immediate of MVI M
+    bool to_hl;      // copy from (DE) to (HL) instead of (HL) to (DE)
+    uint8_t cycles;  // T-states of a round that goes round again
+    uint8_t length;  // bytes of loop code
+} Idiom;
+
+// Recognizes a loop starting at pc in flat memory
+bool idiom_match(const uint8_t* memory, uint16_t pc, Idiom* idiom);
+// Runs rounds of the loop at cpu->pc with memmove, memset or memcmp. The last
+// round, the round that leaves a compare loop and at least one whole round
+// ending before cycles_left are left to the interpreter, so A and the flags
+// come from real instructions. Returns the T-states of the rounds run.
+uint64_t idiom_run(Cpu* cpu, const Idiom* idiom, uint64_t cycles_left);
+
+#endif
@@ -0,0 +1,207 @@
+#include "input_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+#include "snapshot.h"
+
+static const uint8_t magic[7] = { '8', '0', '8', '0', 'L', 'O', 'G' };
+// Kind, a varint of up to 10 bytes and two data bytes, or eight for the end
+#define MAX_RECORD 19
+
+static void flush(InputLog* log) {
+    if (log->len && fwrite(log->data, log->len, 1, log->fp) != 1) log->write_error = true;
+    log->len = 0;
+}
+
+bool input_log_record(InputLog* log, FILE* fp) {
+    memset(log, 0, sizeof(*log));
+    log->fp = fp;
+    log->data = malloc(INPUT_LOG_BUFFER);
+    if (log->data == NULL) return false;
+    memcpy(log->data, magic, sizeof(magic));
+    log->data[sizeof(magic)] = INPUT_LOG_VERSION;
+    log->len = sizeof(magic) + 1;
+    return true;
+}
+
+bool input_log_replay(InputLog* log, FILE* fp) {
+    memset(log, 0, sizeof(*log));
+    log->fp = fp;
+    log->replaying = true;
+    size_t cap = INPUT_LOG_BUFFER;
+    log->data = malloc(cap);
+    while (log->data) {
+        log->len += fread(log->data + log->len, 1, cap - log->len, fp);
+        if (log->len < cap) break;
+        cap *= 2;
+        uint8_t* data = realloc(log->data, cap);
+        if (data == NULL) free(log->data);
+        log->data = data;
+    }
+    if (log->data == NULL || log->len <= sizeof(magic) || memcmp(log->data, magic, sizeof(magic)) != 0 ||
+        log->data[sizeof(magic)] != INPUT_LOG_VERSION) {
+        return false;
+    }
+    for (int kind = 0; kind <= INPUT_END; kind++) log->cursor[kind].pos = sizeof(magic) + 1;
+    return true;
+}
+
+void input_log_free(InputLog* log) {
+    free(log->data);
+    log->data = NULL;
+}
+
+static size_t put_varint(uint8_t* p, uint64_t value) {
+    size_t n = 0;
+    for (; value >= 0x80; value >>= 7) p[n++] = (uint8_t)value | 0x80;
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t get_varint(const uint8_t* p, size_t len, uint64_t* value) {
+    *value = 0;
+    for (size_t n = 0; n < len && n < 10; n++) {
+        *value |= (uint64_t)(p[n] & 0x7F) << (7 * n);
+        if (!(p[n] & 0x80)) return n + 1;
+    }
+    return 0;
+}
+
+static uint8_t* append(InputLog* log, uint8_t kind, uint64_t time) {
+    if (log->len + MAX_RECORD > INPUT_LOG_BUFFER) flush(log);
+    uint8_t* p = log->data + log->len;
+    p[0] = kind;
+    // Differences wrap, so a time before the previous one still comes back exactly
+    size_t n = 1 + put_varint(p + 1, time - log->time);
+    log->time = time;
+    log->len += n;
+    log->records++;
+    return p + n;
+}
+
+void input_log_append(InputLog* log, uint8_t kind, uint64_t time, uint8_t x, uint8_t y) {
+    uint8_t* p = append(log, kind, time);
+    p[0] = x;
+    p[1] = y;
+    log->len += 2;
+}
+
+// Decodes the record at pos, returns its length or 0 past the end
+static size_t record_at(const InputLog* log, size_t pos, uint8_t* kind, uint64_t* delta) {
+    if (pos >= log->len) return 0;
+    *kind = log->data[pos];
+    size_t n = get_varint(log->data + pos + 1, log->len - pos - 1, delta);
+    size_t size = 1 + n + (*kind == INPUT_END ? 8 : 2);
+    return n && *kind <= INPUT_END && pos + size <= log->len ? size : 0;
+}
+
+static bool next_record(InputLog* log, uint8_t kind, uint64_t* time, uint8_t* x, uint8_t* y) {
+    size_t pos = log->cursor[kind].pos;
+    uint64_t at = log->cursor[kind].time;
+    for (;;) {
+        uint8_t found;
+        uint64_t delta;
+        size_t size = record_at(log, pos, &found, &delta);
+        if (size == 0) return false;
+        at += delta;
+        pos += size;
+        if (found == kind) {
+            const uint8_t* data = log->data + pos - 2;
+            *time = at;
+            if (x) *x = data[0];
+            if (y) *y = data[1];
+            break;
+        }
+    }
+    log->cursor[kind].pos = pos;
+    log->cursor[kind].time = at;
+    log->records++;
+    return true;
+}
+
+bool input_log_next(InputLog* log, uint8_t kind, uint64_t* time, uint8_t* x, uint8_t* y) {
+    if (next_record(log, kind, time, x, y)) return true;
+    log->diverged = true;
+    return false;
+}
+
+bool input_log_close(InputLog* log, Cpu* cpu) {
+    uint64_t hash = snapshot_hash(cpu);
+    if (!log->replaying) {
+        uint8_t* p = append(log, INPUT_END, cpu->cycles);
+        for (int i = 0; i < 8; i++) p[i] = hash >> (8 * i);
+        log->len += 8;
+        flush(log);
+        return !log->write_error && fflush(log->fp) == 0;
+    }
+    // The end record has eight bytes of hash, input_log_next points at the last two
+    uint64_t time;
+    if (!input_log_next(log, INPUT_END, &time, NULL, NULL)) return false;
+    const uint8_t* p = log->data + log->cursor[INPUT_END].pos - 8;
+    uint64_t recorded = 0;
+    for (int i = 7; i >= 0; i--) recorded = recorded << 8 | p[i];
+    // Every IN and console record must have been used up
+    for (int kind = 0; kind < INPUT_END; kind++) {
+        uint8_t found;
+        uint64_t delta;
+        for (size_t pos = log->cursor[kind].pos, size; (size = record_at(log, pos, &found, &delta)); pos += size) {
+            if (found == kind) log->diverged = true;
+        }
+    }
+    return !log->diverged && time == cpu->cycles && recorded == hash;
+}
+
+static uint8_t logged_read(void* ctx, uint8_t port) {
+    InputLog* log = ctx;
+    uint64_t time = log->cpu->cycles;
+    if (log->replaying) {
+        uint8_t logged_port, value;
+        if (!input_log_next(log, INPUT_IN, &time, &logged_port, &value)) return 0xFF;
+        if (logged_port != port) log->diverged = true;
+        return value;
+    }
+    const PortDevice* device = &log->devices[port];
+    uint8_t value = device->read(device->ctx, port);
+    input_log_append(log, INPUT_IN, time, port, value);
+    return value;
+}
+
+// The device's write handler takes the context the logging read replaced
+static void forward_write(void* ctx, uint8_t port, uint8_t value) {
+    InputLog* log = ctx;
+    const PortDevice* device = &log->devices[port];
+    device->write(device->ctx, port, value);
+}
+
+void input_log_attach_ports(InputLog* log, Cpu* cpu) {
+    log->cpu = cpu;
+    if (cpu->ports == NULL) return;
+    for (int port = 0; port < 256; port++) {
+        PortDevice* device = &cpu->ports->device[port];
+        if (device->read == NULL) continue;
+        log->devices[port] = *device;
+        device->read = logged_read;
+        if (device->write) device->write = forward_write;
+        device->ctx = log;
+    }
+}
+
+static void post_next_interrupt(InputLog* log, Scheduler* sched) {
+    uint64_t time;
+    if (next_record(log, INPUT_INTERRUPT, &time, &log->irq, NULL)) sched_post_interrupt(sched, time, log->irq);
+}
+
+void input_log_attach_sched(InputLog* log, Scheduler* sched) {
+    sched->log = log;
+    sched->skip_polls = false;
+    if (log->replaying) post_next_interrupt(log, sched);
+}
+
+void input_log_interrupt(InputLog* log, Scheduler* sched, uint64_t time, uint8_t n) {
+    if (!log->replaying) {
+        input_log_append(log, INPUT_INTERRUPT, time, n, 0);
+        return;
+    }
+    if (time != log->cursor[INPUT_INTERRUPT].time || n != log->irq) log->diverged = true;
+    post_next_interrupt(log, sched);
+}
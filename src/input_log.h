@@ -0,0 +1,70 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "ports.h"
+
+#define INPUT_LOG_VERSION 1
+#define INPUT_LOG_BUFFER 65536
+
+enum { INPUT_IN, INPUT_INTERRUPT, INPUT_CONSOLE, INPUT_END };
+
+struct Scheduler;
+
+// Every input that can differ between two runs of the same program: IN values
+// from port devices, the times interrupts were accepted and BDOS console input.
+// Recording appends records to a buffer that is written out when it fills.
+// Each record is a kind, the T-states since the previous record as a varint
+// and one or two bytes, so most records take four bytes. The log ends with
+// the final hash of the machine state.
+// A replay reads the whole log back, hands out IN values and console input
+// in order and requests interrupts at the recorded times.
+typedef struct InputLog {
+    FILE* fp;
+    bool replaying;
+    uint8_t* data; // recording: unwritten records, replay: the whole log
+    size_t len;
+    uint64_t time; // recording: time of the last record
+    bool write_error;
+    struct {
+        size_t pos;
+        uint64_t time;
+    } cursor[INPUT_END + 1]; // replay: where to look for the next record of each kind
+    bool diverged; // replay: the run asked for an input the log does not have next
+    uint8_t irq;   // replay: the interrupt requested last
+
+    Cpu* cpu;
+    PortDevice devices[256]; // the devices the logging reads stand in for
+    uint64_t records;
+} InputLog;
+
+// Starts a log written to fp, returns false if out of memory
+bool input_log_record(InputLog* log, FILE* fp);
+// Reads a log from fp, returns false if it is not a log of this version
+bool input_log_replay(InputLog* log, FILE* fp);
+// Recording: appends the end record with the state hash and flushes.
+// Replay: returns whether the run took every input and ended in the recorded
+// state.
+bool input_log_close(InputLog* log, Cpu* cpu);
+void input_log_free(InputLog* log);
+
+// Routes IN from the devices of cpu->ports with a read handler through the
+// log. A replay needs the same devices attached, their reads are not called.
+void input_log_attach_ports(InputLog* log, Cpu* cpu);
+// Logs the interrupts sched_run delivers. A replay requests them at the
+// recorded times, the devices that raised them must not post events. Both
+// turn off poll skipping, which runs differently with different events.
+void input_log_attach_sched(InputLog* log, struct Scheduler* sched);
+// Called by sched_run with the time an interrupt was accepted
+void input_log_interrupt(InputLog* log, struct Scheduler* sched, uint64_t time, uint8_t n);
+
+void input_log_append(InputLog* log, uint8_t kind, uint64_t time, uint8_t x, uint8_t y);
+// Replay: takes the next record of kind. Returns false and marks the replay
+// diverged if there is none.
+bool input_log_next(InputLog* log, uint8_t kind, uint64_t* time, uint8_t* x, uint8_t* y);
+
+#endif
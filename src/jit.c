@@ -0,0 +1,767 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+
+#ifdef CPU_HAVE_JIT
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Translated code is entered through enter(state, memory, code_map, block code).
+// Inside it the guest lives in host registers:
+//   r8b A, r9b B, r10b C, r11b D, r12b E, r13b H, r14b L, r15d SP, ebp F
+//   rdi JitState*, rsi guest memory, rdx block cache code map
+//   rax, rbx, rcx scratch
+// Every guest register is kept zero-extended in its 32-bit host register.
+// Blocks leave with the next pc in ecx and their T-states in eax through the
+// shared dispatch routine, which either jumps straight into the next translated
+// block or stores the guest state and returns.
+typedef void (*JitEnter)(JitState* state, uint8_t* memory, const uint8_t* code_map, void* code);
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define HOST_A R8
+#define HOST_B R9
+#define HOST_C R10
+#define HOST_D R11
+#define HOST_E R12
+#define HOST_H R13
+#define HOST_L R14
+#define HOST_SP R15
+#define HOST_F RBP
+#define REG_M 6
+
+// Host register of each 8080 register operand, in opcode order B C D E H L M A
+static const int host_reg[8] = { HOST_B, HOST_C, HOST_D, HOST_E, HOST_H, HOST_L, -1, HOST_A };
+
+// ALU group in opcode order ADD ADC SUB SBB ANA XRA ORA CMP, as x86 /digit
+enum { ALU_ADD, ALU_ADC, ALU_SUB, ALU_SBB, ALU_ANA, ALU_XRA, ALU_ORA, ALU_CMP };
+static const uint8_t x86_alu[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+#define CC_Z 0x4
+#define CC_NZ 0x5
+#define CC_A 0x7
+
+#define JIT_MAX_BLOCK_CODE 8192
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* dispatch;
+} Emitter;
+
+static void emit8(Emitter* e, uint8_t byte) {
+    *e->p++ = byte;
+}
+
+static void emit32(Emitter* e, uint32_t value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit_rex(Emitter* e, int reg, int rm) {
+    emit8(e, 0x40 | (reg >> 3) << 2 | (rm >> 3));
+}
+
+static void emit_modrm_rr(Emitter* e, int reg, int rm) {
+    emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// opcode r/m, reg with register operands
+static void emit_rr(Emitter* e, uint8_t opcode, int reg, int rm) {
+    emit_rex(e, reg, rm);
+    emit8(e, opcode);
+    emit_modrm_rr(e, reg, rm);
+}
+
+// 0F-prefixed reg, r/m with register operands (movzx)
+static void emit_rr0f(Emitter* e, uint8_t opcode, int reg, int rm) {
+    emit_rex(e, reg, rm);
+    emit8(e, 0x0F);
+    emit8(e, opcode);
+    emit_modrm_rr(e, reg, rm);
+}
+
+// Group opcodes taking a /digit in the reg field (80, 81, C1, D0, F6, FE, FF)
+static void emit_group(Emitter* e, uint8_t opcode, int digit, int rm) {
+    emit_rex(e, 0, rm);
+    emit8(e, opcode);
+    emit_modrm_rr(e, digit, rm);
+}
+
+static void emit_ri8(Emitter* e, int digit, int rm, uint8_t imm) {
+    emit_group(e, 0x80, digit, rm);
+    emit8(e, imm);
+}
+
+static void emit_ri32(Emitter* e, int digit, int rm, uint32_t imm) {
+    emit_group(e, 0x81, digit, rm);
+    emit32(e, imm);
+}
+
+static void emit_shift32(Emitter* e, int digit, int rm, uint8_t count) {
+    emit_group(e, 0xC1, digit, rm);
+    emit8(e, count);
+}
+
+static void emit_mov_ri8(Emitter* e, int rm, uint8_t imm) {
+    emit_rex(e, 0, rm);
+    emit8(e, 0xB0 | (rm & 7));
+    emit8(e, imm);
+}
+
+static void emit_mov_ri32(Emitter* e, int rm, uint32_t imm) {
+    emit_rex(e, 0, rm);
+    emit8(e, 0xB8 | (rm & 7));
+    emit32(e, imm);
+}
+
+// lea reg, [base + disp] followed by movzx reg, reg16 to wrap at 64 KiB
+static void emit_lea16(Emitter* e, int reg, int base, int8_t disp) {
+    emit_rex(e, reg, base);
+    emit8(e, 0x8D);
+    emit8(e, 0x40 | (reg & 7) << 3 | (base & 7));
+    emit8(e, (uint8_t)disp);
+    emit_rr0f(e, 0xB7, reg, reg);
+}
+
+// opcode reg, byte [rsi + rcx]
+static void emit_mem(Emitter* e, uint8_t opcode, int reg) {
+    emit_rex(e, reg, 0);
+    emit8(e, opcode);
+    emit8(e, 0x04 | (reg & 7) << 3);
+    emit8(e, 0x0E);
+}
+
+// movzx reg, byte [rsi + rcx]
+static void emit_load_zx(Emitter* e, int reg) {
+    emit_rex(e, reg, 0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x04 | (reg & 7) << 3);
+    emit8(e, 0x0E);
+}
+
+static void emit_state_load8(Emitter* e, int reg, size_t offset) {
+    emit_rex(e, reg, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x40 | (reg & 7) << 3 | 7);
+    emit8(e, offset);
+}
+
+static void emit_state_load16(Emitter* e, int reg, size_t offset) {
+    emit_rex(e, reg, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit8(e, 0x40 | (reg & 7) << 3 | 7);
+    emit8(e, offset);
+}
+
+static void emit_state_store8(Emitter* e, int reg, size_t offset) {
+    emit_rex(e, reg, RDI);
+    emit8(e, 0x88);
+    emit8(e, 0x40 | (reg & 7) << 3 | 7);
+    emit8(e, offset);
+}
+
+static void emit_state_store16(Emitter* e, int reg, size_t offset) {
+    emit8(e, 0x66);
+    emit_rex(e, reg, RDI);
+    emit8(e, 0x89);
+    emit8(e, 0x40 | (reg & 7) << 3 | 7);
+    emit8(e, offset);
+}
+
+// Emits a jcc rel32 and returns the position to patch once the target is known
+static uint8_t* emit_jcc(Emitter* e, uint8_t cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->p;
+}
+
+static void patch_here(Emitter* e, uint8_t* jump_end) {
+    int32_t rel = (int32_t)(e->p - jump_end);
+    memcpy(jump_end - 4, &rel, 4);
+}
+
+static void emit_jmp(Emitter* e, uint8_t* target) {
+    emit8(e, 0xE9);
+    emit32(e, (uint32_t)(int32_t)(target - (e->p + 4)));
+}
+
+// Leaves the block with the next pc already in ecx
+static void emit_exit_dynamic(Emitter* e, uint32_t cycles) {
+    emit_mov_ri32(e, RAX, cycles);
+    emit_jmp(e, e->dispatch);
+}
+
+static void emit_exit(Emitter* e, uint16_t pc, uint32_t cycles) {
+    emit_mov_ri32(e, RCX, pc);
+    emit_exit_dynamic(e, cycles);
+}
+
+static void emit_enter(Emitter* e) {
+    emit8(e, 0x53);                 // push rbx
+    emit8(e, 0x55);                 // push rbp
+    emit8(e, 0x41); emit8(e, 0x54); // push r12
+    emit8(e, 0x41); emit8(e, 0x55); // push r13
+    emit8(e, 0x41); emit8(e, 0x56); // push r14
+    emit8(e, 0x41); emit8(e, 0x57); // push r15
+    emit_state_load8(e, HOST_A, offsetof(JitState, a));
+    emit_state_load8(e, HOST_B, offsetof(JitState, b));
+    emit_state_load8(e, HOST_C, offsetof(JitState, c));
+    emit_state_load8(e, HOST_D, offsetof(JitState, d));
+    emit_state_load8(e, HOST_E, offsetof(JitState, e));
+    emit_state_load8(e, HOST_H, offsetof(JitState, h));
+    emit_state_load8(e, HOST_L, offsetof(JitState, l));
+    emit_state_load8(e, HOST_F, offsetof(JitState, f));
+    emit_state_load16(e, HOST_SP, offsetof(JitState, sp));
+    emit8(e, 0xFF); emit8(e, 0xE1); // jmp rcx
+}
+
+// Chains into the translated block at ecx when no store hit cached code, a
+// whole block still fits in the budget and the address is not an exit.
+// The block is found through the block cache, addressed relative to code_map.
+static void emit_dispatch(Emitter* e) {
+    int32_t block_at = (int32_t)offsetof(BlockCache, block_at) - (int32_t)offsetof(BlockCache, code_map);
+    int32_t native = (int32_t)offsetof(BlockCache, blocks) - (int32_t)sizeof(Block) +
+        (int32_t)offsetof(Block, native) - (int32_t)offsetof(BlockCache, code_map);
+    uint8_t* out[5];
+
+    emit8(e, 0x48); emit8(e, 0x01); emit8(e, 0x47); emit8(e, offsetof(JitState, cycles)); // add [rdi + cycles], rax
+    emit8(e, 0x80); emit8(e, 0x7F); emit8(e, offsetof(JitState, smc)); emit8(e, 0x00);   // cmp byte [rdi + smc], 0
+    out[0] = emit_jcc(e, CC_NZ);
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x47); emit8(e, offsetof(JitState, cycles));      // mov rax, [rdi + cycles]
+    emit8(e, 0x48); emit8(e, 0x3B); emit8(e, 0x47); emit8(e, offsetof(JitState, cycle_limit)); // cmp rax, [rdi + cycle_limit]
+    out[1] = emit_jcc(e, CC_A);
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x47); emit8(e, offsetof(JitState, exit_at)); // mov rax, [rdi + exit_at]
+    emit8(e, 0x80); emit8(e, 0x3C); emit8(e, 0x08); emit8(e, 0x00);                          // cmp byte [rax + rcx], 0
+    out[2] = emit_jcc(e, CC_NZ);
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x84); emit8(e, 0x4A); emit32(e, block_at); // movzx eax, word [rdx + rcx * 2 + block_at]
+    emit8(e, 0x85); emit8(e, 0xC0);                                                      // test eax, eax
+    out[3] = emit_jcc(e, CC_Z);
+    emit8(e, 0x69); emit8(e, 0xC0); emit32(e, sizeof(Block));                            // imul eax, eax, sizeof(Block)
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x84); emit8(e, 0x02); emit32(e, native);   // mov rax, [rdx + rax + native]
+    emit8(e, 0x48); emit8(e, 0x85); emit8(e, 0xC0);                                      // test rax, rax
+    out[4] = emit_jcc(e, CC_Z);
+    emit8(e, 0xFF); emit8(e, 0xE0);                                                      // jmp rax
+
+    for (int i = 0; i < 5; i++) patch_here(e, out[i]);
+    emit_state_store16(e, RCX, offsetof(JitState, pc));
+    emit_state_store8(e, HOST_A, offsetof(JitState, a));
+    emit_state_store8(e, HOST_B, offsetof(JitState, b));
+    emit_state_store8(e, HOST_C, offsetof(JitState, c));
+    emit_state_store8(e, HOST_D, offsetof(JitState, d));
+    emit_state_store8(e, HOST_E, offsetof(JitState, e));
+    emit_state_store8(e, HOST_H, offsetof(JitState, h));
+    emit_state_store8(e, HOST_L, offsetof(JitState, l));
+    emit_state_store8(e, HOST_F, offsetof(JitState, f));
+    emit_state_store16(e, HOST_SP, offsetof(JitState, sp));
+    emit8(e, 0x41); emit8(e, 0x5F); // pop r15
+    emit8(e, 0x41); emit8(e, 0x5E); // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D); // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C); // pop r12
+    emit8(e, 0x5D);                 // pop rbp
+    emit8(e, 0x5B);                 // pop rbx
+    emit8(e, 0xC3);                 // ret
+}
+
+// reg = hi << 8 | lo
+static void emit_pair(Emitter* e, int reg, int hi, int lo) {
+    emit_rr(e, 0x89, hi, reg);
+    emit_shift32(e, 4, reg, 8);
+    emit_rr(e, 0x09, lo, reg);
+}
+
+// hi, lo = low 16 bits of ecx
+static void emit_split_ecx(Emitter* e, int hi, int lo) {
+    emit_rr0f(e, 0xB6, lo, RCX);
+    emit_rr(e, 0x89, RCX, hi);
+    emit_shift32(e, 5, hi, 8);
+    emit_ri32(e, 4, hi, 0xFF);
+}
+
+// Records store n in the JitState when the byte at [rsi + rcx] holds cached code
+static void emit_smc_check(Emitter* e, int n) {
+    emit8(e, 0x80); emit8(e, 0x3C); emit8(e, 0x0A); emit8(e, 0x00); // cmp byte [rdx + rcx], 0
+    uint8_t* skip = emit_jcc(e, CC_Z);
+    emit_state_store16(e, RCX, offsetof(JitState, smc_addr) + 2 * n);
+    emit8(e, 0x80); emit8(e, 0x4F); emit8(e, offsetof(JitState, smc)); emit8(e, 1 << n); // or byte [rdi + smc], 1 << n
+    patch_here(e, skip);
+}
+
+static void emit_store(Emitter* e, int reg, int n) {
+    emit_mem(e, 0x88, reg);
+    emit_smc_check(e, n);
+}
+
+static void emit_store_imm(Emitter* e, uint8_t imm, int n) {
+    emit8(e, 0xC6); emit8(e, 0x04); emit8(e, 0x0E); emit8(e, imm); // mov byte [rsi + rcx], imm
+    emit_smc_check(e, n);
+}
+
+// Leaves the block after an instruction whose stores hit cached code
+static void emit_smc_exit(Emitter* e, uint16_t next_pc, uint32_t cycles) {
+    emit8(e, 0x80); emit8(e, 0x7F); emit8(e, offsetof(JitState, smc)); emit8(e, 0x00); // cmp byte [rdi + smc], 0
+    uint8_t* skip = emit_jcc(e, CC_Z);
+    emit_exit(e, next_pc, cycles);
+    patch_here(e, skip);
+}
+
+// F = S Z A P C of the last host ALU op, LAHF already uses the 8080 PSW layout
+static void emit_flags(Emitter* e) {
+    emit8(e, 0x9F);                               // lahf
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC4); // movzx eax, ah
+    emit_rr(e, 0x89, RAX, HOST_F);
+}
+
+// Same as emit_flags but keeps the guest carry (INR, DCR)
+static void emit_flags_keep_carry(Emitter* e) {
+    emit8(e, 0x9F);
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC4);
+    emit_ri32(e, 4, RAX, 0xFE);
+    emit_ri32(e, 4, HOST_F, 0x01);
+    emit_rr(e, 0x09, RAX, HOST_F);
+}
+
+// Guest carry = host CF
+static void emit_carry_from_cf(Emitter* e) {
+    emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC0); // setc al
+    emit_rr0f(e, 0xB6, RAX, RAX);
+    emit_ri32(e, 4, HOST_F, 0xFE);
+    emit_rr(e, 0x09, RAX, HOST_F);
+}
+
+// Host CF = guest carry
+static void emit_cf_from_carry(Emitter* e) {
+    emit8(e, 0x0F); emit8(e, 0xBA); emit8(e, 0xE5); emit8(e, 0x00); // bt ebp, 0
+}
+
+// Points rcx at the byte addressed by HL
+static void emit_hl_address(Emitter* e) {
+    emit_pair(e, RCX, HOST_H, HOST_L);
+}
+
+// Loads an 8080 register operand, M is read into ebx
+static int emit_operand(Emitter* e, int reg_code) {
+    if (reg_code != REG_M) return host_reg[reg_code];
+    emit_hl_address(e);
+    emit_load_zx(e, RBX);
+    return RBX;
+}
+
+// A = A op src, src < 0 means the immediate operand
+static void emit_alu(Emitter* e, int alu, int src, uint8_t imm) {
+    if (alu == ALU_ANA) {
+        // AC = bit 3 of (A | src)
+        emit_rr(e, 0x89, HOST_A, RCX);
+        if (src < 0) emit_ri32(e, 1, RCX, imm);
+        else emit_rr(e, 0x09, src, RCX);
+        emit_ri32(e, 4, RCX, 0x08);
+        emit_shift32(e, 4, RCX, 1);
+    }
+    if (alu == ALU_ADC || alu == ALU_SBB) emit_cf_from_carry(e);
+    if (src < 0) emit_ri8(e, x86_alu[alu], HOST_A, imm);
+    else emit_rr(e, x86_alu[alu] << 3, src, HOST_A);
+    emit_flags(e);
+    switch (alu) {
+        // The 8080 sets AC on no borrow, x86 on borrow
+        case ALU_SUB: case ALU_SBB: case ALU_CMP: emit_ri32(e, 6, HOST_F, 0x10); break;
+        case ALU_XRA: case ALU_ORA: emit_ri32(e, 4, HOST_F, 0xEF); break;
+        case ALU_ANA:
+            emit_ri32(e, 4, HOST_F, 0xEF);
+            emit_rr(e, 0x09, RCX, HOST_F);
+            break;
+        default: break;
+    }
+}
+
+// Pushes hi, lo (registers, or immediates when negative) onto the guest stack
+static void emit_push(Emitter* e, int hi, int lo, uint16_t imm) {
+    emit_lea16(e, RCX, HOST_SP, -1);
+    if (hi < 0) emit_store_imm(e, imm >> 8, 0);
+    else emit_store(e, hi, 0);
+    emit_lea16(e, RCX, HOST_SP, -2);
+    if (lo < 0) emit_store_imm(e, imm & 0xFF, 1);
+    else emit_store(e, lo, 1);
+    emit_lea16(e, HOST_SP, HOST_SP, -2);
+}
+
+static void emit_pop(Emitter* e, int hi, int lo) {
+    emit_rr(e, 0x89, HOST_SP, RCX);
+    emit_load_zx(e, lo);
+    emit_lea16(e, RCX, HOST_SP, 1);
+    emit_load_zx(e, hi);
+    emit_lea16(e, HOST_SP, HOST_SP, 2);
+}
+
+// Pops the return address into ecx
+static void emit_pop_pc(Emitter* e) {
+    emit_pop(e, RBX, RAX);
+    emit_shift32(e, 4, RBX, 8);
+    emit_rr(e, 0x09, RBX, RAX);
+    emit_rr(e, 0x89, RAX, RCX);
+}
+
+// test F against the condition of a conditional opcode, returns the jcc that skips the taken path
+static uint8_t* emit_condition(Emitter* e, uint8_t opcode) {
+    static const uint8_t masks[4] = { 0x40, 0x01, 0x04, 0x80 }; // Z, C, P, S
+    uint8_t cond = (opcode >> 3) & 7;
+    emit_group(e, 0xF7, 0, HOST_F);
+    emit32(e, masks[cond >> 1]);
+    return emit_jcc(e, (cond & 1) ? CC_Z : CC_NZ);
+}
+
+static bool is_supported(uint8_t opcode) {
+    switch (opcode) {
+        case 0x27: // DAA
+        case 0x76: // HLT
+        case 0xd3: // OUT
+        case 0xdb: // IN
+        case 0xf3: // DI
+        case 0xfb: // EI
+        case 0xed: // hook trap
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Emits one instruction. cycles is the block total including this instruction.
+// Returns false when the instruction ends the block.
+static bool emit_op(Emitter* e, const DecodedOp* op, uint32_t cycles, uint16_t* max_cycles) {
+    uint8_t opcode = op->opcode;
+    uint16_t next = op->next_pc;
+    uint16_t word = op->operand;
+    uint8_t byte = op->operand & 0xFF;
+    int dst = host_reg[(opcode >> 3) & 7];
+    int src = host_reg[opcode & 7];
+
+    // MOV
+    if (opcode >= 0x40 && opcode < 0x80) {
+        if ((opcode & 7) == REG_M) {
+            emit_hl_address(e);
+            emit_mem(e, 0x8A, dst);
+        }
+        else if (((opcode >> 3) & 7) == REG_M) {
+            emit_hl_address(e);
+            emit_store(e, src, 0);
+            emit_smc_exit(e, next, cycles);
+        }
+        else if (dst != src) {
+            emit_rr(e, 0x88, src, dst);
+        }
+        return true;
+    }
+    // ALU with register or M
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        emit_alu(e, (opcode >> 3) & 7, emit_operand(e, opcode & 7), 0);
+        return true;
+    }
+
+    switch (opcode) {
+        case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xcb: case 0xd9: case 0xdd: case 0xfd:
+            return true;
+        // LXI
+        case 0x01: case 0x11: case 0x21: {
+            int hi = host_reg[(opcode >> 3) & 6];
+            int lo = host_reg[((opcode >> 3) & 6) + 1];
+            emit_mov_ri32(e, hi, word >> 8);
+            emit_mov_ri32(e, lo, word & 0xFF);
+            return true;
+        }
+        case 0x31: emit_mov_ri32(e, HOST_SP, word); return true;
+        // STAX, LDAX
+        case 0x02: case 0x12:
+            emit_pair(e, RCX, host_reg[(opcode >> 3) & 6], host_reg[((opcode >> 3) & 6) + 1]);
+            emit_store(e, HOST_A, 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        case 0x0a: case 0x1a:
+            emit_pair(e, RCX, host_reg[(opcode >> 3) & 6], host_reg[((opcode >> 3) & 6) + 1]);
+            emit_mem(e, 0x8A, HOST_A);
+            return true;
+        // INX, DCX
+        case 0x03: case 0x13: case 0x23: case 0x0b: case 0x1b: case 0x2b: {
+            int hi = host_reg[(opcode >> 3) & 6];
+            int lo = host_reg[((opcode >> 3) & 6) + 1];
+            emit_pair(e, RCX, hi, lo);
+            emit_group(e, 0xFF, (opcode & 0x08) ? 1 : 0, RCX);
+            emit_split_ecx(e, hi, lo);
+            return true;
+        }
+        case 0x33: emit_lea16(e, HOST_SP, HOST_SP, 1); return true;
+        case 0x3b: emit_lea16(e, HOST_SP, HOST_SP, -1); return true;
+        // INR, DCR
+        case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x3c:
+            emit_group(e, 0xFE, 0, dst);
+            emit_flags_keep_carry(e);
+            return true;
+        case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x3d:
+            emit_group(e, 0xFE, 1, dst);
+            emit_flags_keep_carry(e);
+            emit_ri32(e, 6, HOST_F, 0x10);
+            return true;
+        case 0x34: case 0x35:
+            emit_hl_address(e);
+            emit_load_zx(e, RBX);
+            emit_group(e, 0xFE, opcode & 1, RBX);
+            emit_flags_keep_carry(e);
+            if (opcode & 1) emit_ri32(e, 6, HOST_F, 0x10);
+            emit_store(e, RBX, 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        // MVI
+        case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x3e:
+            emit_mov_ri8(e, dst, byte);
+            return true;
+        case 0x36:
+            emit_hl_address(e);
+            emit_store_imm(e, byte, 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        // RLC, RRC, RAL, RAR
+        case 0x07: case 0x0f: case 0x17: case 0x1f:
+            if (opcode >= 0x17) emit_cf_from_carry(e);
+            emit_group(e, 0xD0, (opcode >> 3) & 3, HOST_A);
+            emit_carry_from_cf(e);
+            return true;
+        // DAD
+        case 0x09: case 0x19: case 0x29: case 0x39:
+            if (opcode == 0x39) emit_rr(e, 0x89, HOST_SP, RAX);
+            else emit_pair(e, RAX, host_reg[(opcode >> 3) & 6], host_reg[((opcode >> 3) & 6) + 1]);
+            emit_hl_address(e);
+            emit_rr(e, 0x01, RAX, RCX);
+            emit_rr(e, 0x89, RCX, RAX);
+            emit_shift32(e, 5, RAX, 16);
+            emit_ri32(e, 4, HOST_F, 0xFE);
+            emit_rr(e, 0x09, RAX, HOST_F);
+            emit_split_ecx(e, HOST_H, HOST_L);
+            return true;
+        // SHLD, LHLD, STA, LDA
+        case 0x22:
+            emit_mov_ri32(e, RCX, word);
+            emit_store(e, HOST_L, 0);
+            emit_mov_ri32(e, RCX, (uint16_t)(word + 1));
+            emit_store(e, HOST_H, 1);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        case 0x2a:
+            emit_mov_ri32(e, RCX, word);
+            emit_mem(e, 0x8A, HOST_L);
+            emit_mov_ri32(e, RCX, (uint16_t)(word + 1));
+            emit_mem(e, 0x8A, HOST_H);
+            return true;
+        case 0x32:
+            emit_mov_ri32(e, RCX, word);
+            emit_store(e, HOST_A, 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        case 0x3a:
+            emit_mov_ri32(e, RCX, word);
+            emit_mem(e, 0x8A, HOST_A);
+            return true;
+        // CMA, STC, CMC
+        case 0x2f: emit_group(e, 0xF6, 2, HOST_A); return true;
+        case 0x37: emit_ri32(e, 1, HOST_F, 0x01); return true;
+        case 0x3f: emit_ri32(e, 6, HOST_F, 0x01); return true;
+        // ALU immediate
+        case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+            emit_alu(e, (opcode >> 3) & 7, -1, byte);
+            return true;
+        // POP, PUSH
+        case 0xc1: case 0xd1: case 0xe1:
+            emit_pop(e, host_reg[(opcode >> 3) & 6], host_reg[((opcode >> 3) & 6) + 1]);
+            return true;
+        case 0xf1:
+            emit_pop(e, HOST_A, HOST_F);
+            emit_ri32(e, 4, HOST_F, 0xD5);
+            emit_ri32(e, 1, HOST_F, 0x02);
+            return true;
+        case 0xc5: case 0xd5: case 0xe5:
+            emit_push(e, host_reg[(opcode >> 3) & 6], host_reg[((opcode >> 3) & 6) + 1], 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        case 0xf5:
+            emit_push(e, HOST_A, HOST_F, 0);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        // XTHL, XCHG, SPHL
+        case 0xe3:
+            emit_rr(e, 0x89, HOST_SP, RCX);
+            emit_load_zx(e, RBX);
+            emit_store(e, HOST_L, 0);
+            emit_rr(e, 0x89, RBX, HOST_L);
+            emit_lea16(e, RCX, HOST_SP, 1);
+            emit_load_zx(e, RBX);
+            emit_store(e, HOST_H, 1);
+            emit_rr(e, 0x89, RBX, HOST_H);
+            emit_smc_exit(e, next, cycles);
+            return true;
+        case 0xeb:
+            emit_rr(e, 0x87, HOST_H, HOST_D);
+            emit_rr(e, 0x87, HOST_L, HOST_E);
+            return true;
+        case 0xf9:
+            emit_pair(e, HOST_SP, HOST_H, HOST_L);
+            return true;
+        // JMP, PCHL
+        case 0xc3:
+            emit_exit(e, word, cycles);
+            return false;
+        case 0xe9:
+            emit_hl_address(e);
+            emit_exit_dynamic(e, cycles);
+            return false;
+        // CALL, RST
+        case 0xcd:
+            emit_push(e, -1, -1, next);
+            emit_exit(e, word, cycles);
+            return false;
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+            emit_push(e, -1, -1, next);
+            emit_exit(e, opcode & 0x38, cycles);
+            return false;
+        // RET
+        case 0xc9:
+            emit_pop_pc(e);
+            emit_exit_dynamic(e, cycles);
+            return false;
+        default: break;
+    }
+
+    // Conditional jumps, calls and returns
+    uint8_t* not_taken = emit_condition(e, opcode);
+    switch (opcode & 7) {
+        case 2:
+            emit_exit(e, word, cycles);
+            break;
+        case 4:
+            emit_push(e, -1, -1, next);
+            emit_exit(e, word, cycles + 6);
+            *max_cycles = cycles + 6;
+            break;
+        case 0:
+            emit_pop_pc(e);
+            emit_exit_dynamic(e, cycles + 6);
+            *max_cycles = cycles + 6;
+            break;
+    }
+    patch_here(e, not_taken);
+    emit_exit(e, next, cycles);
+    return false;
+}
+
+static void reset_arena(Jit* jit, BlockCache* cache) {
+    for (uint32_t i = 0; i < cache->num_blocks; i++) {
+        cache->blocks[i].native = NULL;
+    }
+    jit->arena_used = jit->code_start;
+    jit->arena_resets++;
+}
+
+bool jit_attach(Cpu* cpu) {
+    if (cpu->jit) return true;
+    Jit* jit = calloc(1, sizeof(Jit));
+    if (jit == NULL) return false;
+    jit->arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->arena == MAP_FAILED) {
+        free(jit);
+        return false;
+    }
+    Emitter e = { jit->arena, NULL };
+    jit->enter = e.p;
+    emit_enter(&e);
+    e.dispatch = jit->dispatch = e.p;
+    emit_dispatch(&e);
+    jit->code_start = jit->arena_used = e.p - jit->arena;
+    cpu->jit = jit;
+    return true;
+}
+
+void jit_set_exit(Jit* jit, uint16_t addr) {
+    jit->exit_at[addr] = 1;
+}
+
+void jit_destroy(Jit* jit) {
+    munmap(jit->arena, JIT_ARENA_SIZE);
+    free(jit);
+}
+
+void jit_translate(Cpu* cpu, Block* block) {
+    Jit* jit = cpu->jit;
+    BlockCache* cache = cpu->block_cache;
+    // A cache flush drops every block, so their code can be overwritten too
+    if (jit->cache_flushes != cache->flushes) {
+        jit->cache_flushes = cache->flushes;
+        jit->arena_used = jit->code_start;
+    }
+    if (JIT_ARENA_SIZE - jit->arena_used < JIT_MAX_BLOCK_CODE) reset_arena(jit, cache);
+
+    if (!is_supported(block->ops[0].opcode)) {
+        jit->blocks_rejected++;
+        return;
+    }
+
+    Emitter e = { jit->arena + jit->arena_used, jit->dispatch };
+    uint8_t* entry = e.p;
+
+    uint32_t cycles = 0;
+    uint16_t max_cycles = 0;
+    uint16_t pc = block->start;
+    bool open = true;
+    for (uint16_t i = 0; open && i < block->num_ops; i++) {
+        const DecodedOp* op = &block->ops[i];
+        if (!is_supported(op->opcode)) break;
+        cycles += op->cycles;
+        open = emit_op(&e, op, cycles, &max_cycles);
+        pc = op->next_pc;
+    }
+    // Fell off the end of the block or stopped before an unsupported instruction
+    if (open) emit_exit(&e, pc, cycles);
+    if (max_cycles < cycles) max_cycles = cycles;
+
+    block->native = entry;
+    block->max_cycles = max_cycles;
+    jit->arena_used = e.p - jit->arena;
+    jit->blocks_translated++;
+}
+
+uint64_t jit_call(Cpu* cpu, Block* block, uint64_t cycle_budget) {
+    JitState state;
+    cpu_sync_flags(cpu);
+    state.cycles = 0;
+    state.cycle_limit = cycle_budget >= JIT_MAX_BLOCK_CYCLES ? cycle_budget - JIT_MAX_BLOCK_CYCLES : 0;
+    state.exit_at = cpu->jit->exit_at;
+    state.a = cpu->a;
+    state.b = cpu->b;
+    state.c = cpu->c;
+    state.d = cpu->d;
+    state.e = cpu->e;
+    state.h = cpu->h;
+    state.l = cpu->l;
+    state.f = cpu->f;
+    state.sp = cpu->sp;
+    state.smc = 0;
+
+    ((JitEnter)cpu->jit->enter)(&state, cpu->memory, cpu->block_cache->code_map, block->native);
+
+    cpu->a = state.a;
+    cpu->b = state.b;
+    cpu->c = state.c;
+    cpu->d = state.d;
+    cpu->e = state.e;
+    cpu->h = state.h;
+    cpu->l = state.l;
+    cpu->f = state.f;
+    cpu->sp = state.sp;
+    cpu->pc = state.pc;
+    if (state.smc & 1) block_cache_write(cpu->block_cache, state.smc_addr[0]);
+    if (state.smc & 2) block_cache_write(cpu->block_cache, state.smc_addr[1]);
+    return state.cycles;
+}
+
+#endif
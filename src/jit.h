@@ -0,0 +1,59 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "block_cache.h"
+
+#ifdef CPU_HAVE_JIT
+
+// Executions of a cached block before it is translated
+#define JIT_HOT_THRESHOLD 16
+#define JIT_ARENA_SIZE (16 << 20)
+// Upper bound on the T-states of any block: XTHL is the slowest instruction, plus a taken CALL/RET
+#define JIT_MAX_BLOCK_CYCLES (BLOCK_MAX_OPS * 18 + 6)
+
+// Guest state as seen by translated code. F holds the flags in PUSH PSW layout.
+typedef struct {
+    uint64_t cycles;         // T-states run since entry
+    uint64_t cycle_limit;    // chaining into the next block stops once cycles exceeds this
+    const uint8_t* exit_at;  // block start addresses that return to the caller
+    uint8_t a, b, c, d, e, h, l, f;
+    uint16_t sp;
+    uint16_t pc;
+    uint16_t smc_addr[2]; // addresses of the stores that hit cached code
+    uint8_t smc;          // bit n set when store n of the last instruction hit cached code
+} JitState;
+
+typedef struct Jit {
+    uint8_t* arena;
+    uint32_t arena_used;
+    uint32_t code_start; // arena bytes taken by the shared entry and exit routines
+    void* enter;
+    void* dispatch;
+    uint8_t exit_at[0x10000];
+    uint64_t cache_flushes; // block cache flush count the arena contents belong to
+
+    uint64_t blocks_translated;
+    uint64_t blocks_rejected;
+    uint64_t arena_resets;
+} Jit;
+
+// Attaches an x86-64 translator to the cpu. Blocks run through cpu_run_cached
+// and cpu_execute_block are translated once hot. Returns false if no executable
+// memory could be mapped. Translated code reads and writes the flat memory
+// directly, so the blocks of a cpu with a bus always run interpreted.
+bool jit_attach(Cpu* cpu);
+void jit_destroy(Jit* jit);
+// Makes translated code return to the caller instead of chaining into the block at addr
+void jit_set_exit(Jit* jit, uint16_t addr);
+// Translates a cached block, leaves block->native NULL if its first instruction is unsupported
+void jit_translate(Cpu* cpu, Block* block);
+// Runs a translated block, and any translated blocks it leads to while
+// JIT_MAX_BLOCK_CYCLES more fit in cycle_budget. Returns the T-states run.
+uint64_t jit_call(Cpu* cpu, Block* block, uint64_t cycle_budget);
+
+#endif
+
+#endif
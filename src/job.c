@@ -0,0 +1,143 @@
+#define _POSIX_C_SOURCE 199309L
+#include "job.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bdos.h"
+#include "cpu.h"
+#include "debug.h"
+#include "hooks.h"
+#include "input_log.h"
+#include "jit.h"
+
+// Returns the rom size, or 0 if it could not be read
+static uint16_t load_rom(unsigned char* memory, const char* filename, uint16_t addr) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 0;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    rewind(fp);
+    if (file_size <= 0 || file_size > 0x10000 - addr) {
+        fprintf(stderr, "Failed to read rom %s\n", filename);
+        fclose(fp);
+        return 0;
+    }
+
+    const size_t test_size = fread(memory + addr, 1, file_size, fp);
+    fclose(fp);
+    if (test_size != (size_t)file_size) {
+        fprintf(stderr, "Failed to read rom %s\n", filename);
+        return 0;
+    }
+    return (uint16_t)file_size;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void job_init(Job* job, const char* rom, uint64_t cycle_budget, FILE* stream) {
+    job->rom = rom;
+    job->cycle_budget = cycle_budget;
+    job->jit = false;
+    job->debug = false;
+    job->trace = NULL;
+    job->profile = NULL;
+    job->sampler = NULL;
+    job->dir = ".";
+    job->args = NULL;
+    console_init(&job->console, stream);
+    job->status = JOB_LOAD_FAILED;
+    job->cycles = 0;
+    job->seconds = 0;
+}
+
+void job_run(Job* job) {
+    double start = now();
+    uint64_t budget = job->cycle_budget ? job->cycle_budget : UINT64_MAX;
+    unsigned char* memory = calloc(0x10000, 1);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+
+    uint16_t memory_size = memory ? load_rom(memory, job->rom, 0x100) : 0;
+    if (memory_size == 0) {
+        job->status = JOB_LOAD_FAILED;
+        free(memory);
+        return;
+    }
+
+    Hooks hooks;
+    hooks_init(&hooks, &cpu);
+    Bdos bdos;
+    bdos_init(&bdos, &job->console, job->dir);
+    bdos_attach(&bdos, &hooks, &cpu);
+    if (job->args) bdos_set_command_line(&cpu, job->args);
+
+    if (job->debug) print_memory(&cpu, memory_size);
+
+    if (job->sampler) sampler_start(job->sampler, &cpu);
+    if (job->debug || job->trace || (job->profile && job->sampler)) {
+        while (!cpu.halted && cpu.cycles < budget) {
+            if (job->debug) disassemble(&cpu);
+            TraceRecord record;
+            if (job->trace) trace_begin(&record, &cpu);
+            uint16_t pc = cpu.pc;
+            uint16_t sp = cpu.sp;
+            uint8_t opcode = cpu_get_content_addr(&cpu, pc);
+            uint8_t cycles = cpu_execute(&cpu);
+            if (job->profile) profile_count(job->profile, pc, opcode, cycles);
+            if (job->sampler) sampler_step(job->sampler, &cpu, opcode, sp);
+            // The last instruction too, the HLT or the jump to the warm boot
+            if (job->debug) register_state(&cpu);
+            if (job->trace) trace_end(job->trace, &record, &cpu);
+        }
+    }
+    else if (job->profile) {
+        while (!cpu.halted && cpu.cycles < budget) cpu_run_profiled(&cpu, budget - cpu.cycles, job->profile);
+    }
+    else if (job->sampler) {
+        while (!cpu.halted && cpu.cycles < budget) cpu_run_sampled(&cpu, budget - cpu.cycles, job->sampler);
+    }
+#ifdef CPU_HAVE_JIT
+    else if (job->jit && jit_attach(&cpu)) {
+        while (!cpu.halted && cpu.cycles < budget) cpu_run_cached(&cpu, budget - cpu.cycles);
+    }
+#endif
+    else {
+        while (!cpu.halted && cpu.cycles < budget) cpu_run(&cpu, budget - cpu.cycles);
+    }
+
+    if (hooks.stopped) job->status = JOB_DONE;
+    else if (cpu.halted) job->status = JOB_HALTED;
+    else job->status = JOB_OUT_OF_BUDGET;
+    if (!bdos_free(&bdos)) job->status = JOB_WRITE_FAILED;
+    if (job->profile) profile_capture(job->profile, &cpu);
+    console_flush(&job->console);
+    if (job->console.log && !input_log_close(job->console.log, &cpu)) job->status = JOB_LOG_FAILED;
+    job->cycles = cpu.cycles;
+    cpu_free(&cpu);
+    free(memory);
+    job->seconds = now() - start;
+}
+
+void job_free(Job* job) {
+    console_free(&job->console);
+}
+
+const char* job_status_name(JobStatus status) {
+    switch (status) {
+        case JOB_DONE: return "done";
+        case JOB_OUT_OF_BUDGET: return "out of budget";
+        case JOB_HALTED: return "halted";
+        case JOB_LOG_FAILED: return "input log failed";
+        case JOB_WRITE_FAILED: return "file write failed";
+        case JOB_LOAD_FAILED: return "load failed";
+    }
+    return "unknown";
+}
@@ -0,0 +1,47 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "console.h"
+#include "profile.h"
+#include "sampler.h"
+#include "trace.h"
+
+typedef enum {
+    JOB_DONE,          // rom jumped to 0x0000
+    JOB_OUT_OF_BUDGET, // cycle budget ran out first
+    JOB_HALTED,        // rom ran HLT, nothing can wake it
+    JOB_LOG_FAILED,    // the input log could not be written, or the replay did not match it
+    JOB_WRITE_FAILED,  // a guest file could not be written back to the host
+    JOB_LOAD_FAILED
+} JobStatus;
+
+// One rom run on its own Cpu and memory
+typedef struct {
+    const char* rom;
+    uint64_t cycle_budget; // 0 for no limit
+    bool jit;
+    bool debug;
+    TraceRing* trace; // binary trace of every instruction, NULL for none
+    Profile* profile; // counts per opcode and address, NULL for none
+    Sampler* sampler; // call stack samples, NULL for none
+    const char* dir;  // host directory behind the BDOS file functions
+    const char* args; // command tail, NULL for none
+    Console console; // console.log records or replays console input
+
+    JobStatus status;
+    uint64_t cycles;
+    double seconds;
+} Job;
+
+void job_init(Job* job, const char* rom, uint64_t cycle_budget, FILE* stream);
+// Loads the rom at 0x100 and runs it until it exits or the budget runs out.
+// Then writes back the guest files and closes console.log if set, which checks
+// a replay against the final state.
+// Only touches the job, so jobs can run on different threads.
+void job_run(Job* job);
+void job_free(Job* job);
+const char* job_status_name(JobStatus status);
+
+#endif
@@ -1,66 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include "cpu.h"
-#include "debug.h"
+#include <time.h>
+#include <unistd.h>
+#include "input_log.h"
+#include "job.h"
+#include "pool.h"
 
-uint16_t memory_size = 0xFFFF;
-bool debug = 0;
-void read_test(unsigned char* memory, char* filename, uint16_t addr);
+typedef struct {
+    bool debug;
+    bool jit;
+    unsigned threads;
+    uint64_t cycle_budget;
+    const char* job_list;
+    const char* record;
+    const char* replay;
+    const char* trace;
+    const char* profile;
+    const char* sample;
+    uint64_t sample_interval;
+    const char* symbols;
+    const char* dir;
+    const char* args;
+} Options;
 
-int main(int argc, char** argv) {
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s [--debug] filename\n", argv[0]);
+typedef struct {
+    Job* jobs;
+    size_t count;
+    size_t cap;
+    size_t owned; // leading jobs whose rom path was allocated by read_job_list
+} JobList;
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--debug] [--jit] [--threads N] [--budget CYCLES] [--jobs FILE] [--record LOG | --replay LOG] [--trace FILE] [--profile FILE] [--sample FILE [--interval CYCLES] [--symbols FILE]] [--dir DIR] [--args TEXT] romfile...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static bool parse_u64(const char* s, uint64_t* value) {
+    char* end;
+    if (*s == '\0' || *s == '-') return false;
+    *value = strtoull(s, &end, 0);
+    return *end == '\0';
+}
+
+static void add_job(JobList* list, const char* rom, uint64_t cycle_budget, const Options* options) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 8;
+        list->jobs = realloc(list->jobs, list->cap * sizeof(Job));
+        if (list->jobs == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Job* job = &list->jobs[list->count++];
+    job_init(job, rom, cycle_budget, NULL);
+    job->jit = options->jit;
+    if (options->dir) job->dir = options->dir;
+    job->args = options->args;
+}
+
+// One job per line: rom path and an optional cycle budget. # starts a comment.
+static void read_job_list(JobList* list, const char* filename, const Options* options) {
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
         exit(EXIT_FAILURE);
     }
-    if (argc == 3) {
-        if ((strcmp(argv[1], "--debug") != 0 && strcmp(argv[1], "-d") != 0)) {
-            fprintf(stderr, "Usage: %s [--debug] filename\n", argv[0]);
+    char line[1024];
+    for (int n = 1; fgets(line, sizeof(line), fp); n++) {
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char* rom = strtok(line, " \t\r\n");
+        if (rom == NULL) continue;
+        char* budget_arg = strtok(NULL, " \t\r\n");
+        uint64_t budget = options->cycle_budget;
+        if ((budget_arg && !parse_u64(budget_arg, &budget)) || strtok(NULL, " \t\r\n")) {
+            fprintf(stderr, "%s:%d: expected a rom and an optional cycle budget\n", filename, n);
+            exit(EXIT_FAILURE);
+        }
+        char* path = strdup(rom);
+        if (path == NULL) {
+            fprintf(stderr, "Out of memory\n");
             exit(EXIT_FAILURE);
         }
-        debug = 1;
+        add_job(list, path, budget, options);
+        list->owned++;
     }
+    fclose(fp);
+}
 
-    Cpu cpu;
-    unsigned char* rom = malloc(memory_size);
-    cpu_init(&cpu, rom);
+// Starts recording to options->record or reads options->replay back
+static FILE* open_log(InputLog* log, const Options* options) {
+    const char* filename = options->record ? options->record : options->replay;
+    FILE* fp = fopen(filename, options->record ? "wb" : "rb");
+    bool ok = fp && (options->record ? input_log_record(log, fp) : input_log_replay(log, fp));
+    if (!ok) {
+        fprintf(stderr, options->record || fp == NULL ? "Could not open %s\n" : "%s is not an input log\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
 
-    read_test(cpu.memory, argv[argc - 1], 0x100);
+static void run_job(void* arg, size_t task) {
+    job_run(&((Job*)arg)[task]);
+}
 
-    // Needed for syscall
-    *(cpu.memory + 0x07) = 0xC9;
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    if (debug) print_memory(&cpu, memory_size);
+int main(int argc, char** argv) {
+    Options options = { false, false, pool_default_threads(), 0, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL };
+    JobList list = { NULL, 0, 0, 0 };
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) options.debug = true;
+        else if (strcmp(argv[i], "--jit") == 0) options.jit = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            uint64_t threads;
+            if (!parse_u64(argv[++i], &threads) || threads == 0 || threads > 1024) usage(argv[0]);
+            options.threads = (unsigned)threads;
+        }
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            if (!parse_u64(argv[++i], &options.cycle_budget)) usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) options.job_list = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) options.record = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) options.replay = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) options.trace = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) options.profile = argv[++i];
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) options.sample = argv[++i];
+        else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            if (!parse_u64(argv[++i], &options.sample_interval) || options.sample_interval == 0) usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) options.symbols = argv[++i];
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) options.dir = argv[++i];
+        else if (strcmp(argv[i], "--args") == 0 && i + 1 < argc) options.args = argv[++i];
+        else usage(argv[0]);
+    }
+    if (options.job_list) read_job_list(&list, options.job_list, &options);
+    for (; i < argc; i++) add_job(&list, argv[i], options.cycle_budget, &options);
+    if (list.count == 0 || (options.record && options.replay)) usage(argv[0]);
 
-    while (1) {
-        if (cpu.pc == 0x0000) return 0;
-        if (debug) disassemble(&cpu);
-        cpu_execute(&cpu);
-        sys_call(&cpu);
-        if (debug) register_state(&cpu);
+    // A single rom writes straight to stdout, as before
+    if (list.count == 1 && options.job_list == NULL) {
+        Job* job = &list.jobs[0];
+        job->debug = options.debug;
+        // --debug prints between instructions, so guest output must keep its place
+        console_set_file(&job->console, stdout, options.debug ? CONSOLE_FLUSH_WRITE : isatty(STDOUT_FILENO) ? CONSOLE_FLUSH_LINE : CONSOLE_FLUSH_FULL);
+        // Unbuffered, so a status check that polls the descriptor sees every byte
+        setvbuf(stdin, NULL, _IONBF, 0);
+        job->console.input = stdin;
+        InputLog log;
+        FILE* log_file = NULL;
+        if (options.record || options.replay) {
+            log_file = open_log(&log, &options);
+            job->console.log = &log;
+        }
+        TraceRing trace;
+        FILE* trace_file = NULL;
+        if (options.trace) {
+            trace_file = fopen(options.trace, "wb");
+            if (trace_file == NULL || !trace_open(&trace, trace_file)) {
+                fprintf(stderr, "Could not open %s\n", options.trace);
+                return EXIT_FAILURE;
+            }
+            job->trace = &trace;
+        }
+        Profile profile;
+        FILE* profile_file = NULL;
+        if (options.profile) {
+            profile_file = fopen(options.profile, "w");
+            if (profile_file == NULL || !profile_init(&profile)) {
+                fprintf(stderr, "Could not open %s\n", options.profile);
+                return EXIT_FAILURE;
+            }
+            job->profile = &profile;
+        }
+        Sampler sampler;
+        SymbolTable symbols;
+        symbols_init(&symbols);
+        FILE* sample_file = NULL;
+        if (options.sample) {
+            int line;
+            if (options.symbols && !symbols_load(&symbols, options.symbols, &line)) {
+                if (line) fprintf(stderr, "%s:%d: expected pairs of a hex address and a name\n", options.symbols, line);
+                else fprintf(stderr, "Could not read %s\n", options.symbols);
+                return EXIT_FAILURE;
+            }
+            sample_file = fopen(options.sample, "w");
+            if (sample_file == NULL || !sampler_init(&sampler, options.sample_interval)) {
+                fprintf(stderr, "Could not open %s\n", options.sample);
+                return EXIT_FAILURE;
+            }
+            job->sampler = &sampler;
+        }
+        job_run(job);
+        if (trace_file) {
+            if (!trace_close(&trace)) fprintf(stderr, "%s: could not write %s\n", job->rom, options.trace);
+            fclose(trace_file);
+        }
+        if (profile_file) {
+            profile_report(&profile, stderr, PROFILE_TOP);
+            bool written = profile_dump(&profile, profile_file);
+            if (fclose(profile_file) != 0 || !written) {
+                fprintf(stderr, "%s: could not write %s\n", job->rom, options.profile);
+            }
+            profile_free(&profile);
+        }
+        if (sample_file) {
+            fprintf(stderr, "%s: %llu samples every %llu T-states in %zu call stacks\n", job->rom,
+                    (unsigned long long)sampler.samples, (unsigned long long)sampler.interval, sampler.node_count);
+            bool written = sampler_write(&sampler, &symbols, sample_file);
+            if (fclose(sample_file) != 0 || !written) {
+                fprintf(stderr, "%s: could not write %s\n", job->rom, options.sample);
+            }
+            sampler_free(&sampler);
+        }
+        symbols_free(&symbols);
+        if (job->status == JOB_OUT_OF_BUDGET) fprintf(stderr, "%s: cycle budget of %llu ran out\n", job->rom, (unsigned long long)job->cycle_budget);
+        if (job->status == JOB_HALTED) fprintf(stderr, "%s: halted with nothing to wake it\n", job->rom);
+        if (job->status == JOB_WRITE_FAILED) fprintf(stderr, "%s: could not write back a file in %s\n", job->rom, job->dir);
+        if (job->status == JOB_LOG_FAILED) {
+            fprintf(stderr, options.record ? "%s: could not write %s\n" : "%s: run did not match %s\n", job->rom,
+                    options.record ? options.record : options.replay);
+        }
+        if (log_file) {
+            input_log_free(&log);
+            fclose(log_file);
+        }
+        int status = job->status == JOB_DONE ? EXIT_SUCCESS : EXIT_FAILURE;
+        job_free(job);
+        free(list.jobs);
+        return status;
+    }
+    if (options.debug) {
+        fprintf(stderr, "--debug takes a single rom\n");
+        return EXIT_FAILURE;
+    }
+    if (options.record || options.replay || options.trace || options.profile || options.sample) {
+        fprintf(stderr, "--record, --replay, --trace, --profile and --sample take a single rom\n");
+        return EXIT_FAILURE;
     }
 
-    free(rom);
-    return 0;
-}
+    double start = now();
+    uint64_t steals = pool_run(list.count, options.threads, run_job, list.jobs);
+    double seconds = now() - start;
 
-void read_test(unsigned char* memory, char* filename, uint16_t addr) {
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-        printf("Could not open %s\n", filename);
-        exit(EXIT_FAILURE);
+    uint64_t total_cycles = 0;
+    size_t failed = 0;
+    for (size_t j = 0; j < list.count; j++) {
+        Job* job = &list.jobs[j];
+        if (job->console.len) fwrite(job->console.data, 1, job->console.len, stdout);
+        if (job->console.truncated) printf("\n(output truncated)");
+        printf("\n[%s] %s: %llu cycles in %.3f s\n", job->rom, job_status_name(job->status),
+               (unsigned long long)job->cycles, job->seconds);
+        total_cycles += job->cycles;
+        if (job->status != JOB_DONE) failed++;
     }
+    printf("%zu jobs (%zu failed) on %u threads: %llu cycles in %.3f s, %.1f MHz aggregate, %llu steals\n",
+           list.count, failed, options.threads < list.count ? options.threads : (unsigned)list.count,
+           (unsigned long long)total_cycles, seconds, seconds > 0 ? total_cycles / seconds / 1e6 : 0.0,
+           (unsigned long long)steals);
 
-    fseek(fp, 0, SEEK_END);
-    size_t file_size = ftell(fp);
-    memory_size = (uint16_t)file_size;
-    rewind(fp);
-
-    const size_t test_size = fread(memory + addr, 1, memory_size, fp);
-    if (test_size != file_size) {
-        printf("Failed to read rom %s\n", filename);
-        exit(EXIT_FAILURE);
+    for (size_t j = 0; j < list.count; j++) {
+        if (j < list.owned) free((char*)list.jobs[j].rom);
+        job_free(&list.jobs[j]);
     }
-    fclose(fp);
+    free(list.jobs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
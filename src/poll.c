@@ -0,0 +1,114 @@
+#include "poll.h"
+#include "bus.h"
+#include "ports.h"
+
+#define MAX_LOOP_OPS 3
+
+// Reads guest memory without going through device handlers. Returns false if
+// addr is not RAM or ROM.
+static bool peek(const Cpu* cpu, uint16_t addr, uint8_t* value) {
+    if (cpu->bus == NULL) {
+        *value = cpu->memory[addr];
+        return true;
+    }
+    const uint8_t* page = cpu->bus->read_page[addr >> BUS_PAGE_BITS];
+    if (page == NULL) return false;
+    *value = page[addr & (BUS_PAGE_SIZE - 1)];
+    return true;
+}
+
+static bool peek_word(const Cpu* cpu, uint16_t addr, uint16_t* value) {
+    uint8_t lo, hi;
+    if (!peek(cpu, addr, &lo) || !peek(cpu, addr + 1, &hi)) return false;
+    *value = hi << 8 | lo;
+    return true;
+}
+
+static bool stable_port(const Cpu* cpu, uint8_t port) {
+    if (cpu->ports == NULL) return true;
+    const PortDevice* device = &cpu->ports->device[port];
+    return device->read == NULL || device->stable;
+}
+
+// JNZ JZ JNC JC JPO JPE JP JM
+static bool is_branch(uint8_t opcode) {
+    return (opcode & 0xC7) == 0xC2;
+}
+
+// Instructions that set flags from A alone and leave A a function of its old value
+static bool is_test(uint8_t opcode) {
+    switch (opcode) {
+        case 0x07: // RLC
+        case 0x0F: // RRC
+        case 0xA7: // ANA A
+        case 0xB7: // ORA A
+        case 0xE6: // ANI
+        case 0xEE: // XRI
+        case 0xF6: // ORI
+        case 0xFE: // CPI
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Decodes the loop starting at top and keeps the address of each instruction in ops
+static bool match_at(const Cpu* cpu, uint16_t top, PollLoop* loop, uint16_t* ops) {
+    uint8_t opcode, byte;
+    uint16_t addr;
+    if (!peek(cpu, top, &opcode)) return false;
+    switch (opcode) {
+        case 0xDB: // IN
+            if (!peek(cpu, top + 1, &byte) || !stable_port(cpu, byte)) return false;
+            break;
+        case 0x3A: // LDA
+            if (!peek_word(cpu, top + 1, &addr) || !peek(cpu, addr, &byte)) return false;
+            break;
+        case 0x0A: // LDAX B
+        case 0x1A: // LDAX D
+        case 0x7E: // MOV A,M
+            addr = opcode == 0x0A ? cpu->bc : opcode == 0x1A ? cpu->de : cpu->hl;
+            if (!peek(cpu, addr, &byte)) return false;
+            break;
+        default:
+            return false;
+    }
+
+    uint16_t pc = top;
+    loop->num_ops = 0;
+    loop->cycles = 0;
+    for (;;) {
+        ops[loop->num_ops++] = pc;
+        loop->cycles += cpu_opcode_cycles(opcode);
+        pc += cpu_opcode_length(opcode);
+        if (is_branch(opcode)) break;
+        if (loop->num_ops == MAX_LOOP_OPS || !peek(cpu, pc, &opcode)) return false;
+        if (!is_branch(opcode) && (loop->num_ops > 1 || !is_test(opcode))) return false;
+    }
+    uint16_t target;
+    if (!peek_word(cpu, pc - 2, &target) || target != top) return false;
+    loop->top = top;
+    return true;
+}
+
+bool poll_find(Cpu* cpu, PollLoop* loop) {
+    uint16_t ops[MAX_LOOP_OPS];
+    if (match_at(cpu, cpu->pc, loop, ops)) {
+        loop->steps = 0;
+        return true;
+    }
+    // pc may sit on the test or the branch, both are at most two bytes before the branch
+    for (uint16_t branch = cpu->pc; branch != (uint16_t)(cpu->pc + 3); branch++) {
+        uint8_t opcode;
+        uint16_t top;
+        if (!peek(cpu, branch, &opcode) || !is_branch(opcode) || !peek_word(cpu, branch + 1, &top)) continue;
+        if (!match_at(cpu, top, loop, ops)) continue;
+        for (uint8_t i = 1; i < loop->num_ops; i++) {
+            if (ops[i] == cpu->pc) {
+                loop->steps = loop->num_ops - i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,23 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// A busy-wait loop: a load from a port or memory, an optional test of A and a
+// conditional jump back to the load, e.g. IN 10h / ANI 01h / JZ loop.
+// Nothing in the loop writes, so once it has gone round with a value every
+// further round leaves the cpu in the same state until that value changes.
+typedef struct {
+    uint16_t top;     // address of the load
+    uint8_t steps;    // instructions from pc to top
+    uint8_t num_ops;  // instructions in one round
+    uint8_t cycles;   // T-states of one round
+} PollLoop;
+
+// Recognizes a polling loop that pc is in. Only loads whose value cannot change
+// under the loop qualify: RAM and ROM, and ports that are unattached or stable.
+bool poll_find(Cpu* cpu, PollLoop* loop);
+
+#endif
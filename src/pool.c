@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* tasks;
+    size_t head; // next task to steal
+    size_t tail; // one past the next task to run locally
+} Deque;
+
+typedef struct {
+    Deque* deques;
+    unsigned num_threads;
+    void (*fn)(void* arg, size_t task);
+    void* arg;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    unsigned id;
+    uint64_t steals;
+} Worker;
+
+static bool deque_pop(Deque* deque, size_t* task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head != deque->tail;
+    if (found) *task = deque->tasks[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal(Deque* deque, size_t* task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head != deque->tail;
+    if (found) *task = deque->tasks[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// No tasks are added once the pool runs, so a thread that finds every deque
+// empty is done
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    Pool* pool = worker->pool;
+    size_t task;
+    for (;;) {
+        if (deque_pop(&pool->deques[worker->id], &task)) {
+            pool->fn(pool->arg, task);
+            continue;
+        }
+        bool stolen = false;
+        for (unsigned i = 1; i < pool->num_threads && !stolen; i++) {
+            stolen = deque_steal(&pool->deques[(worker->id + i) % pool->num_threads], &task);
+        }
+        if (!stolen) return NULL;
+        worker->steals++;
+        pool->fn(pool->arg, task);
+    }
+}
+
+uint64_t pool_run(size_t num_tasks, unsigned num_threads, void (*fn)(void* arg, size_t task), void* arg) {
+    if (num_threads == 0) num_threads = 1;
+    if (num_threads > num_tasks) num_threads = num_tasks ? num_tasks : 1;
+
+    Pool pool = { calloc(num_threads, sizeof(Deque)), num_threads, fn, arg };
+    Worker* workers = calloc(num_threads, sizeof(Worker));
+    pthread_t* threads = calloc(num_threads, sizeof(pthread_t));
+    size_t* tasks = malloc((num_tasks ? num_tasks : 1) * sizeof(size_t));
+    if (pool.deques == NULL || workers == NULL || threads == NULL || tasks == NULL) {
+        // Fall back to running everything on the calling thread
+        for (size_t task = 0; task < num_tasks; task++) fn(arg, task);
+        free(pool.deques);
+        free(workers);
+        free(threads);
+        free(tasks);
+        return 0;
+    }
+
+    // Deal tasks round-robin, each deque gets a contiguous slice of the array
+    size_t next = 0;
+    for (unsigned t = 0; t < num_threads; t++) {
+        Deque* deque = &pool.deques[t];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->tasks = tasks + next;
+        deque->head = 0;
+        deque->tail = 0;
+        for (size_t task = t; task < num_tasks; task += num_threads) {
+            deque->tasks[deque->tail++] = task;
+        }
+        next += deque->tail;
+    }
+
+    unsigned started = 0;
+    for (unsigned t = 0; t < num_threads; t++) {
+        workers[t].pool = &pool;
+        workers[t].id = t;
+        workers[t].steals = 0;
+        // Thread 0 is the caller
+        if (t > 0 && pthread_create(&threads[t], NULL, worker_main, &workers[t]) != 0) break;
+        started = t + 1;
+    }
+    worker_main(&workers[0]);
+
+    uint64_t steals = workers[0].steals;
+    for (unsigned t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        steals += workers[t].steals;
+    }
+    for (unsigned t = 0; t < num_threads; t++) pthread_mutex_destroy(&pool.deques[t].lock);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    free(tasks);
+    return steals;
+}
+
+unsigned pool_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
@@ -0,0 +1,16 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs fn(arg, task) for every task in [0, num_tasks) on num_threads threads.
+// Tasks are dealt round-robin onto one deque per thread. Each thread takes
+// work from the back of its own deque and, once that is empty, steals from
+// the front of the others. Returns the number of steals.
+uint64_t pool_run(size_t num_tasks, unsigned num_threads, void (*fn)(void* arg, size_t task), void* arg);
+
+// Number of online processors, at least 1
+unsigned pool_default_threads(void);
+
+#endif
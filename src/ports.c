@@ -0,0 +1,66 @@
+#include "ports.h"
+#include <stdlib.h>
+
+Ports* ports_create(void) {
+    return calloc(1, sizeof(Ports));
+}
+
+void ports_destroy(Ports* ports) {
+    free(ports);
+}
+
+void ports_attach(Ports* ports, uint8_t port, PortReadFn read, PortWriteFn write, void* ctx) {
+    ports->device[port] = (PortDevice){ read, write, ctx, false };
+}
+
+void ports_detach(Ports* ports, uint8_t port) {
+    ports->device[port] = (PortDevice){ 0 };
+}
+
+void ports_set_stable(Ports* ports, uint8_t port, bool stable) {
+    ports->device[port].stable = stable;
+}
+
+static uint8_t bulk_read(void* ctx, uint8_t port) {
+    (void)port;
+    PortBulk* bulk = ctx;
+    return bulk->input_pos < bulk->input_len ? bulk->input[bulk->input_pos++] : bulk->end;
+}
+
+static void bulk_write(void* ctx, uint8_t port, uint8_t value) {
+    (void)port;
+    PortBulk* bulk = ctx;
+    if (bulk->output_len == bulk->output_cap) {
+        size_t cap = bulk->output_cap ? bulk->output_cap * 2 : 256;
+        uint8_t* output = realloc(bulk->output, cap);
+        if (output == NULL) {
+            bulk->truncated = true;
+            return;
+        }
+        bulk->output = output;
+        bulk->output_cap = cap;
+    }
+    bulk->output[bulk->output_len++] = value;
+}
+
+void ports_attach_bulk(Ports* ports, uint8_t port, PortBulk* bulk) {
+    ports_attach(ports, port, bulk_read, bulk_write, bulk);
+}
+
+void port_bulk_init(PortBulk* bulk, const uint8_t* input, size_t input_len, uint8_t end) {
+    bulk->input = input;
+    bulk->input_len = input_len;
+    bulk->input_pos = 0;
+    bulk->end = end;
+    bulk->output = NULL;
+    bulk->output_len = 0;
+    bulk->output_cap = 0;
+    bulk->truncated = false;
+}
+
+void port_bulk_free(PortBulk* bulk) {
+    free(bulk->output);
+    bulk->output = NULL;
+    bulk->output_len = 0;
+    bulk->output_cap = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef PORTS_H
+#define PORTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t (*PortReadFn)(void* ctx, uint8_t port);
+typedef void (*PortWriteFn)(void* ctx, uint8_t port, uint8_t value);
+
+// A missing read handler reads 0xFF, a missing write handler drops the write
+typedef struct {
+    PortReadFn read;
+    PortWriteFn write;
+    void* ctx;
+    bool stable; // reads have no side effects and only change when a scheduled event fires
+} PortDevice;
+
+// Device dispatch table behind IN and OUT
+typedef struct Ports {
+    PortDevice device[256];
+} Ports;
+
+// Bulk device: IN serves preloaded input and then end, OUT appends to output
+typedef struct {
+    const uint8_t* input;
+    size_t input_len;
+    size_t input_pos;
+    uint8_t end;
+
+    uint8_t* output;
+    size_t output_len;
+    size_t output_cap;
+    bool truncated; // ran out of memory, later output was dropped
+} PortBulk;
+
+Ports* ports_create(void);
+void ports_destroy(Ports* ports);
+// Either handler may be NULL
+void ports_attach(Ports* ports, uint8_t port, PortReadFn read, PortWriteFn write, void* ctx);
+void ports_detach(Ports* ports, uint8_t port);
+// Lets sched_run skip loops polling the port, see poll.h
+void ports_set_stable(Ports* ports, uint8_t port, bool stable);
+void ports_attach_bulk(Ports* ports, uint8_t port, PortBulk* bulk);
+
+// input is not copied and must outlive the device
+void port_bulk_init(PortBulk* bulk, const uint8_t* input, size_t input_len, uint8_t end);
+void port_bulk_free(PortBulk* bulk);
+
+static inline uint8_t ports_in(const Ports* ports, uint8_t port) {
+    const PortDevice* device = &ports->device[port];
+    return device->read ? device->read(device->ctx, port) : 0xFF;
+}
+
+static inline void ports_out(const Ports* ports, uint8_t port, uint8_t value) {
+    const PortDevice* device = &ports->device[port];
+    if (device->write) device->write(device->ctx, port, value);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "profile.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+
+typedef struct {
+    unsigned key; // opcode or address
+    ProfileCounter counter;
+} ProfileRow;
+
+bool profile_init(Profile* profile) {
+    memset(profile->opcodes, 0, sizeof(profile->opcodes));
+    profile->addrs = calloc(0x10000, sizeof(ProfileCounter));
+    profile->code = NULL;
+    return profile->addrs != NULL;
+}
+
+void profile_free(Profile* profile) {
+    free(profile->addrs);
+    free(profile->code);
+    profile->addrs = NULL;
+    profile->code = NULL;
+}
+
+bool profile_capture(Profile* profile, Cpu* cpu) {
+    if (profile->code == NULL) profile->code = malloc(0x10000);
+    if (profile->code == NULL) return false;
+    for (unsigned addr = 0; addr < 0x10000; addr++) profile->code[addr] = cpu_get_content_addr(cpu, (uint16_t)addr);
+    return true;
+}
+
+// An opcode by itself: the whole text for one-byte instructions, only the
+// mnemonic for those whose operands are not known
+static void opcode_text(char* out, size_t size, uint8_t opcode) {
+    if (disassemble_opcode(out, size, opcode, 0, 0) > 1) out[strcspn(out, " ")] = '\0';
+}
+
+static void addr_text(const Profile* profile, char* out, size_t size, uint16_t addr) {
+    if (profile->code == NULL) {
+        if (size) out[0] = '\0';
+        return;
+    }
+    disassemble_opcode(out, size, profile->code[addr], profile->code[(uint16_t)(addr + 1)],
+                       profile->code[(uint16_t)(addr + 2)]);
+}
+
+// By T-states, then by count, then by key
+static int compare_rows(const void* a, const void* b) {
+    const ProfileRow* x = a;
+    const ProfileRow* y = b;
+    if (x->counter.cycles != y->counter.cycles) return x->counter.cycles < y->counter.cycles ? 1 : -1;
+    if (x->counter.count != y->counter.count) return x->counter.count < y->counter.count ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Returns the counters that ran at least once, sorted, or NULL when out of memory
+static ProfileRow* sorted_rows(const ProfileCounter* counters, unsigned n, size_t* count) {
+    ProfileRow* rows = malloc(n * sizeof(ProfileRow));
+    if (rows == NULL) return NULL;
+    *count = 0;
+    for (unsigned key = 0; key < n; key++) {
+        if (counters[key].count) rows[(*count)++] = (ProfileRow){ key, counters[key] };
+    }
+    qsort(rows, *count, sizeof(ProfileRow), compare_rows);
+    return rows;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+void profile_report(const Profile* profile, FILE* fp, size_t top) {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    for (unsigned opcode = 0; opcode < 256; opcode++) {
+        instructions += profile->opcodes[opcode].count;
+        cycles += profile->opcodes[opcode].cycles;
+    }
+    fprintf(fp, "profile: %" PRIu64 " instructions, %" PRIu64 " T-states\n", instructions, cycles);
+
+    char text[DISASSEMBLY_SIZE];
+    size_t count;
+    ProfileRow* rows = sorted_rows(profile->opcodes, 256, &count);
+    if (rows == NULL) return;
+    fprintf(fp, "\nopcode %-32s %14s %7s %16s %7s\n", "instruction", "count", "%", "T-states", "%");
+    for (size_t i = 0; i < count && i < top; i++) {
+        opcode_text(text, sizeof(text), (uint8_t)rows[i].key);
+        fprintf(fp, "    %02x %-32s %14" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%\n", rows[i].key, text,
+                rows[i].counter.count, percent(rows[i].counter.count, instructions), rows[i].counter.cycles,
+                percent(rows[i].counter.cycles, cycles));
+    }
+    fprintf(fp, "%zu of 256 opcodes ran\n", count);
+    free(rows);
+
+    rows = sorted_rows(profile->addrs, 0x10000, &count);
+    if (rows == NULL) return;
+    fprintf(fp, "\naddr   %-32s %14s %7s %16s %7s\n", "instruction", "count", "%", "T-states", "%");
+    for (size_t i = 0; i < count && i < top; i++) {
+        addr_text(profile, text, sizeof(text), (uint16_t)rows[i].key);
+        fprintf(fp, "  %04x %-32s %14" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%\n", rows[i].key, text,
+                rows[i].counter.count, percent(rows[i].counter.count, instructions), rows[i].counter.cycles,
+                percent(rows[i].counter.cycles, cycles));
+    }
+    fprintf(fp, "%zu addresses ran\n", count);
+    free(rows);
+}
+
+bool profile_dump(const Profile* profile, FILE* fp) {
+    char text[DISASSEMBLY_SIZE];
+    fprintf(fp, "# kind\tkey\tcount\tcycles\tinstruction\n");
+    for (unsigned opcode = 0; opcode < 256; opcode++) {
+        opcode_text(text, sizeof(text), (uint8_t)opcode);
+        fprintf(fp, "opcode\t%02x\t%" PRIu64 "\t%" PRIu64 "\t%s\n", opcode, profile->opcodes[opcode].count,
+                profile->opcodes[opcode].cycles, text);
+    }
+    for (unsigned addr = 0; addr < 0x10000; addr++) {
+        const ProfileCounter* counter = &profile->addrs[addr];
+        if (counter->count == 0) continue;
+        addr_text(profile, text, sizeof(text), (uint16_t)addr);
+        fprintf(fp, "addr\t%04x\t%" PRIu64 "\t%" PRIu64 "\t%s\n", addr, counter->count, counter->cycles, text);
+    }
+    return !ferror(fp);
+}
@@ -0,0 +1,45 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu.h"
+
+#define PROFILE_TOP 20
+
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+} ProfileCounter;
+
+// Executions and T-states per opcode and per instruction address, in flat
+// arrays so counting an instruction is two increments into each, with no
+// lookups. A trapped hook counts under HOOK_OPCODE at its address, with the
+// T-states its host function added.
+typedef struct Profile {
+    ProfileCounter opcodes[256];
+    ProfileCounter* addrs; // 0x10000 counters
+    uint8_t* code;         // memory at the end of the run, set by profile_capture
+} Profile;
+
+bool profile_init(Profile* profile);
+void profile_free(Profile* profile);
+
+static inline void profile_count(Profile* profile, uint16_t pc, uint8_t opcode, uint64_t cycles) {
+    profile->opcodes[opcode].count++;
+    profile->opcodes[opcode].cycles += cycles;
+    profile->addrs[pc].count++;
+    profile->addrs[pc].cycles += cycles;
+}
+
+// Keeps a copy of memory to disassemble the counted addresses from
+bool profile_capture(Profile* profile, Cpu* cpu);
+// Prints the totals and the top opcodes and addresses by T-states
+void profile_report(const Profile* profile, FILE* fp, size_t top);
+// Writes every opcode and every executed address as tab-separated lines of
+// kind, opcode or address in hex, count, T-states and instruction
+bool profile_dump(const Profile* profile, FILE* fp);
+
+#endif
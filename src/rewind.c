@@ -0,0 +1,153 @@
+#include "rewind.h"
+#include <stdlib.h>
+
+static Checkpoint* checkpoint_at(Rewind* rewind, size_t i) {
+    return &rewind->ring[(rewind->first + i) % rewind->capacity];
+}
+
+static void drop_newest(Rewind* rewind) {
+    snapshot_release(&checkpoint_at(rewind, rewind->count - 1)->snapshot);
+    rewind->count--;
+}
+
+bool rewind_init(Rewind* rewind, Cpu* cpu, size_t capacity, uint64_t interval) {
+    rewind->ring = calloc(capacity, sizeof(Checkpoint));
+    if (rewind->ring == NULL || capacity == 0 || interval == 0 || !snapshot_track(&rewind->tracker, cpu)) {
+        free(rewind->ring);
+        rewind->ring = NULL;
+        return false;
+    }
+    rewind->capacity = capacity;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->interval = interval;
+    rewind->step = 0;
+    rewind->next = 0;
+    rewind->replayed = 0;
+    return true;
+}
+
+void rewind_free(Rewind* rewind, Cpu* cpu) {
+    while (rewind->count) drop_newest(rewind);
+    snapshot_untrack(&rewind->tracker, cpu);
+    free(rewind->ring);
+    rewind->ring = NULL;
+}
+
+static void checkpoint(Rewind* rewind, Cpu* cpu) {
+    if (rewind->count == rewind->capacity) {
+        snapshot_release(&rewind->ring[rewind->first].snapshot);
+        rewind->first = (rewind->first + 1) % rewind->capacity;
+        rewind->count--;
+    }
+    Checkpoint* newest = checkpoint_at(rewind, rewind->count);
+    // Out of memory only costs history
+    if (!snapshot_take(&rewind->tracker, cpu, &newest->snapshot)) return;
+    newest->step = rewind->step;
+    rewind->count++;
+}
+
+uint8_t rewind_execute(Rewind* rewind, Cpu* cpu) {
+    if (rewind->step == rewind->next) {
+        checkpoint(rewind, cpu);
+        rewind->next = rewind->step + rewind->interval;
+    }
+    rewind->step++;
+    return cpu_execute(cpu);
+}
+
+// Restores the newest checkpoint at or before step and replays up to it,
+// forgetting the checkpoints after it
+static bool go_to(Rewind* rewind, Cpu* cpu, uint64_t step) {
+    size_t i = rewind->count;
+    while (i > 0 && checkpoint_at(rewind, i - 1)->step > step) i--;
+    if (i == 0) return false;
+    while (rewind->count > i) drop_newest(rewind);
+
+    Checkpoint* from = checkpoint_at(rewind, i - 1);
+    snapshot_restore(&rewind->tracker, cpu, &from->snapshot);
+    for (uint64_t n = from->step; n < step; n++) cpu_execute(cpu);
+    rewind->replayed += step - from->step;
+    rewind->step = step;
+    rewind->next = from->step + rewind->interval;
+    return true;
+}
+
+bool rewind_step_back(Rewind* rewind, Cpu* cpu, uint64_t n) {
+    if (n > rewind->step) return false;
+    return go_to(rewind, cpu, rewind->step - n);
+}
+
+// Runs one instruction and returns whether it wrote addr
+static bool execute_writes(Cpu* cpu, uint16_t addr) {
+    uint8_t opcode = cpu->memory[cpu->pc];
+    uint16_t word = cpu->memory[(uint16_t)(cpu->pc + 2)] << 8 | cpu->memory[(uint16_t)(cpu->pc + 1)];
+    uint16_t sp = cpu->sp;
+    uint16_t target = 0;
+    uint16_t length = 0;
+    switch (opcode) {
+        case 0x02: target = cpu->bc; length = 1; break;
+        case 0x12: target = cpu->de; length = 1; break;
+        case 0x22: target = word; length = 2; break;
+        case 0x32: target = word; length = 1; break;
+        case 0x34: case 0x35: case 0x36:
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
+            target = cpu->hl;
+            length = 1;
+            break;
+        case 0xE3: target = sp; length = 2; break;
+        default: break;
+    }
+    cpu_execute(cpu);
+    // PUSH, RST and taken calls push a word
+    if (length == 0 && opcode >= 0xC0 && opcode != 0xF9 && cpu->sp == (uint16_t)(sp - 2)) {
+        target = cpu->sp;
+        length = 2;
+    }
+    return (uint16_t)(addr - target) < length;
+}
+
+bool rewind_to_write(Rewind* rewind, Cpu* cpu, uint16_t addr) {
+    uint64_t now = rewind->step;
+    // Search the stretches between checkpoints, newest first
+    uint64_t end = now;
+    for (size_t i = rewind->count; i > 0; i--) {
+        Checkpoint* from = checkpoint_at(rewind, i - 1);
+        if (from->step >= end) continue;
+        snapshot_restore(&rewind->tracker, cpu, &from->snapshot);
+        uint64_t found = UINT64_MAX;
+        for (uint64_t n = from->step; n < end; n++) {
+            if (execute_writes(cpu, addr)) found = n;
+        }
+        rewind->replayed += end - from->step;
+        if (found != UINT64_MAX) return go_to(rewind, cpu, found);
+        end = from->step;
+    }
+    go_to(rewind, cpu, now);
+    return false;
+}
+
+static int by_address(const void* x, const void* y) {
+    uintptr_t a = (uintptr_t)*(SnapshotPage* const*)x;
+    uintptr_t b = (uintptr_t)*(SnapshotPage* const*)y;
+    return a < b ? -1 : a > b;
+}
+
+size_t rewind_pages_held(const Rewind* rewind) {
+    size_t total = (rewind->count + 1) * SNAPSHOT_PAGES;
+    SnapshotPage** pages = malloc(total * sizeof(SnapshotPage*));
+    if (pages == NULL) return 0;
+    size_t used = 0;
+    for (size_t i = 0; i < rewind->count; i++) {
+        const Checkpoint* checkpoint = &rewind->ring[(rewind->first + i) % rewind->capacity];
+        for (int page = 0; page < SNAPSHOT_PAGES; page++) pages[used++] = checkpoint->snapshot.pages[page];
+    }
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) pages[used++] = rewind->tracker.pages[page];
+    qsort(pages, used, sizeof(SnapshotPage*), by_address);
+    size_t distinct = 0;
+    for (size_t i = 0; i < used; i++) {
+        if (i == 0 || pages[i] != pages[i - 1]) distinct++;
+    }
+    free(pages);
+    return distinct;
+}
@@ -0,0 +1,49 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "snapshot.h"
+
+typedef struct {
+    Snapshot snapshot;
+    uint64_t step; // instructions run before it was taken
+} Checkpoint;
+
+// Reverse execution for a debugger. Instructions run through rewind_execute
+// are counted, and every interval instructions a copy-on-write snapshot goes
+// into a ring of checkpoints, so history only costs the pages written since
+// the one before. Going back restores the nearest checkpoint and replays
+// forward with cpu_execute. Replay is deterministic as long as ports and
+// interrupts do not feed the cpu anything that differs between runs.
+typedef struct {
+    SnapshotTracker tracker;
+    Checkpoint* ring;
+    size_t capacity;
+    size_t first; // oldest checkpoint
+    size_t count;
+    uint64_t interval;
+    uint64_t step;      // instructions run so far
+    uint64_t next;      // step of the next checkpoint
+    uint64_t replayed;  // instructions run again while going back
+} Rewind;
+
+// Starts tracking cpu. History reaches back between (capacity - 1) * interval
+// and capacity * interval instructions.
+bool rewind_init(Rewind* rewind, Cpu* cpu, size_t capacity, uint64_t interval);
+void rewind_free(Rewind* rewind, Cpu* cpu);
+// cpu_execute with a checkpoint every interval instructions
+uint8_t rewind_execute(Rewind* rewind, Cpu* cpu);
+// Goes back n instructions. Returns false, leaving the cpu as it was, if that
+// is before the oldest checkpoint.
+bool rewind_step_back(Rewind* rewind, Cpu* cpu, uint64_t n);
+// Goes back to the last instruction that wrote addr, so it is the next one to
+// run. Returns false, leaving the cpu as it was, if no instruction since the
+// oldest checkpoint wrote it.
+bool rewind_to_write(Rewind* rewind, Cpu* cpu, uint16_t addr);
+// Distinct memory pages held by the checkpoints
+size_t rewind_pages_held(const Rewind* rewind);
+
+#endif
@@ -0,0 +1,103 @@
+#include "sampler.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define C SAMPLER_CALL
+#define R SAMPLER_RET
+const uint8_t sampler_flow[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    R, 0, 0, 0, C, 0, 0, C, R, R, 0, 0, C, C, 0, C,
+    R, 0, 0, 0, C, 0, 0, C, R, 0, 0, 0, C, 0, 0, C,
+    R, 0, 0, 0, C, 0, 0, C, R, 0, 0, 0, C, 0, 0, C,
+    R, 0, 0, 0, C, 0, 0, C, R, 0, 0, 0, C, 0, 0, C
+};
+#undef C
+#undef R
+
+#define ROOT 0
+#define NONE UINT32_MAX
+
+// Returns the child of parent for entry, added if missing, or NONE when out of memory
+static uint32_t child_node(Sampler* sampler, uint32_t parent, uint16_t entry) {
+    uint32_t node = sampler->nodes[parent].child;
+    for (; node != NONE; node = sampler->nodes[node].sibling) {
+        if (sampler->nodes[node].entry == entry) return node;
+    }
+    if (sampler->node_count == sampler->node_cap) {
+        size_t cap = sampler->node_cap * 2;
+        SamplerNode* nodes = realloc(sampler->nodes, cap * sizeof(SamplerNode));
+        if (nodes == NULL) return NONE;
+        sampler->nodes = nodes;
+        sampler->node_cap = cap;
+    }
+    node = (uint32_t)sampler->node_count++;
+    sampler->nodes[node] = (SamplerNode){ entry, parent, NONE, sampler->nodes[parent].child, 0 };
+    sampler->nodes[parent].child = node;
+    return node;
+}
+
+bool sampler_init(Sampler* sampler, uint64_t interval) {
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->interval = interval ? interval : SAMPLER_INTERVAL;
+    sampler->next_sample = sampler->interval;
+    sampler->node_cap = 256;
+    sampler->nodes = malloc(sampler->node_cap * sizeof(SamplerNode));
+    if (sampler->nodes == NULL) return false;
+    sampler->nodes[ROOT] = (SamplerNode){ 0, NONE, NONE, NONE, 0 };
+    sampler->node_count = 1;
+    return true;
+}
+
+void sampler_start(Sampler* sampler, Cpu* cpu) {
+    sampler->nodes[ROOT].entry = cpu->pc;
+    sampler->next_sample = cpu->cycles + sampler->interval;
+    sampler->depth = 0;
+}
+
+void sampler_free(Sampler* sampler) {
+    free(sampler->nodes);
+    sampler->nodes = NULL;
+    sampler->node_count = 0;
+}
+
+void sampler_sample(Sampler* sampler, Cpu* cpu) {
+    // An instruction, or a hook, longer than the interval counts once per interval
+    uint64_t weight = (cpu->cycles - sampler->next_sample) / sampler->interval + 1;
+    sampler->next_sample += weight * sampler->interval;
+    sampler->samples += weight;
+
+    while (sampler->depth && sampler->frames[sampler->depth - 1].sp < cpu->sp) sampler->depth--;
+    uint32_t node = ROOT;
+    for (size_t i = 0; i < sampler->depth && node != NONE; i++) {
+        node = child_node(sampler, node, sampler->frames[i].entry);
+    }
+    if (node == NONE) sampler->lost_samples += weight;
+    else sampler->nodes[node].samples += weight;
+}
+
+bool sampler_write(const Sampler* sampler, const SymbolTable* symbols, FILE* fp) {
+    uint32_t path[SAMPLER_MAX_DEPTH + 1];
+    char name[64];
+    for (size_t node = 0; node < sampler->node_count; node++) {
+        if (sampler->nodes[node].samples == 0) continue;
+        size_t depth = 0;
+        for (uint32_t n = (uint32_t)node; n != NONE; n = sampler->nodes[n].parent) path[depth++] = n;
+        while (depth--) {
+            symbols_name(symbols, sampler->nodes[path[depth]].entry, name, sizeof(name));
+            fprintf(fp, "%s%c", name, depth ? ';' : ' ');
+        }
+        fprintf(fp, "%llu\n", (unsigned long long)sampler->nodes[node].samples);
+    }
+    return !ferror(fp);
+}
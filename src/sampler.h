@@ -0,0 +1,77 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu.h"
+#include "symbols.h"
+
+#define SAMPLER_MAX_DEPTH 256
+#define SAMPLER_INTERVAL 10000
+
+enum { SAMPLER_OTHER, SAMPLER_CALL, SAMPLER_RET };
+// CALL, conditional CALL and RST push a return address, RET and conditional RET pop one
+extern const uint8_t sampler_flow[256];
+
+typedef struct {
+    uint16_t entry; // address called
+    uint16_t sp;    // stack slot holding the return address
+} SamplerFrame;
+
+// Call tree node, the root is the routine running when sampling started
+typedef struct {
+    uint16_t entry;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t sibling;
+    uint64_t samples; // samples with this node on top
+} SamplerNode;
+
+// Samples the guest call stack every interval T-states. The stack is a
+// shadow of the one in guest memory: taken calls push a frame and taken
+// returns drop every frame at or below the slot they popped. A frame whose
+// slot is below SP by the time of a sample was left without a RET, by a POP
+// and a jump or a reset SP, and is dropped too. Interrupts taken outside
+// the run loop are not seen, their RET drops nothing.
+typedef struct Sampler {
+    uint64_t interval;
+    uint64_t next_sample; // cpu->cycles of the next sample
+    SamplerFrame frames[SAMPLER_MAX_DEPTH];
+    size_t depth;
+    SamplerNode* nodes;
+    size_t node_count;
+    size_t node_cap;
+    uint64_t samples;
+    uint64_t lost_frames; // calls not shadowed past SAMPLER_MAX_DEPTH
+    uint64_t lost_samples; // samples dropped when the tree could not grow
+} Sampler;
+
+// interval 0 picks SAMPLER_INTERVAL
+bool sampler_init(Sampler* sampler, uint64_t interval);
+// Starts sampling cpu from where it is now, with its routine as the root
+void sampler_start(Sampler* sampler, Cpu* cpu);
+void sampler_free(Sampler* sampler);
+void sampler_sample(Sampler* sampler, Cpu* cpu);
+
+// Follows calls and returns and takes the samples that are due, after an
+// instruction with opcode ran with SP at sp
+static inline void sampler_step(Sampler* sampler, Cpu* cpu, uint8_t opcode, uint16_t sp) {
+    uint8_t flow = sampler_flow[opcode];
+    if (flow == SAMPLER_CALL && cpu->sp == (uint16_t)(sp - 2)) {
+        if (sampler->depth < SAMPLER_MAX_DEPTH) sampler->frames[sampler->depth++] = (SamplerFrame){ cpu->pc, cpu->sp };
+        else sampler->lost_frames++;
+    }
+    else if (flow == SAMPLER_RET && cpu->sp == (uint16_t)(sp + 2)) {
+        while (sampler->depth && sampler->frames[sampler->depth - 1].sp < cpu->sp) sampler->depth--;
+    }
+    if (cpu->cycles >= sampler->next_sample) sampler_sample(sampler, cpu);
+}
+
+// Writes one line per call stack sampled, its routines from the root up
+// separated by semicolons and then its sample count, as flamegraph.pl reads.
+// Routines are named from symbols, which may be empty.
+bool sampler_write(const Sampler* sampler, const SymbolTable* symbols, FILE* fp);
+
+#endif
@@ -0,0 +1,153 @@
+#include "sched.h"
+#include <stdlib.h>
+#include "input_log.h"
+#include "poll.h"
+
+// T-states between checks for a polling loop
+#define POLL_INTERVAL 2048
+
+static bool before(const Event* x, const Event* y) {
+    return x->time < y->time || (x->time == y->time && x->seq < y->seq);
+}
+
+static bool push_event(Scheduler* sched, Event event) {
+    if (sched->count == sched->cap) {
+        size_t cap = sched->cap ? sched->cap * 2 : 16;
+        Event* heap = realloc(sched->heap, cap * sizeof(Event));
+        if (heap == NULL) return false;
+        sched->heap = heap;
+        sched->cap = cap;
+    }
+    event.seq = sched->seq++;
+    size_t i = sched->count++;
+    while (i > 0 && before(&event, &sched->heap[(i - 1) / 2])) {
+        sched->heap[i] = sched->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sched->heap[i] = event;
+    return true;
+}
+
+static Event pop_event(Scheduler* sched) {
+    Event top = sched->heap[0];
+    Event last = sched->heap[--sched->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= sched->count) break;
+        if (child + 1 < sched->count && before(&sched->heap[child + 1], &sched->heap[child])) child++;
+        if (!before(&sched->heap[child], &last)) break;
+        sched->heap[i] = sched->heap[child];
+        i = child;
+    }
+    if (sched->count) sched->heap[i] = last;
+    return top;
+}
+
+void sched_init(Scheduler* sched) {
+    sched->heap = NULL;
+    sched->count = 0;
+    sched->cap = 0;
+    sched->seq = 0;
+    sched->irq = 0;
+    sched->skip_polls = true;
+    sched->log = NULL;
+    sched->events_fired = 0;
+    sched->interrupts_taken = 0;
+    sched->polls_skipped = 0;
+    sched->poll_cycles_skipped = 0;
+}
+
+void sched_free(Scheduler* sched) {
+    free(sched->heap);
+    sched_init(sched);
+}
+
+bool sched_post(Scheduler* sched, uint64_t time, EventFn fn, void* ctx) {
+    return push_event(sched, (Event){ .time = time, .fn = fn, .ctx = ctx });
+}
+
+bool sched_post_interrupt(Scheduler* sched, uint64_t time, uint8_t n) {
+    return push_event(sched, (Event){ .time = time, .irq = n & 7 });
+}
+
+void sched_request_interrupt(Scheduler* sched, uint8_t n) {
+    sched->irq |= 1 << (n & 7);
+}
+
+uint64_t sched_next(const Scheduler* sched) {
+    return sched->count ? sched->heap[0].time : UINT64_MAX;
+}
+
+void sched_dispatch(Scheduler* sched, uint64_t now) {
+    while (sched->count && sched->heap[0].time <= now) {
+        Event event = pop_event(sched);
+        sched->events_fired++;
+        if (event.fn) event.fn(sched, event.ctx, event.time);
+        else sched_request_interrupt(sched, event.irq);
+    }
+}
+
+static bool deliver_interrupt(Scheduler* sched, Cpu* cpu) {
+    uint8_t n = 7;
+    while (!(sched->irq >> n & 1)) n--;
+    uint64_t time = cpu->cycles;
+    if (!cpu_interrupt(cpu, n)) return false;
+    sched->irq &= ~(1 << n);
+    sched->interrupts_taken++;
+    if (sched->log) input_log_interrupt(sched->log, sched, time, n);
+    return true;
+}
+
+// Steps onto the top of a polling loop and through one round. If the loop goes
+// round again the cpu is back in the same state, so rounds that end before the
+// next event can be credited without running them.
+static void skip_poll(Scheduler* sched, Cpu* cpu, uint64_t next) {
+    PollLoop loop;
+    if (!poll_find(cpu, &loop)) return;
+    for (unsigned i = 0; i < loop.steps + loop.num_ops; i++) {
+        if (cpu->cycles >= next || (i == loop.steps && cpu->pc != loop.top)) return;
+        cpu_execute(cpu);
+    }
+    if (cpu->pc != loop.top || cpu->cycles >= next) return;
+    uint64_t rounds = (next - cpu->cycles) / loop.cycles;
+    if (rounds == 0) return;
+    cpu->cycles += rounds * loop.cycles;
+    sched->polls_skipped++;
+    sched->poll_cycles_skipped += rounds * loop.cycles;
+}
+
+uint64_t sched_run(Scheduler* sched, Cpu* cpu, uint64_t cycle_budget) {
+    uint64_t start = cpu->cycles;
+    uint64_t end = cycle_budget > UINT64_MAX - start ? UINT64_MAX : start + cycle_budget;
+    while (cpu->cycles < end) {
+        sched_dispatch(sched, cpu->cycles);
+        if (sched->irq) {
+            if (deliver_interrupt(sched, cpu)) continue;
+            // Only an interrupt wakes a halted cpu, with INTE clear it waits for events
+            if (!cpu->halted) {
+                cpu_execute(cpu);
+                continue;
+            }
+        }
+        uint64_t next = sched_next(sched);
+        // Nothing left that could wake the cpu
+        if (cpu->halted && next == UINT64_MAX) break;
+        if (next > end) next = end;
+        // A halted cpu skips straight to the next event
+        if (cpu->halted) {
+            cpu->cycles = next;
+            continue;
+        }
+        if (!sched->skip_polls) {
+            cpu_run(cpu, next - cpu->cycles);
+            continue;
+        }
+        // Look for a polling loop every so often, the cpu may enter one mid-slice
+        skip_poll(sched, cpu, next);
+        if (cpu->cycles >= next) continue;
+        uint64_t slice = next - cpu->cycles;
+        cpu_run(cpu, slice < POLL_INTERVAL ? slice : POLL_INTERVAL);
+    }
+    return cpu->cycles - start;
+}
@@ -0,0 +1,63 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+struct Scheduler;
+struct InputLog;
+
+// Called once cpu->cycles reaches time. May post further events or request interrupts.
+typedef void (*EventFn)(struct Scheduler* sched, void* ctx, uint64_t time);
+
+typedef struct {
+    uint64_t time;
+    uint64_t seq; // events due at the same time fire in posting order
+    EventFn fn;   // NULL for an interrupt request
+    void* ctx;
+    uint8_t irq;
+} Event;
+
+// Future events in a binary min-heap keyed on emulated cycle time, and the
+// RST interrupt requests waiting for the cpu to accept them
+typedef struct Scheduler {
+    Event* heap;
+    size_t count;
+    size_t cap;
+    uint64_t seq;
+    uint8_t irq; // bit n set while RST n is requested
+    bool skip_polls; // fast-forward busy-wait loops to the next event, on by default
+    struct InputLog* log; // set by input_log_attach_sched, NULL otherwise
+
+    uint64_t events_fired;
+    uint64_t interrupts_taken;
+    uint64_t polls_skipped;       // busy-wait loops fast-forwarded
+    uint64_t poll_cycles_skipped; // T-states they would have spun for
+} Scheduler;
+
+void sched_init(Scheduler* sched);
+void sched_free(Scheduler* sched);
+// Returns false if the event could not be stored
+bool sched_post(Scheduler* sched, uint64_t time, EventFn fn, void* ctx);
+// Requests RST n at time
+bool sched_post_interrupt(Scheduler* sched, uint64_t time, uint8_t n);
+// Requests RST n right away. Requests stay pending until the cpu accepts one,
+// the highest n first as with an 8214 priority controller.
+void sched_request_interrupt(Scheduler* sched, uint8_t n);
+// Time of the earliest event, UINT64_MAX if there is none
+uint64_t sched_next(const Scheduler* sched);
+// Fires every event due by now
+void sched_dispatch(Scheduler* sched, uint64_t now);
+// Runs the cpu for at least cycle_budget T-states. The dispatch loop only
+// hands control back at the next event, interrupts are delivered in between.
+// While a request waits for the cpu to enable interrupts the cpu is stepped
+// one instruction at a time. A halted cpu jumps straight to the next event. With
+// no event left to wake it sched_run returns early with cpu->halted set. A cpu
+// spinning in a polling loop (see poll.h) skips whole rounds up to the next
+// event, which ends in the same state as running them.
+// Returns the T-states consumed.
+uint64_t sched_run(Scheduler* sched, Cpu* cpu, uint64_t cycle_budget);
+
+#endif
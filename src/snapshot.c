@@ -0,0 +1,196 @@
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+#include "block_cache.h"
+
+// Header: magic, version, a f b c d e h l, sp, pc, interrupt, halted,
+// ei_cycles, cycles, then a bitmap of the pages that are not all zero and
+// those pages in order. Numbers are little-endian.
+static const uint8_t magic[8] = { '8', '0', '8', '0', 'S', 'N', 'A', 'P' };
+#define HEADER_SIZE 42
+#define BITMAP_SIZE (SNAPSHOT_PAGES / 8)
+
+static void put(uint8_t* p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = value >> (8 * i);
+}
+
+static uint64_t get(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) value = value << 8 | p[i];
+    return value;
+}
+
+static SnapshotRegs capture(Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    return (SnapshotRegs){ cpu->a, cpu->f, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l, cpu->sp, cpu->pc,
+        cpu->interrupt, cpu->halted, cpu->ei_cycles, cpu->cycles };
+}
+
+static void apply(Cpu* cpu, const SnapshotRegs* regs) {
+    cpu->a = regs->a;
+    cpu->f = regs->f;
+#ifdef CPU_LAZY_FLAGS
+    cpu->lazy_op = LAZY_NONE;
+#endif
+    cpu->b = regs->b;
+    cpu->c = regs->c;
+    cpu->d = regs->d;
+    cpu->e = regs->e;
+    cpu->h = regs->h;
+    cpu->l = regs->l;
+    cpu->sp = regs->sp;
+    cpu->pc = regs->pc;
+    cpu->interrupt = regs->interrupt;
+    cpu->halted = regs->halted;
+    cpu->ei_cycles = regs->ei_cycles;
+    cpu->cycles = regs->cycles;
+}
+
+static bool zero_page(const uint8_t* page) {
+    for (int i = 0; i < SNAPSHOT_PAGE_SIZE; i++) {
+        if (page[i]) return false;
+    }
+    return true;
+}
+
+bool snapshot_save(Cpu* cpu, FILE* fp) {
+    SnapshotRegs regs = capture(cpu);
+    uint8_t header[HEADER_SIZE + BITMAP_SIZE] = { 0 };
+    memcpy(header, magic, sizeof(magic));
+    put(header + 8, SNAPSHOT_VERSION, 2);
+    uint8_t r[8] = { regs.a, regs.f, regs.b, regs.c, regs.d, regs.e, regs.h, regs.l };
+    memcpy(header + 12, r, sizeof(r));
+    put(header + 20, regs.sp, 2);
+    put(header + 22, regs.pc, 2);
+    header[24] = regs.interrupt;
+    header[25] = regs.halted;
+    put(header + 26, regs.ei_cycles, 8);
+    put(header + 34, regs.cycles, 8);
+    uint8_t* bitmap = header + HEADER_SIZE;
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        if (!zero_page(cpu->memory + (page << SNAPSHOT_PAGE_BITS))) bitmap[page / 8] |= 1 << (page % 8);
+    }
+
+    if (fwrite(header, sizeof(header), 1, fp) != 1) return false;
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        if (!(bitmap[page / 8] >> (page % 8) & 1)) continue;
+        if (fwrite(cpu->memory + (page << SNAPSHOT_PAGE_BITS), SNAPSHOT_PAGE_SIZE, 1, fp) != 1) return false;
+    }
+    return fflush(fp) == 0;
+}
+
+bool snapshot_load(Cpu* cpu, FILE* fp) {
+    uint8_t header[HEADER_SIZE + BITMAP_SIZE];
+    if (fread(header, sizeof(header), 1, fp) != 1) return false;
+    if (memcmp(header, magic, sizeof(magic)) != 0 || get(header + 8, 2) != SNAPSHOT_VERSION) return false;
+
+    // Read into a copy first so a short file leaves the cpu as it was
+    uint8_t* memory = malloc(0x10000);
+    if (memory == NULL) return false;
+    const uint8_t* bitmap = header + HEADER_SIZE;
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        uint8_t* data = memory + (page << SNAPSHOT_PAGE_BITS);
+        if (!(bitmap[page / 8] >> (page % 8) & 1)) memset(data, 0, SNAPSHOT_PAGE_SIZE);
+        else if (fread(data, SNAPSHOT_PAGE_SIZE, 1, fp) != 1) {
+            free(memory);
+            return false;
+        }
+    }
+
+    const uint8_t* r = header + 12;
+    SnapshotRegs regs = { r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], (uint16_t)get(header + 20, 2),
+        (uint16_t)get(header + 22, 2), header[24] != 0, header[25] != 0, get(header + 26, 8), get(header + 34, 8) };
+    apply(cpu, &regs);
+    memcpy(cpu->memory, memory, 0x10000);
+    free(memory);
+    if (cpu->block_cache) block_cache_flush(cpu->block_cache);
+    if (cpu->dirty) memset(cpu->dirty, 1, SNAPSHOT_PAGES);
+    return true;
+}
+
+uint64_t snapshot_hash(Cpu* cpu) {
+    SnapshotRegs regs = capture(cpu);
+    uint8_t bytes[] = { regs.a, regs.f, regs.b, regs.c, regs.d, regs.e, regs.h, regs.l, regs.sp >> 8, regs.sp & 0xFF,
+        regs.pc >> 8, regs.pc & 0xFF, regs.interrupt, regs.halted };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(bytes); i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    for (int i = 0; i < 8; i++) hash = (hash ^ (regs.cycles >> (i * 8) & 0xFF)) * 0x100000001b3ULL;
+    for (size_t i = 0; i < 0x10000; i++) hash = (hash ^ cpu->memory[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+static SnapshotPage* copy_page(const uint8_t* data) {
+    SnapshotPage* page = malloc(sizeof(SnapshotPage));
+    if (page == NULL) return NULL;
+    page->refs = 1;
+    memcpy(page->data, data, SNAPSHOT_PAGE_SIZE);
+    return page;
+}
+
+static void release_page(SnapshotPage* page) {
+    if (page && --page->refs == 0) free(page);
+}
+
+bool snapshot_track(SnapshotTracker* tracker, Cpu* cpu) {
+    memset(tracker, 0, sizeof(*tracker));
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        tracker->pages[page] = copy_page(cpu->memory + (page << SNAPSHOT_PAGE_BITS));
+        if (tracker->pages[page] == NULL) {
+            snapshot_untrack(tracker, cpu);
+            return false;
+        }
+    }
+    tracker->pages_copied = SNAPSHOT_PAGES;
+    cpu->dirty = tracker->dirty;
+    return true;
+}
+
+void snapshot_untrack(SnapshotTracker* tracker, Cpu* cpu) {
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        release_page(tracker->pages[page]);
+        tracker->pages[page] = NULL;
+    }
+    if (cpu->dirty == tracker->dirty) cpu->dirty = NULL;
+}
+
+bool snapshot_take(SnapshotTracker* tracker, Cpu* cpu, Snapshot* snapshot) {
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        if (!tracker->dirty[page]) continue;
+        SnapshotPage* copy = copy_page(cpu->memory + (page << SNAPSHOT_PAGE_BITS));
+        if (copy == NULL) return false;
+        release_page(tracker->pages[page]);
+        tracker->pages[page] = copy;
+        tracker->dirty[page] = 0;
+        tracker->pages_copied++;
+    }
+    snapshot->regs = capture(cpu);
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        snapshot->pages[page] = tracker->pages[page];
+        snapshot->pages[page]->refs++;
+    }
+    return true;
+}
+
+void snapshot_restore(SnapshotTracker* tracker, Cpu* cpu, const Snapshot* snapshot) {
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        SnapshotPage* want = snapshot->pages[page];
+        if (tracker->pages[page] == want && !tracker->dirty[page]) continue;
+        uint8_t* data = cpu->memory + (page << SNAPSHOT_PAGE_BITS);
+        memcpy(data, want->data, SNAPSHOT_PAGE_SIZE);
+        if (cpu->block_cache) {
+            for (int i = 0; i < SNAPSHOT_PAGE_SIZE; i++) block_cache_write(cpu->block_cache, (page << SNAPSHOT_PAGE_BITS) + i);
+        }
+        want->refs++;
+        release_page(tracker->pages[page]);
+        tracker->pages[page] = want;
+        tracker->dirty[page] = 0;
+    }
+    apply(cpu, &snapshot->regs);
+}
+
+void snapshot_release(Snapshot* snapshot) {
+    for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+        release_page(snapshot->pages[page]);
+        snapshot->pages[page] = NULL;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PAGE_BITS 8
+#define SNAPSHOT_PAGE_SIZE (1 << SNAPSHOT_PAGE_BITS)
+#define SNAPSHOT_PAGES (0x10000 >> SNAPSHOT_PAGE_BITS)
+
+// Everything of a Cpu that a snapshot restores besides memory, f already synced
+typedef struct {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp, pc;
+    bool interrupt;
+    bool halted;
+    uint64_t ei_cycles;
+    uint64_t cycles;
+} SnapshotRegs;
+
+// A page of memory shared by every snapshot taken while it stayed clean
+typedef struct {
+    uint32_t refs;
+    uint8_t data[SNAPSHOT_PAGE_SIZE];
+} SnapshotPage;
+
+typedef struct {
+    SnapshotRegs regs;
+    SnapshotPage* pages[SNAPSHOT_PAGES];
+} Snapshot;
+
+// Copy-on-write snapshots of one Cpu. While attached, every write through the
+// core marks its page in dirty. Taking a snapshot copies only the dirty pages
+// and shares the others with the previous one, restoring one copies only the
+// pages that differ from memory.
+typedef struct {
+    uint8_t dirty[SNAPSHOT_PAGES]; // pages written since the last snapshot or restore
+    SnapshotPage* pages[SNAPSHOT_PAGES]; // memory as of the last snapshot or restore
+    uint64_t pages_copied;
+} SnapshotTracker;
+
+// Writes registers, flags, interrupt state, cycles and memory in the versioned
+// format, returns false on a write error
+bool snapshot_save(Cpu* cpu, FILE* fp);
+// Reads a saved state into cpu and its memory, returns false if the file is
+// short, corrupt or of another version
+bool snapshot_load(Cpu* cpu, FILE* fp);
+
+// FNV-1a over registers, flags, interrupt state, cycles and memory
+uint64_t snapshot_hash(Cpu* cpu);
+
+// Copies memory once and starts tracking writes through cpu->dirty. Snapshots
+// cover the flat cpu->memory, not a bus. JIT translated blocks are not run
+// while tracking, their stores bypass it. Host code that writes guest memory
+// directly must set the dirty flag of the page.
+bool snapshot_track(SnapshotTracker* tracker, Cpu* cpu);
+void snapshot_untrack(SnapshotTracker* tracker, Cpu* cpu);
+// O(dirty pages)
+bool snapshot_take(SnapshotTracker* tracker, Cpu* cpu, Snapshot* snapshot);
+// O(pages that differ), cached blocks over them are invalidated
+void snapshot_restore(SnapshotTracker* tracker, Cpu* cpu, const Snapshot* snapshot);
+void snapshot_release(Snapshot* snapshot);
+
+#endif
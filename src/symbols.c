@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+#include "symbols.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void symbols_init(SymbolTable* table) {
+    table->symbols = NULL;
+    table->count = 0;
+}
+
+void symbols_free(SymbolTable* table) {
+    for (size_t i = 0; i < table->count; i++) free(table->symbols[i].name);
+    free(table->symbols);
+    symbols_init(table);
+}
+
+// A hex address, with an optional 0x or $ prefix or H suffix
+static bool parse_addr(const char* s, uint16_t* addr) {
+    if (s[0] == '$') s++;
+    else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+    char* end;
+    unsigned long value = strtoul(s, &end, 16);
+    if (*end == 'h' || *end == 'H') end++;
+    if (end == s || *end != '\0' || value > 0xFFFF) return false;
+    *addr = (uint16_t)value;
+    return true;
+}
+
+// Blanks, and the ^Z padding at the end of a CP/M text file
+#define DELIMITERS " \t\r\n\x1a"
+
+static int compare_symbols(const void* a, const void* b) {
+    const Symbol* x = a;
+    const Symbol* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+bool symbols_load(SymbolTable* table, const char* filename, int* line) {
+    *line = 0;
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) return false;
+    size_t cap = table->count;
+    bool out_of_memory = false;
+    char text[1024];
+    for (int n = 1; !out_of_memory && fgets(text, sizeof(text), fp); n++) {
+        char* addr_arg = strtok(text, DELIMITERS);
+        if (addr_arg && (addr_arg[0] == ';' || addr_arg[0] == '#')) continue;
+        for (; addr_arg; addr_arg = strtok(NULL, DELIMITERS)) {
+            char* name = strtok(NULL, DELIMITERS);
+            uint16_t addr;
+            if (name == NULL || !parse_addr(addr_arg, &addr)) {
+                *line = n;
+                fclose(fp);
+                return false;
+            }
+            if (table->count == cap) {
+                cap = cap ? cap * 2 : 64;
+                Symbol* symbols = realloc(table->symbols, cap * sizeof(Symbol));
+                if (symbols == NULL) break;
+                table->symbols = symbols;
+            }
+            char* copy = strdup(name);
+            if (copy == NULL) break;
+            table->symbols[table->count++] = (Symbol){ addr, copy };
+        }
+        out_of_memory = addr_arg != NULL;
+    }
+    bool ok = feof(fp) && !ferror(fp);
+    fclose(fp);
+    qsort(table->symbols, table->count, sizeof(Symbol), compare_symbols);
+    return ok;
+}
+
+void symbols_name(const SymbolTable* table, uint16_t addr, char* out, size_t size) {
+    // Last symbol at or below addr
+    size_t lo = 0, hi = table->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (table->symbols[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) snprintf(out, size, "%04x", addr);
+    else if (table->symbols[lo - 1].addr == addr) snprintf(out, size, "%s", table->symbols[lo - 1].name);
+    else snprintf(out, size, "%s+%x", table->symbols[lo - 1].name, addr - table->symbols[lo - 1].addr);
+}
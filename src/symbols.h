@@ -0,0 +1,30 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    uint16_t addr;
+    char* name;
+} Symbol;
+
+// Guest addresses and their names, sorted by address
+typedef struct {
+    Symbol* symbols;
+    size_t count;
+} SymbolTable;
+
+void symbols_init(SymbolTable* table);
+void symbols_free(SymbolTable* table);
+// Reads pairs of a hex address and a name, one or more per line, as in the
+// .SYM files of L80 and SID, such as "0100 START\t0E93 LOOP". Blank lines and
+// lines starting with ; or # are skipped. Returns false if the file could not
+// be read, with *line set to the first line that does not hold pairs, or 0.
+bool symbols_load(SymbolTable* table, const char* filename, int* line);
+// Writes the name of the nearest symbol at or below addr, with +offset when
+// it is below, or the address in hex when there is none
+void symbols_name(const SymbolTable* table, uint16_t addr, char* out, size_t size);
+
+#endif
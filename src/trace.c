@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 199309L
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Magic, then version, record size and a byte order mark in host order, as
+// are the records that follow
+static const char magic[8] = { '8', '0', '8', '0', 'T', 'R', 'C', 'E' };
+#define BYTE_ORDER_MARK 0x0102
+
+#define RING_MASK (TRACE_RING_RECORDS - 1)
+
+static void pause_briefly(void) {
+    struct timespec ts = { 0, 50000 };
+    nanosleep(&ts, NULL);
+}
+
+static void* writer_main(void* arg) {
+    TraceRing* ring = arg;
+    for (;;) {
+        // Read done before head, so a ring found empty after done was set stays empty
+        bool done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;
+        if (head == tail) {
+            if (done) return NULL;
+            pause_briefly();
+            continue;
+        }
+        // Up to the end of the buffer, the rest goes on the next round
+        size_t first = tail & RING_MASK;
+        size_t count = head - tail;
+        if (count > TRACE_RING_RECORDS - first) count = TRACE_RING_RECORDS - first;
+        if (!ring->write_error && fwrite(ring->records + first, sizeof(TraceRecord), count, ring->fp) != count) {
+            ring->write_error = true;
+        }
+        __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    }
+}
+
+bool trace_open(TraceRing* ring, FILE* fp) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fp = fp;
+    ring->records = malloc(TRACE_RING_RECORDS * sizeof(TraceRecord));
+    if (ring->records == NULL) return false;
+    uint16_t fields[4] = { TRACE_VERSION, sizeof(TraceRecord), BYTE_ORDER_MARK, 0 };
+    if (fwrite(magic, sizeof(magic), 1, fp) != 1 || fwrite(fields, sizeof(fields), 1, fp) != 1 ||
+        pthread_create(&ring->writer, NULL, writer_main, ring) != 0) {
+        free(ring->records);
+        ring->records = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool trace_close(TraceRing* ring) {
+    __atomic_store_n(&ring->done, true, __ATOMIC_RELEASE);
+    pthread_join(ring->writer, NULL);
+    free(ring->records);
+    ring->records = NULL;
+    return !ring->write_error && fflush(ring->fp) == 0;
+}
+
+void trace_end(TraceRing* ring, TraceRecord* record, Cpu* cpu) {
+    cpu_sync_flags(cpu);
+    record->cycles = cpu->cycles;
+    record->next_pc = cpu->pc;
+    record->sp = cpu->sp;
+    record->a = cpu->a;
+    record->f = cpu->f;
+    record->b = cpu->b;
+    record->c = cpu->c;
+    record->d = cpu->d;
+    record->e = cpu->e;
+    record->h = cpu->h;
+    record->l = cpu->l;
+    memset(record->unused, 0, sizeof(record->unused));
+
+    size_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS) {
+        ring->stalls++;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS) pause_briefly();
+    }
+    ring->records[head & RING_MASK] = *record;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+bool trace_read_header(FILE* fp) {
+    char file_magic[8];
+    uint16_t fields[4];
+    return fread(file_magic, sizeof(file_magic), 1, fp) == 1 && memcmp(file_magic, magic, sizeof(magic)) == 0 &&
+        fread(fields, sizeof(fields), 1, fp) == 1 && fields[0] == TRACE_VERSION &&
+        fields[1] == sizeof(TraceRecord) && fields[2] == BYTE_ORDER_MARK;
+}
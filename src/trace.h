@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "cpu.h"
+
+#define TRACE_VERSION 1
+#define TRACE_RING_RECORDS 65536 // a power of two
+
+// One executed instruction: its address and bytes, and the registers, flags
+// and cycle count once it, or the hook it traps into, has run. 32 bytes.
+typedef struct {
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t next_pc;
+    uint16_t sp;
+    uint8_t opcode, lo, hi;
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t unused[7];
+} TraceRecord;
+
+// Single-producer single-consumer ring of records. The cpu thread appends and
+// a writer thread drains them to a file in large writes. head and tail only
+// grow, each is written by one side and read by the other with acquire and
+// release ordering, so neither side takes a lock.
+typedef struct {
+    TraceRecord* records;
+    size_t head; // next record the cpu thread fills
+    size_t tail; // next record the writer thread saves
+    bool done;
+    FILE* fp;
+    pthread_t writer;
+    bool write_error;
+    uint64_t stalls; // times the cpu thread found the ring full
+} TraceRing;
+
+// Writes the file header and starts the writer thread
+bool trace_open(TraceRing* ring, FILE* fp);
+// Drains the ring and stops the writer thread, returns false on a write error
+bool trace_close(TraceRing* ring);
+
+// Fills in the instruction at pc, before it runs
+static inline void trace_begin(TraceRecord* record, Cpu* cpu) {
+    record->pc = cpu->pc;
+    record->opcode = cpu_get_content_addr(cpu, cpu->pc);
+    record->lo = cpu_get_content_addr(cpu, cpu->pc + 1);
+    record->hi = cpu_get_content_addr(cpu, cpu->pc + 2);
+}
+
+// Fills in the state after the instruction and appends the record, waiting
+// for the writer if the ring is full
+void trace_end(TraceRing* ring, TraceRecord* record, Cpu* cpu);
+
+// Reads the header of a trace file, returns false if it is not one this build can read
+bool trace_read_header(FILE* fp);
+
+#endif
@@ -0,0 +1,95 @@
+// Generates the flag lookup tables declared in src/flags.h.
+// The formulas mirror the original per-instruction flag helpers so the
+// tables are equivalent to computing the flags on the fly.
+#include <stdio.h>
+#include <stdint.h>
+#include "flags.h"
+
+static uint8_t parity(uint8_t val) {
+    uint8_t num_bits = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (val & 0x1) num_bits++;
+        val = val >> 1;
+    }
+    return (num_bits % 2 == 0);
+}
+
+static uint8_t szp(uint8_t val) {
+    uint8_t f = 0;
+    if (val & 0x80) f |= FLAG_S;
+    if (val == 0) f |= FLAG_Z;
+    if (parity(val)) f |= FLAG_P;
+    return f;
+}
+
+static uint8_t add_flags(uint8_t a, uint8_t b, uint8_t cy) {
+    uint8_t result = a + b + cy;
+    uint8_t f = szp(result);
+    if (((a & 0xF) + (b & 0xF) + cy) & 0x10) f |= FLAG_A;
+    if (a + b + cy > UINT8_MAX) f |= FLAG_C;
+    return f;
+}
+
+static uint8_t sub_flags(uint8_t a, uint8_t b, uint8_t cy) {
+    uint8_t result = a - b - cy;
+    uint8_t f = szp(result);
+    if (((a & 0xF) + (~b & 0xF) + !cy) & 0x10) f |= FLAG_A; // a - b = a + (-b)
+    if (a - b - cy < 0) f |= FLAG_C;
+    return f;
+}
+
+static uint16_t daa(uint8_t a, uint8_t cf, uint8_t af) {
+    uint8_t least_sig_4_bits = a & 0xF;
+    uint8_t most_sig_4_bits = a >> 4;
+    uint8_t correction = 0;
+    uint8_t cy = 0;
+    if (least_sig_4_bits > 9 || af) {
+        correction |= 0x06;
+    }
+    if (most_sig_4_bits > 9 || cf || (most_sig_4_bits >= 9 && least_sig_4_bits > 9)) {
+        correction |= 0x60;
+        cy = 1;
+    }
+    uint8_t f = add_flags(a, correction, 0) & ~FLAG_C;
+    if (cy) f |= FLAG_C;
+    return (uint8_t)(a + correction) << 8 | f;
+}
+
+static void print_row(uint16_t (*entry)(int), int base, const char* fmt) {
+    printf("{");
+    for (int i = 0; i < 256; i++) {
+        if (i % 16 == 0) printf("\n    ");
+        printf(fmt, entry(base + i));
+    }
+    printf("\n}");
+}
+
+static void print_table(const char* decl, int planes, int rows, uint16_t (*entry)(int), const char* fmt) {
+    printf("%s = {\n", decl);
+    for (int plane = 0; plane < planes; plane++) {
+        if (planes > 1) printf("{\n");
+        for (int row = 0; row < rows; row++) {
+            print_row(entry, (plane * rows + row) * 256, fmt);
+            printf(",\n");
+        }
+        if (planes > 1) printf("},\n");
+    }
+    printf("};\n\n");
+}
+
+static uint16_t szp_entry(int i) { return szp(i); }
+static uint16_t add_entry(int i) { return add_flags(i >> 8 & 0xFF, i & 0xFF, i >> 16); }
+static uint16_t sub_entry(int i) { return sub_flags(i >> 8 & 0xFF, i & 0xFF, i >> 16); }
+static uint16_t daa_entry(int i) { return daa(i & 0xFF, i >> 9 & 1, i >> 8 & 1); }
+
+int main(void) {
+    printf("// Generated by tools/gen_flags.c, do not edit\n");
+    printf("#include \"flags.h\"\n\n");
+    printf("const uint8_t szp_table[256] = ");
+    print_row(szp_entry, 0, "0x%02x,");
+    printf(";\n\n");
+    print_table("const uint8_t add_flags_table[2][256][256]", 2, 256, add_entry, "0x%02x,");
+    print_table("const uint8_t sub_flags_table[2][256][256]", 2, 256, sub_entry, "0x%02x,");
+    print_table("const uint16_t daa_table[4][256]", 1, 4, daa_entry, "0x%04x,");
+    return 0;
+}
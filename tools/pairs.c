@@ -0,0 +1,103 @@
+// Mines opcode pair and triple frequencies from real runs of CP/M roms, to
+// pick the superinstructions fused by the block cache. Runs each rom to
+// completion one instruction at a time with BDOS calls stubbed out and prints
+// the most frequent sequences, with their share of all executed instructions.
+// Pairs whose first opcode ends a basic block can never be fused and are
+// left out.
+// Usage: pairs [-n count] romfile...
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define MEMORY_SIZE 0x10000
+#define DEFAULT_TOP 24
+
+typedef struct {
+    uint32_t seq; // opcodes, oldest in the highest byte
+    uint64_t count;
+} Entry;
+
+static uint64_t pair_counts[0x10000];
+static uint64_t triple_counts[0x1000000];
+
+static int by_count(const void* x, const void* y) {
+    const Entry* a = x;
+    const Entry* b = y;
+    return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+static unsigned char* load_rom(const char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return NULL;
+    unsigned char* memory = calloc(MEMORY_SIZE, 1);
+    if (memory) fread(memory + 0x100, 1, MEMORY_SIZE - 0x100, fp);
+    fclose(fp);
+    return memory;
+}
+
+static void print_top(const char* title, const uint64_t* counts, size_t size, int width, int top, uint64_t total) {
+    Entry* entries = malloc(size * sizeof(Entry));
+    if (entries == NULL) exit(EXIT_FAILURE);
+    size_t used = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (counts[i]) entries[used++] = (Entry){ (uint32_t)i, counts[i] };
+    }
+    qsort(entries, used, sizeof(Entry), by_count);
+    printf("%s\n", title);
+    double cumulative = 0;
+    for (size_t i = 0; i < used && i < (size_t)top; i++) {
+        double share = 100.0 * entries[i].count / total;
+        cumulative += share;
+        printf("  ");
+        for (int byte = width - 1; byte >= 0; byte--) printf("%02x ", entries[i].seq >> (byte * 8) & 0xFF);
+        printf("%14llu %6.2f%% %6.2f%%\n", (unsigned long long)entries[i].count, share, cumulative);
+    }
+    free(entries);
+}
+
+int main(int argc, char** argv) {
+    int top = DEFAULT_TOP;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        top = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || top <= 0) {
+        fprintf(stderr, "Usage: %s [-n count] romfile...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t total = 0;
+    for (int i = first; i < argc; i++) {
+        unsigned char* memory = load_rom(argv[i]);
+        if (memory == NULL) {
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        // BDOS calls return straight away, warm boot ends the run
+        memory[0x07] = 0xC9;
+        Cpu cpu;
+        cpu_init(&cpu, memory);
+        uint32_t history = 0;
+        uint64_t executed = 0;
+        for (; cpu.pc != 0x0000; executed++) {
+            uint8_t opcode = memory[cpu.pc];
+            cpu_execute(&cpu);
+            history = (history << 8 | opcode) & 0xFFFFFF;
+            if (executed >= 1 && !cpu_opcode_ends_block(history >> 8 & 0xFF)) {
+                pair_counts[history & 0xFFFF]++;
+                if (executed >= 2 && !cpu_opcode_ends_block(history >> 16)) triple_counts[history]++;
+            }
+        }
+        total += executed;
+        cpu_free(&cpu);
+        free(memory);
+    }
+
+    printf("%llu instructions\n", (unsigned long long)total);
+    print_top("pairs", pair_counts, 0x10000, 2, top, total);
+    print_top("triples", triple_counts, 0x1000000, 3, top, total);
+    return 0;
+}
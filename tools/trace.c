@@ -0,0 +1,58 @@
+// Renders a binary trace written by --trace in the text format of --debug:
+// each instruction disassembled, then the registers after it ran.
+// Usage: trace tracefile
+#include <stdio.h>
+#include <stdlib.h>
+#include "cpu.h"
+#include "debug.h"
+#include "trace.h"
+
+#define RECORDS_PER_READ 4096
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s tracefile\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    FILE* fp = fopen(argv[1], "rb");
+    if (fp == NULL || !trace_read_header(fp)) {
+        fprintf(stderr, "%s is not a trace this build can read\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    // disassemble() and register_state() read a Cpu, so each record is put back into one
+    unsigned char* memory = calloc(0x10000, 1);
+    TraceRecord* records = malloc(RECORDS_PER_READ * sizeof(TraceRecord));
+    if (memory == NULL || records == NULL) exit(EXIT_FAILURE);
+    Cpu cpu;
+    cpu_init(&cpu, memory);
+    size_t count;
+    while ((count = fread(records, sizeof(TraceRecord), RECORDS_PER_READ, fp)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            const TraceRecord* record = &records[i];
+            memory[record->pc] = record->opcode;
+            memory[(uint16_t)(record->pc + 1)] = record->lo;
+            memory[(uint16_t)(record->pc + 2)] = record->hi;
+            cpu.pc = record->pc;
+            disassemble(&cpu);
+
+            cpu.a = record->a;
+            cpu.f = record->f;
+            cpu.b = record->b;
+            cpu.c = record->c;
+            cpu.d = record->d;
+            cpu.e = record->e;
+            cpu.h = record->h;
+            cpu.l = record->l;
+            cpu.sp = record->sp;
+            cpu.pc = record->next_pc;
+            cpu.cycles = record->cycles;
+            register_state(&cpu);
+        }
+    }
+    cpu_free(&cpu);
+    free(records);
+    free(memory);
+    fclose(fp);
+    return 0;
+}